@@ -1,15 +1,22 @@
+#include <linux/bitmap.h>
 #include <linux/capability.h>
 #include <linux/compiler.h>
+#include <linux/crc32.h>
 #include <linux/fs.h>
 #include <linux/gfp.h>
+#include <linux/hashtable.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/printk.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
 #include <linux/task_work.h>
 #include <linux/types.h>
 #include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
 #include <linux/sched/task.h>
 #else
@@ -24,13 +31,25 @@
 #include "klog.h" // IWYU pragma: keep
 #include "ksud.h"
 #include "manager.h"
+#include "profile_codec.h"
 #include "selinux/selinux.h"
+#include "status_page.h"
 #ifndef CONFIG_KSU_HYMOFS
 #include "syscall_hook_manager.h"
 #endif // #ifndef CONFIG_KSU_HYMOFS
 
 #define FILE_MAGIC 0x7f4b5355 // ' KSU', u32
-#define FILE_FORMAT_VERSION 3 // u32
+#define FILE_FORMAT_VERSION 4 // u32
+// fixed size struct app_profile records, only read for migration
+#define FILE_FORMAT_VERSION_V3 3
+
+// sanity limit for the snapshot, a v4 profile is usually well below 100B
+#define ALLOWLIST_MAX_SIZE (16 * 1024 * 1024)
+
+struct allowlist_file_hdr {
+	u32 magic;
+	u32 version;
+};
 
 #define KSU_APP_PROFILE_PRESERVE_UID 9999 // NOBODY_UID
 #define KSU_DEFAULT_SELINUX_DOMAIN "u:r:" KERNEL_SU_DOMAIN ":s0"
@@ -41,37 +60,223 @@ static DEFINE_MUTEX(allowlist_mutex);
 static struct root_profile default_root_profile;
 static struct non_root_profile default_non_root_profile;
 
-static int allow_list_arr[PAGE_SIZE / sizeof(int)] __read_mostly
-    __aligned(PAGE_SIZE);
-static int allow_list_pointer __read_mostly = 0;
+/*
+ * Allowed uids, split by Android user: users[user_id] is a bitmap of the
+ * appids granted root in that user, or NULL if there are none. The map is
+ * copy-on-write, readers only dereference it under RCU and writers build
+ * and publish a new one under allowlist_mutex. Between allow_uid_map_begin()
+ * and allow_uid_map_commit() updates go to one unpublished draft, so a bulk
+ * change copies each touched bitmap once and publishes once.
+ */
+struct allow_uid_map {
+	struct rcu_head rcu;
+	// bit n set: users[n] was dropped by the map that retired this one
+	unsigned long *stale;
+	u32 nr_users;
+	unsigned long *users[];
+};
+
+#define ALLOW_BITMAP_SIZE (BITS_TO_LONGS(PER_USER_RANGE) * sizeof(long))
+
+static struct allow_uid_map __rcu *allow_uid_map;
+// everything below is under allowlist_mutex
+static struct allow_uid_map *allow_uid_draft;
+static unsigned int allow_uid_batch;
+
+static void allow_uid_map_free_stale(struct allow_uid_map *map)
+{
+	u32 i;
+
+	for (i = 0; i < map->nr_users; i++) {
+		if (test_bit(i, map->stale))
+			vfree(map->users[i]);
+	}
+	kfree(map->stale);
+	vfree(map);
+}
+
+static void allow_uid_map_free_rcu(struct rcu_head *head)
+{
+	allow_uid_map_free_stale(
+	    container_of(head, struct allow_uid_map, rcu));
+}
+
+static struct allow_uid_map *allow_uid_map_current(void)
+{
+	if (allow_uid_draft)
+		return allow_uid_draft;
+	return rcu_dereference_protected(allow_uid_map,
+					 lockdep_is_held(&allowlist_mutex));
+}
+
+// Whether draft bitmap n is still the published one and must be copied
+static bool allow_uid_map_shared(u32 user)
+{
+	struct allow_uid_map *pub = rcu_dereference_protected(
+	    allow_uid_map, lockdep_is_held(&allowlist_mutex));
+
+	return pub && user < pub->nr_users &&
+	       pub->users[user] == allow_uid_draft->users[user];
+}
+
+// Makes sure the draft exists and has a slot for user
+static bool allow_uid_draft_reserve(u32 user)
+{
+	struct allow_uid_map *cur = allow_uid_map_current(), *new;
+	u32 nr_users = cur ? max(cur->nr_users, user + 1) : user + 1;
+
+	if (allow_uid_draft && user < allow_uid_draft->nr_users)
+		return true;
+
+	new = vzalloc(sizeof(*new) + nr_users * sizeof(new->users[0]));
+	if (!new)
+		return false;
+
+	new->nr_users = nr_users;
+	if (cur)
+		memcpy(new->users, cur->users,
+		       cur->nr_users * sizeof(new->users[0]));
+	// an outgrown draft was never published, just drop its shell
+	vfree(allow_uid_draft);
+	allow_uid_draft = new;
+	return true;
+}
 
-static void remove_uid_from_arr(uid_t uid)
+static void allow_uid_map_publish(void)
 {
-	int *temp_arr;
-	int i, j;
+	struct allow_uid_map *old, *new = allow_uid_draft;
+	u32 i;
 
-	if (allow_list_pointer == 0)
+	if (!new)
 		return;
 
-	temp_arr = kzalloc(sizeof(allow_list_arr), GFP_KERNEL);
-	if (temp_arr == NULL) {
-		pr_err("%s: unable to allocate memory\n", __func__);
+	allow_uid_draft = NULL;
+	old = rcu_dereference_protected(allow_uid_map,
+					lockdep_is_held(&allowlist_mutex));
+	rcu_assign_pointer(allow_uid_map, new);
+	if (!old)
+		return;
+
+	old->stale = kcalloc(BITS_TO_LONGS(old->nr_users), sizeof(long),
+			     GFP_KERNEL);
+	if (!old->stale) {
+		// no room to note the dropped bitmaps, free them after a wait
+		synchronize_rcu();
+		for (i = 0; i < old->nr_users; i++) {
+			if (i >= new->nr_users ||
+			    new->users[i] != old->users[i])
+				vfree(old->users[i]);
+		}
+		vfree(old);
 		return;
 	}
 
-	for (i = j = 0; i < allow_list_pointer; i++) {
-		if (allow_list_arr[i] == uid)
-			continue;
-		temp_arr[j++] = allow_list_arr[i];
+	for (i = 0; i < old->nr_users; i++) {
+		if (old->users[i] &&
+		    (i >= new->nr_users || new->users[i] != old->users[i]))
+			__set_bit(i, old->stale);
 	}
+	call_rcu(&old->rcu, allow_uid_map_free_rcu);
+}
 
-	allow_list_pointer = j;
+// caller must hold allowlist_mutex
+static void allow_uid_map_begin(void)
+{
+	allow_uid_batch++;
+}
+
+// caller must hold allowlist_mutex
+static void allow_uid_map_commit(void)
+{
+	if (!WARN_ON(!allow_uid_batch) && !--allow_uid_batch)
+		allow_uid_map_publish();
+}
+
+// caller must hold allowlist_mutex
+static bool allow_uid_map_update(uid_t uid, bool allow)
+{
+	struct allow_uid_map *cur = allow_uid_map_current();
+	unsigned long *bits = NULL;
+	u32 user = uid / PER_USER_RANGE;
+	u32 appid = uid % PER_USER_RANGE;
 
-	for (; j < ARRAY_SIZE(allow_list_arr); j++)
-		temp_arr[j] = -1;
+	if (cur && user < cur->nr_users)
+		bits = cur->users[user];
 
-	memcpy(&allow_list_arr, temp_arr, PAGE_SIZE);
-	kfree(temp_arr);
+	// nothing to do if the bit already has the wanted value
+	if (bits ? !!test_bit(appid, bits) == allow : !allow)
+		return true;
+
+	if (!allow_uid_draft_reserve(user))
+		goto oom;
+
+	bits = allow_uid_draft->users[user];
+	if (!bits || allow_uid_map_shared(user)) {
+		bits = vmalloc(ALLOW_BITMAP_SIZE);
+		if (!bits)
+			goto oom;
+		if (allow_uid_draft->users[user])
+			memcpy(bits, allow_uid_draft->users[user],
+			       ALLOW_BITMAP_SIZE);
+		else
+			memset(bits, 0, ALLOW_BITMAP_SIZE);
+		allow_uid_draft->users[user] = bits;
+	}
+
+	if (allow) {
+		__set_bit(appid, bits);
+	} else {
+		__clear_bit(appid, bits);
+		if (bitmap_empty(bits, PER_USER_RANGE)) {
+			vfree(bits);
+			allow_uid_draft->users[user] = NULL;
+		}
+	}
+
+	if (!allow_uid_batch)
+		allow_uid_map_publish();
+	return true;
+
+oom:
+	pr_err("%s: unable to allocate memory\n", __func__);
+	if (!allow_uid_batch)
+		allow_uid_map_publish();
+	return false;
+}
+
+static bool allow_uid_map_test(uid_t uid)
+{
+	struct allow_uid_map *map;
+	u32 user = uid / PER_USER_RANGE;
+	bool allowed = false;
+
+	rcu_read_lock();
+	map = rcu_dereference(allow_uid_map);
+	if (map && user < map->nr_users && map->users[user])
+		allowed = test_bit(uid % PER_USER_RANGE, map->users[user]);
+	rcu_read_unlock();
+
+	return allowed;
+}
+
+static void allow_uid_map_destroy(void)
+{
+	struct allow_uid_map *map;
+	u32 i;
+
+	// a draft only exists inside a batch, which never spans exit
+	WARN_ON(allow_uid_draft);
+
+	map = rcu_dereference_protected(allow_uid_map,
+					lockdep_is_held(&allowlist_mutex));
+	RCU_INIT_POINTER(allow_uid_map, NULL);
+	if (!map)
+		return;
+
+	synchronize_rcu();
+	for (i = 0; i < map->nr_users; i++)
+		vfree(map->users[i]);
+	vfree(map);
 }
 
 static void init_default_profiles(void)
@@ -91,30 +296,84 @@ static void init_default_profiles(void)
 	default_non_root_profile.umount_modules = true;
 }
 
+/*
+ * Profiles are kept in a hash table keyed by uid. Readers (setuid, umount
+ * and su hot paths) only take rcu_read_lock(); writers serialize on
+ * allowlist_mutex and never modify a published entry in place, they publish
+ * a new copy and free the old one after a grace period.
+ */
+#define KSU_ALLOWLIST_HASH_BITS 8
+
 struct perm_data {
-	struct list_head list;
+	struct hlist_node node;
+	struct rcu_head rcu;
+	// JOURNAL_OP_* not flushed yet, protected by allowlist_mutex
+	u8 journal_op;
 	struct app_profile profile;
 };
 
-static struct list_head allow_list;
-
-static uint8_t allow_list_bitmap[PAGE_SIZE] __read_mostly __aligned(PAGE_SIZE);
-#define BITMAP_UID_MAX ((sizeof(allow_list_bitmap) * BITS_PER_BYTE) - 1)
+static DEFINE_HASHTABLE(allow_list, KSU_ALLOWLIST_HASH_BITS);
 
 #define KERNEL_SU_ALLOWLIST "/data/adb/ksu/.allowlist"
+// a compaction is written here and renamed over the snapshot once synced
+#define KERNEL_SU_ALLOWLIST_TMP "/data/adb/ksu/.allowlist.tmp"
+#define KERNEL_SU_ALLOWLIST_JOURNAL "/data/adb/ksu/.allowlist.journal"
+
+#define JOURNAL_MAGIC 0x4a4b5355 // 'JKSU', u32
+#define JOURNAL_OP_ADD 1
+#define JOURNAL_OP_UPDATE 2
+#define JOURNAL_OP_DELETE 3
+
+#define ALLOWLIST_JOURNAL_MAX_RECORDS 256
+#define ALLOWLIST_FLUSH_DELAY msecs_to_jiffies(500)
+// retries after a failed compaction back off up to this
+#define ALLOWLIST_RETRY_MAX msecs_to_jiffies(5 * 60 * 1000)
+
+struct allowlist_journal_hdr {
+	u32 magic;
+	u16 op;
+	u16 reserved;
+	u32 len; // payload length
+	u32 crc; // crc32 of the payload
+};
+
+struct journal_delete_record {
+	u32 uid;
+	char key[KSU_MAX_PACKAGE_NAME];
+};
+
+// deletions not flushed yet, protected by allowlist_mutex
+struct deleted_profile {
+	struct list_head list;
+	struct journal_delete_record rec;
+};
+
+static LIST_HEAD(deleted_profiles);
+static u32 journal_records;
+static bool allowlist_need_compact;
+// delay of the next retry after a failed compaction, 0 after a success
+static unsigned long allowlist_retry_delay;
+static unsigned long allowlist_flush_queued;
+// a profile was added that the throne tracker hasn't pruned against yet
+static bool allowlist_added = true;
+
+static void allowlist_flush_work_func(struct work_struct *work);
+static DECLARE_DELAYED_WORK(allowlist_flush_work, allowlist_flush_work_func);
 
 void persistent_allow_list(void);
+static void schedule_allow_list_flush(void);
 
 void ksu_show_allow_list(void)
 {
 	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
+	int bkt;
 	pr_info("ksu_show_allow_list\n");
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
+	rcu_read_lock();
+	hash_for_each_rcu (allow_list, bkt, p, node) {
 		pr_info("uid :%d, allow: %d\n", p->profile.current_uid,
 			p->profile.allow_su);
 	}
+	rcu_read_unlock();
 }
 
 #ifdef CONFIG_KSU_DEBUG
@@ -132,28 +391,51 @@ static void ksu_grant_root_to_shell(void)
 }
 #endif // #ifdef CONFIG_KSU_DEBUG
 
-bool ksu_get_app_profile(struct app_profile *profile)
+struct app_profile *ksu_get_app_profile_rcu(uid_t uid)
 {
 	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
+
+	hash_for_each_possible_rcu (allow_list, p, node, uid) {
+		if (p->profile.current_uid == uid)
+			return &p->profile;
+	}
+
+	return NULL;
+}
+
+bool ksu_get_app_profile(struct app_profile *profile)
+{
+	struct app_profile *p;
 	bool found = false;
-	bool uid_match = false;
-
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
-		uid_match = profile->current_uid == p->profile.current_uid;
-		if (uid_match) {
-			// found it, override it with ours
-			memcpy(profile, &p->profile, sizeof(*profile));
-			found = true;
-			goto exit;
-		}
+
+	rcu_read_lock();
+	p = ksu_get_app_profile_rcu(profile->current_uid);
+	if (p) {
+		// found it, override it with ours
+		memcpy(profile, p, sizeof(*profile));
+		found = true;
 	}
+	rcu_read_unlock();
 
-exit:
 	return found;
 }
 
+// caller must hold allowlist_mutex
+static struct perm_data *find_perm_data_locked(uid_t uid, const char *key)
+{
+	struct perm_data *p = NULL;
+
+	hash_for_each_possible (allow_list, p, node, uid) {
+		// both uid and package must match, otherwise it will break
+		// multiple package with different user id
+		if (p->profile.current_uid == uid &&
+		    !strcmp(p->profile.key, key))
+			return p;
+	}
+
+	return NULL;
+}
+
 static inline bool forbid_system_uid(uid_t uid)
 {
 #define SHELL_UID 2000
@@ -185,38 +467,34 @@ static bool profile_valid(struct app_profile *profile)
 	return true;
 }
 
-bool ksu_set_app_profile(struct app_profile *profile, bool persist)
+// caller must hold allowlist_mutex
+static bool set_app_profile_locked(struct app_profile *profile, bool persist)
 {
 	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
-	bool result = false;
+	struct perm_data *old = NULL;
 
-	if (!profile_valid(profile)) {
-		pr_err("Failed to set app profile: invalid profile!\n");
-		return false;
-	}
-
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
-		// both uid and package must match, otherwise it will break
-		// multiple package with different user id
-		if (profile->current_uid == p->profile.current_uid &&
-		    !strcmp(profile->key, p->profile.key)) {
-			// found it, just override it all!
-			memcpy(&p->profile, profile, sizeof(*profile));
-			result = true;
-			goto out;
-		}
-	}
-
-	// not found, alloc a new node!
 	p = (struct perm_data *)kzalloc(sizeof(struct perm_data), GFP_KERNEL);
 	if (!p) {
 		pr_err("ksu_set_app_profile alloc failed\n");
 		return false;
 	}
-
 	memcpy(&p->profile, profile, sizeof(*profile));
+
+	old = find_perm_data_locked(profile->current_uid, profile->key);
+	if (old) {
+		if (!persist)
+			p->journal_op = old->journal_op;
+		else if (old->journal_op == JOURNAL_OP_ADD)
+			p->journal_op = JOURNAL_OP_ADD;
+		else
+			p->journal_op = JOURNAL_OP_UPDATE;
+		// found it, readers may still see the old one until the grace
+		// period ends, so replace it instead of overriding in place.
+		hlist_replace_rcu(&old->node, &p->node);
+		kfree_rcu(old, rcu);
+		goto out;
+	}
+
 	if (profile->allow_su) {
 		pr_info("set root profile, key: %s, uid: %d, gid: %d, context: "
 			"%s\n",
@@ -229,36 +507,15 @@ bool ksu_set_app_profile(struct app_profile *profile, bool persist)
 		    profile->key, profile->current_uid,
 		    profile->nrp_config.profile.umount_modules);
 	}
-	list_add_tail(&p->list, &allow_list);
+	p->journal_op = persist ? JOURNAL_OP_ADD : 0;
+	allowlist_added = true;
+	hlist_add_tail_rcu(
+	    &p->node,
+	    &allow_list[hash_min(profile->current_uid, HASH_BITS(allow_list))]);
 
 out:
-	if (profile->current_uid <= BITMAP_UID_MAX) {
-		if (profile->allow_su)
-			allow_list_bitmap[profile->current_uid /
-					  BITS_PER_BYTE] |=
-			    1 << (profile->current_uid % BITS_PER_BYTE);
-		else
-			allow_list_bitmap[profile->current_uid /
-					  BITS_PER_BYTE] &=
-			    ~(1 << (profile->current_uid % BITS_PER_BYTE));
-	} else {
-		if (profile->allow_su) {
-			/*
-			 * 1024 apps with uid higher than BITMAP_UID_MAX
-			 * registered to request superuser?
-			 */
-			if (allow_list_pointer >= ARRAY_SIZE(allow_list_arr)) {
-				pr_err("too many apps registered\n");
-				WARN_ON(1);
-				return false;
-			}
-			allow_list_arr[allow_list_pointer++] =
-			    profile->current_uid;
-		} else {
-			remove_uid_from_arr(profile->current_uid);
-		}
-	}
-	result = true;
+	if (!allow_uid_map_update(profile->current_uid, profile->allow_su))
+		return false;
 
 	// check if the default profiles is changed, cache it to a single struct
 	// to accelerate access.
@@ -274,8 +531,54 @@ out:
 		       sizeof(default_root_profile));
 	}
 
+	ksu_status_allowlist_changed();
+	return true;
+}
+
+// caller must hold allowlist_mutex
+static void del_app_profile_locked(uid_t uid, const char *key, bool persist)
+{
+	struct perm_data *p = NULL;
+	struct deleted_profile *d;
+
+	p = find_perm_data_locked(uid, key);
+	if (!p)
+		return;
+
 	if (persist) {
-		persistent_allow_list();
+		d = kzalloc(sizeof(*d), GFP_KERNEL);
+		if (d) {
+			d->rec.uid = uid;
+			strscpy(d->rec.key, key, sizeof(d->rec.key));
+			list_add_tail(&d->list, &deleted_profiles);
+		} else {
+			// can't journal it, fall back to a full rewrite
+			allowlist_need_compact = true;
+		}
+	}
+
+	// key may point into p, don't touch it after this
+	hash_del_rcu(&p->node);
+	allow_uid_map_update(uid, false);
+	kfree_rcu(p, rcu);
+	ksu_status_allowlist_changed();
+}
+
+bool ksu_set_app_profile(struct app_profile *profile, bool persist)
+{
+	bool result = false;
+
+	if (!profile_valid(profile)) {
+		pr_err("Failed to set app profile: invalid profile!\n");
+		return false;
+	}
+
+	mutex_lock(&allowlist_mutex);
+	result = set_app_profile_locked(profile, persist);
+	mutex_unlock(&allowlist_mutex);
+
+	if (result && persist) {
+		schedule_allow_list_flush();
 #if !defined(CONFIG_KSU_HYMOFS) && !defined(CONFIG_KSU_MANUAL_HOOK)
 		// FIXME: use a new flag
 		ksu_mark_running_process();
@@ -287,8 +590,6 @@ out:
 
 bool __ksu_is_allow_uid(uid_t uid)
 {
-	int i;
-
 	if (forbid_system_uid(uid)) {
 		// do not bother going through the list if it's system
 		return false;
@@ -300,17 +601,7 @@ bool __ksu_is_allow_uid(uid_t uid)
 		return true;
 	}
 
-	if (likely(uid <= BITMAP_UID_MAX)) {
-		return !!(allow_list_bitmap[uid / BITS_PER_BYTE] &
-			  (1 << (uid % BITS_PER_BYTE)));
-	} else {
-		for (i = 0; i < allow_list_pointer; i++) {
-			if (allow_list_arr[i] == uid)
-				return true;
-		}
-	}
-
-	return false;
+	return allow_uid_map_test(uid);
 }
 
 bool __ksu_is_allow_uid_for_current(uid_t uid)
@@ -327,211 +618,727 @@ EXPORT_SYMBOL(__ksu_is_allow_uid_for_current);
 
 bool ksu_uid_should_umount(uid_t uid)
 {
-	struct app_profile profile = {.current_uid = uid};
-	bool found = false;
+	struct app_profile *profile;
+	bool should_umount;
 
 	if (likely(ksu_is_manager_uid_valid()) &&
 	    unlikely(ksu_get_manager_uid() == uid)) {
 		// we should not umount on manager!
 		return false;
 	}
-	found = ksu_get_app_profile(&profile);
-	if (!found) {
+
+	rcu_read_lock();
+	profile = ksu_get_app_profile_rcu(uid);
+	if (!profile) {
 		// no app profile found, it must be non root app
-		return default_non_root_profile.umount_modules;
-	}
-	if (profile.allow_su) {
+		should_umount = default_non_root_profile.umount_modules;
+	} else if (profile->allow_su) {
 		// if found and it is granted to su, we shouldn't umount for it
-		return false;
+		should_umount = false;
+	} else if (profile->nrp_config.use_default) {
+		should_umount = default_non_root_profile.umount_modules;
 	} else {
-		// found an app profile
-		if (profile.nrp_config.use_default) {
-			return default_non_root_profile.umount_modules;
-		} else {
-			return profile.nrp_config.profile.umount_modules;
-		}
+		should_umount = profile->nrp_config.profile.umount_modules;
 	}
+	rcu_read_unlock();
+
+	return should_umount;
 }
 
-struct root_profile *ksu_get_root_profile(uid_t uid)
+void ksu_get_root_profile(uid_t uid, struct root_profile *profile)
 {
 	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
-
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
-		if (uid == p->profile.current_uid && p->profile.allow_su) {
-			if (!p->profile.rp_config.use_default) {
-				return &p->profile.rp_config.profile;
-			}
+
+	rcu_read_lock();
+	hash_for_each_possible_rcu (allow_list, p, node, uid) {
+		if (uid == p->profile.current_uid && p->profile.allow_su &&
+		    !p->profile.rp_config.use_default) {
+			memcpy(profile, &p->profile.rp_config.profile,
+			       sizeof(*profile));
+			rcu_read_unlock();
+			return;
 		}
 	}
+	rcu_read_unlock();
 
 	// use default profile
-	return &default_root_profile;
+	memcpy(profile, &default_root_profile, sizeof(*profile));
 }
 
 bool ksu_get_allow_list(int *array, int *length, bool allow)
 {
 	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
 	int i = 0;
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
+	int bkt;
+
+	rcu_read_lock();
+	hash_for_each_rcu (allow_list, bkt, p, node) {
 		// pr_info("get_allow_list uid: %d allow: %d\n", p->uid,
 		// p->allow);
 		if (p->profile.allow_su == allow) {
 			array[i++] = p->profile.current_uid;
 		}
 	}
+	rcu_read_unlock();
 	*length = i;
 
 	return true;
 }
 
-static void do_persistent_allow_list(struct callback_head *_cb)
+/*
+ * Persistence: KERNEL_SU_ALLOWLIST holds a full snapshot and
+ * KERNEL_SU_ALLOWLIST_JOURNAL holds the changes made since, one checksummed
+ * record per added, updated or deleted profile. Changes only mark the entry
+ * dirty and arm allowlist_flush_work, so a burst of updates ends up as a
+ * single flush. Once the journal grows past ALLOWLIST_JOURNAL_MAX_RECORDS
+ * (or a full rewrite is requested) it is folded back into the snapshot.
+ */
+static void write_journal_record(struct file *fp, loff_t *off, u16 op,
+				 const void *payload, u32 len)
 {
-	u32 magic = FILE_MAGIC;
-	u32 version = FILE_FORMAT_VERSION;
+	struct allowlist_journal_hdr hdr = {
+	    .magic = JOURNAL_MAGIC,
+	    .op = op,
+	    .len = len,
+	    .crc = crc32(0, payload, len),
+	};
+
+	if (ksu_kernel_write_compat(fp, &hdr, sizeof(hdr), off) !=
+		sizeof(hdr) ||
+	    ksu_kernel_write_compat(fp, payload, len, off) != len) {
+		pr_err("allowlist journal write failed, op: %d\n", op);
+		// the journal may be torn now, rewrite everything next time
+		allowlist_need_compact = true;
+	}
+}
+
+// caller must hold allowlist_mutex
+static void append_allow_list_journal_locked(void)
+{
+	struct deleted_profile *d, *tmp;
 	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
 	struct file *fp = NULL;
-	loff_t off = 0;
+	loff_t off;
+	int bkt;
 
-	mutex_lock(&allowlist_mutex);
-	fp = ksu_filp_open_compat(KERNEL_SU_ALLOWLIST,
-				  O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	fp = ksu_filp_open_compat(KERNEL_SU_ALLOWLIST_JOURNAL,
+				  O_WRONLY | O_CREAT | O_APPEND, 0644);
 	if (IS_ERR(fp)) {
-		pr_err("save_allow_list create file failed: %ld\n",
-		       PTR_ERR(fp));
-		goto unlock;
+		pr_err("allowlist journal open failed: %ld\n", PTR_ERR(fp));
+		allowlist_need_compact = true;
+		return;
+	}
+	off = i_size_read(file_inode(fp));
+
+	// deletions first, a profile deleted and added again in the same
+	// window is then replayed in the right order.
+	list_for_each_entry_safe (d, tmp, &deleted_profiles, list) {
+		write_journal_record(fp, &off, JOURNAL_OP_DELETE, &d->rec,
+				     sizeof(d->rec));
+		journal_records++;
+		list_del(&d->list);
+		kfree(d);
 	}
 
-	// store magic and version
-	if (ksu_kernel_write_compat(fp, &magic, sizeof(magic), &off) !=
-	    sizeof(magic)) {
-		pr_err("save_allow_list write magic failed.\n");
-		goto close_file;
+	hash_for_each (allow_list, bkt, p, node) {
+		if (!p->journal_op)
+			continue;
+		pr_info("journal allow list, op: %d, name: %s, uid: %d\n",
+			p->journal_op, p->profile.key, p->profile.current_uid);
+		write_journal_record(fp, &off, p->journal_op, &p->profile,
+				     sizeof(p->profile));
+		journal_records++;
+		p->journal_op = 0;
 	}
 
-	if (ksu_kernel_write_compat(fp, &version, sizeof(version), &off) !=
-	    sizeof(version)) {
-		pr_err("save_allow_list write version failed.\n");
-		goto close_file;
+	filp_close(fp, 0);
+}
+
+/*
+ * Encode count profiles as v4 blocks into buf, returns the bytes used or 0
+ * if buf is too small.
+ */
+static size_t encode_profiles(void *buf, size_t size,
+			      struct app_profile **profiles, u32 count)
+{
+	size_t off = 0, len;
+	u32 i, n;
+
+	for (i = 0; i < count; i += n) {
+		n = min_t(u32, count - i, KSU_PROFILE_BLOCK_RECORDS);
+		len = ksu_profile_encode_block(buf + off, size - off,
+					       profiles + i, n);
+		if (!len)
+			return 0;
+		off += len;
 	}
 
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
-		pr_info("save allow list, name: %s uid :%d, allow: %d\n",
-			p->profile.key, p->profile.current_uid,
-			p->profile.allow_su);
+	return off;
+}
+
+/*
+ * Caller must hold allowlist_mutex. Encodes the profiles whose uid is in
+ * [uid_min, uid_max] into a vmalloc'd buffer, leaving reserve bytes in
+ * front of the blocks for a file header.
+ */
+static void *encode_allow_list_locked(size_t reserve, uid_t uid_min,
+				      uid_t uid_max, size_t *size, u32 *count)
+{
+	struct app_profile **profiles;
+	struct perm_data *p = NULL;
+	u32 n = 0, i = 0;
+	size_t bound, len;
+	void *buf = NULL;
+	int bkt;
+
+	hash_for_each (allow_list, bkt, p, node) {
+		if ((uid_t)p->profile.current_uid >= uid_min &&
+		    (uid_t)p->profile.current_uid <= uid_max)
+			n++;
+	}
 
-		ksu_kernel_write_compat(fp, &p->profile, sizeof(p->profile),
-					&off);
+	profiles = vmalloc(max_t(u32, n, 1) * sizeof(*profiles));
+	if (!profiles)
+		return NULL;
+
+	hash_for_each (allow_list, bkt, p, node) {
+		if ((uid_t)p->profile.current_uid >= uid_min &&
+		    (uid_t)p->profile.current_uid <= uid_max)
+			profiles[i++] = &p->profile;
 	}
 
-close_file:
+	bound = reserve + ksu_profile_encode_bound(n);
+	buf = vmalloc(bound);
+	if (!buf)
+		goto out;
+
+	len = encode_profiles(buf + reserve, bound - reserve, profiles, n);
+	if (n && !len) {
+		pr_err("encode allow list failed\n");
+		vfree(buf);
+		buf = NULL;
+		goto out;
+	}
+	*size = reserve + len;
+	*count = n;
+
+out:
+	vfree(profiles);
+	return buf;
+}
+
+// caller must hold allowlist_mutex, returns a vmalloc'd v4 file image
+static void *build_allow_list_image_locked(size_t *size)
+{
+	struct allowlist_file_hdr *hdr;
+	void *buf;
+	u32 count;
+
+	buf = encode_allow_list_locked(sizeof(*hdr), 0, (uid_t)-1, size,
+				       &count);
+	if (!buf) {
+		pr_err("save_allow_list encode failed\n");
+		return NULL;
+	}
+
+	hdr = buf;
+	hdr->magic = FILE_MAGIC;
+	hdr->version = FILE_FORMAT_VERSION;
+	pr_info("save allow list, %u profiles in %zu bytes\n", count, *size);
+
+	return buf;
+}
+
+// called with allowlist_mutex held
+static int verify_profile_cb(struct app_profile *profile, void *data)
+{
+	struct perm_data *p;
+
+	p = find_perm_data_locked(profile->current_uid, profile->key);
+	if (!p || !ksu_profile_equal(&p->profile, profile)) {
+		pr_err("allowlist round trip mismatch, uid: %d, key: %s\n",
+		       profile->current_uid, profile->key);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Caller must hold allowlist_mutex. Decodes a freshly built image and checks
+ * it gives back every profile in memory unchanged, before it may replace the
+ * snapshot (and with it a v3 file on migration).
+ */
+static bool verify_allow_list_image_locked(const void *buf, size_t size)
+{
+	struct perm_data *p = NULL;
+	u32 count = 0;
+	int bkt;
+	int ret;
+
+	hash_for_each (allow_list, bkt, p, node)
+		count++;
+
+	ret = ksu_profile_check_blocks(buf + sizeof(struct allowlist_file_hdr),
+				       size - sizeof(struct allowlist_file_hdr),
+				       verify_profile_cb, NULL);
+	if (ret < 0 || ret != count) {
+		pr_err("allowlist round trip failed: %d of %u profiles\n", ret,
+		       count);
+		return false;
+	}
+
+	return true;
+}
+
+// writes the whole image to path and syncs it, returns 0 or -errno
+static int write_allow_list_image(const char *path, const void *buf,
+				  size_t size)
+{
+	struct file *fp;
+	loff_t off = 0;
+	ssize_t ret;
+	int err;
+
+	fp = ksu_filp_open_compat(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (IS_ERR(fp))
+		return PTR_ERR(fp);
+
+	while (off < size) {
+		ret = ksu_kernel_write_compat(fp, buf + off, size - off, &off);
+		if (ret <= 0) {
+			filp_close(fp, 0);
+			return ret < 0 ? ret : -EIO;
+		}
+	}
+
+	err = vfs_fsync(fp, 0);
 	filp_close(fp, 0);
-unlock:
+	return err;
+}
+
+/*
+ * Caller must hold allowlist_mutex. The image goes to a temp file first and
+ * is renamed over the snapshot once synced, so a torn write never replaces
+ * a good snapshot. Returns false if the snapshot was left as it was.
+ */
+static bool compact_allow_list_locked(void)
+{
+	struct deleted_profile *d, *tmp;
+	struct perm_data *p = NULL;
+	struct file *fp = NULL;
+	bool ok = false;
+	size_t size;
+	void *buf;
+	int bkt;
+	int err;
+
+	buf = build_allow_list_image_locked(&size);
+	if (!buf)
+		return false;
+
+	if (!verify_allow_list_image_locked(buf, size))
+		goto free_buf;
+
+	err = write_allow_list_image(KERNEL_SU_ALLOWLIST_TMP, buf, size);
+	if (err) {
+		pr_err("save_allow_list write failed: %d\n", err);
+		goto free_buf;
+	}
+
+	err = ksu_rename_compat(NULL, KERNEL_SU_ALLOWLIST_TMP,
+				KERNEL_SU_ALLOWLIST);
+	if (err) {
+		pr_err("save_allow_list rename failed: %d\n", err);
+		goto free_buf;
+	}
+
+	// snapshot is complete, everything in the journal is stale now. If we
+	// die before the truncate, replaying it again is harmless.
+	fp = ksu_filp_open_compat(KERNEL_SU_ALLOWLIST_JOURNAL,
+				  O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (IS_ERR(fp)) {
+		// compact again on the retry rather than append to it
+		pr_err("allowlist journal truncate failed: %ld\n",
+		       PTR_ERR(fp));
+		goto free_buf;
+	}
+	filp_close(fp, 0);
+	ok = true;
+
+	hash_for_each (allow_list, bkt, p, node)
+		p->journal_op = 0;
+	list_for_each_entry_safe (d, tmp, &deleted_profiles, list) {
+		list_del(&d->list);
+		kfree(d);
+	}
+	journal_records = 0;
+	allowlist_need_compact = false;
+
+free_buf:
+	vfree(buf);
+	return ok;
+}
+
+static void do_flush_allow_list(struct callback_head *_cb)
+{
+	unsigned long retry = 0;
+
+	// anything changed from now on needs another flush
+	clear_bit(0, &allowlist_flush_queued);
+
+	mutex_lock(&allowlist_mutex);
+	if (!allowlist_need_compact &&
+	    journal_records < ALLOWLIST_JOURNAL_MAX_RECORDS)
+		append_allow_list_journal_locked();
+	// a failed append asks for a compaction right away
+	if (allowlist_need_compact ||
+	    journal_records >= ALLOWLIST_JOURNAL_MAX_RECORDS) {
+		if (compact_allow_list_locked()) {
+			allowlist_retry_delay = 0;
+		} else {
+			allowlist_retry_delay =
+			    clamp(allowlist_retry_delay * 2, (unsigned long)HZ,
+				  ALLOWLIST_RETRY_MAX);
+			retry = allowlist_retry_delay;
+		}
+	}
 	mutex_unlock(&allowlist_mutex);
+
+	if (retry) {
+		pr_warn("allowlist flush failed, retry in %lus\n", retry / HZ);
+		schedule_delayed_work(&allowlist_flush_work, retry);
+	}
 	kfree(_cb);
+	// held since the work was queued, see allowlist_flush_work_func()
+	module_put(THIS_MODULE);
 }
 
-void persistent_allow_list(void)
+static void allowlist_flush_work_func(struct work_struct *work)
 {
 	struct task_struct *tsk;
 	struct callback_head *cb;
 
+	if (test_and_set_bit(0, &allowlist_flush_queued))
+		return;
+
 	tsk = get_pid_task(find_vpid(1), PIDTYPE_PID);
 	if (!tsk) {
 		pr_err("save_allow_list find init task err\n");
-		return;
+		goto clear;
 	}
 
 	cb = kzalloc(sizeof(struct callback_head), GFP_KERNEL);
 	if (!cb) {
-		pr_err("save_allow_list alloc cb err\b");
+		pr_err("save_allow_list alloc cb err\n");
+		goto put_task;
+	}
+	cb->func = do_flush_allow_list;
+	/*
+	 * The callback is this module's code and init may take a while to
+	 * run it, so pin the module until it did: there is no way to cancel
+	 * it from ksu_allowlist_exit(). This fails once unloading started.
+	 */
+	if (!try_module_get(THIS_MODULE)) {
+		kfree(cb);
 		goto put_task;
 	}
-	cb->func = do_persistent_allow_list;
-	task_work_add(tsk, cb, TWA_RESUME);
+	if (task_work_add(tsk, cb, TWA_RESUME)) {
+		module_put(THIS_MODULE);
+		kfree(cb);
+		goto put_task;
+	}
+	put_task_struct(tsk);
+	return;
 
 put_task:
 	put_task_struct(tsk);
+clear:
+	clear_bit(0, &allowlist_flush_queued);
 }
 
-void ksu_load_allow_list(void)
+static void schedule_allow_list_flush(void)
 {
-	loff_t off = 0;
-	ssize_t ret = 0;
-	struct file *fp = NULL;
-	u32 magic;
-	u32 version;
+	schedule_delayed_work(&allowlist_flush_work, ALLOWLIST_FLUSH_DELAY);
+}
 
-#ifdef CONFIG_KSU_DEBUG
-	// always allow adb shell by default
-	ksu_grant_root_to_shell();
-#endif // #ifdef CONFIG_KSU_DEBUG
+void *ksu_get_app_profiles_encoded(uid_t uid_min, uid_t uid_max, size_t *size,
+				   u32 *count)
+{
+	void *buf;
 
-	// load allowlist now!
-	fp = ksu_filp_open_compat(KERNEL_SU_ALLOWLIST, O_RDONLY, 0);
-	if (IS_ERR(fp)) {
-		pr_err("load_allow_list open file failed: %ld\n", PTR_ERR(fp));
-		return;
+	mutex_lock(&allowlist_mutex);
+	buf = encode_allow_list_locked(0, uid_min, uid_max, size, count);
+	mutex_unlock(&allowlist_mutex);
+
+	return buf;
+}
+
+/*
+ * Encoders before every allow_su record carried its root profile dropped it
+ * for use_default grants, hand those the default root profile back.
+ */
+static void fill_default_root_profile(struct app_profile *profile)
+{
+	if (profile->allow_su && profile->rp_config.use_default &&
+	    !profile->rp_config.profile.selinux_domain[0])
+		memcpy(&profile->rp_config.profile, &default_root_profile,
+		       sizeof(default_root_profile));
+}
+
+static int check_profiles_cb(struct app_profile *profile, void *data)
+{
+	fill_default_root_profile(profile);
+	if (!profile_valid(profile)) {
+		pr_err("set app profiles: reject uid: %d, key: %s\n",
+		       profile->current_uid, profile->key);
+		return -EINVAL;
 	}
 
-	// verify magic
-	if (ksu_kernel_read_compat(fp, &magic, sizeof(magic), &off) !=
-		sizeof(magic) ||
-	    magic != FILE_MAGIC) {
-		pr_err("allowlist file invalid: %d!\n", magic);
-		goto exit;
+	return 0;
+}
+
+static int set_profiles_cb(struct app_profile *profile, void *data)
+{
+	u32 *applied = data;
+
+	fill_default_root_profile(profile);
+	if (!set_app_profile_locked(profile, true)) {
+		pr_err("set app profiles: failed uid: %d, key: %s\n",
+		       profile->current_uid, profile->key);
+		return 0;
+	}
+
+	(*applied)++;
+	return 0;
+}
+
+int ksu_set_app_profiles_encoded(const void *buf, size_t size)
+{
+	u32 applied = 0;
+	int ret;
+
+	// all or nothing: any bad block or profile rejects the whole write
+	ret = ksu_profile_check_blocks(buf, size, check_profiles_cb, NULL);
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&allowlist_mutex);
+	allow_uid_map_begin();
+	ret = ksu_profile_decode_blocks(buf, size, set_profiles_cb, &applied);
+	allow_uid_map_commit();
+	mutex_unlock(&allowlist_mutex);
+
+	if (applied) {
+		// one flush and one rescan for the whole batch
+		schedule_allow_list_flush();
+#if !defined(CONFIG_KSU_HYMOFS) && !defined(CONFIG_KSU_MANUAL_HOOK)
+		ksu_mark_running_process();
+#endif // #if !defined(CONFIG_KSU_HYMOFS) && !def...
+	}
+
+	return ret < 0 ? ret : applied;
+}
+
+// rewrite the whole snapshot on the next flush
+void persistent_allow_list(void)
+{
+	mutex_lock(&allowlist_mutex);
+	allowlist_need_compact = true;
+	mutex_unlock(&allowlist_mutex);
+	schedule_allow_list_flush();
+}
+
+static int load_profile_cb(struct app_profile *profile, void *data)
+{
+	pr_info("load_allow_uid, name: %s, uid: %d, allow: %d\n", profile->key,
+		profile->current_uid, profile->allow_su);
+
+	fill_default_root_profile(profile);
+	if (!profile_valid(profile)) {
+		pr_err("load_allow_uid: drop invalid profile, name: %s, uid: "
+		       "%d\n",
+		       profile->key, profile->current_uid);
+		return 0;
+	}
+	set_app_profile_locked(profile, false);
+	return 0;
+}
+
+// returns true if the snapshot is in an older format and should be rewritten
+static bool load_allow_list_snapshot(void)
+{
+	struct allowlist_file_hdr *hdr;
+	bool migrate = false;
+	size_t size = 0;
+	void *buf;
+	int count = 0;
+
+	buf = ksu_read_file_compat(KERNEL_SU_ALLOWLIST, ALLOWLIST_MAX_SIZE,
+				   &size);
+	if (IS_ERR(buf)) {
+		pr_err("load_allow_list open file failed: %ld\n",
+		       PTR_ERR(buf));
+		return false;
 	}
 
-	if (ksu_kernel_read_compat(fp, &version, sizeof(version), &off) !=
-	    sizeof(version)) {
-		pr_err("allowlist read version: %d failed\n", version);
+	hdr = buf;
+	if (size < sizeof(*hdr) || hdr->magic != FILE_MAGIC) {
+		pr_err("allowlist file invalid: %d!\n",
+		       size < sizeof(*hdr) ? 0 : hdr->magic);
 		goto exit;
 	}
 
-	pr_info("allowlist version: %d\n", version);
+	pr_info("allowlist version: %d, size: %zu\n", hdr->version, size);
 
-	while (true) {
-		struct app_profile profile;
+	mutex_lock(&allowlist_mutex);
+	allow_uid_map_begin();
+	if (hdr->version == FILE_FORMAT_VERSION_V3) {
+		// fixed size records, parse them in place
+		struct app_profile *profile = buf + sizeof(*hdr);
+		size_t nr = (size - sizeof(*hdr)) / sizeof(*profile);
+
+		for (; count < nr; count++)
+			load_profile_cb(&profile[count], NULL);
+		migrate = true;
+	} else if (hdr->version == FILE_FORMAT_VERSION) {
+		count = ksu_profile_decode_blocks(buf + sizeof(*hdr),
+						  size - sizeof(*hdr),
+						  load_profile_cb, NULL);
+	} else {
+		pr_err("allowlist version %d unsupported\n", hdr->version);
+	}
+	allow_uid_map_commit();
+	mutex_unlock(&allowlist_mutex);
 
-		ret =
-		    ksu_kernel_read_compat(fp, &profile, sizeof(profile), &off);
+	pr_info("allowlist loaded %d profiles\n", count);
 
-		if (ret <= 0) {
-			pr_info("load_allow_list read err: %zd\n", ret);
+exit:
+	vfree(buf);
+	return migrate;
+}
+
+static u32 replay_allow_list_journal(void)
+{
+	struct allowlist_journal_hdr hdr;
+	struct app_profile *profile;
+	struct file *fp = NULL;
+	loff_t off = 0;
+	u32 replayed = 0;
+
+	fp = ksu_filp_open_compat(KERNEL_SU_ALLOWLIST_JOURNAL, O_RDONLY, 0);
+	if (IS_ERR(fp))
+		return 0;
+
+	// app_profile is too big for the stack, it also covers a delete
+	profile = kmalloc(sizeof(*profile), GFP_KERNEL);
+	if (!profile)
+		goto close_file;
+
+	mutex_lock(&allowlist_mutex);
+	allow_uid_map_begin();
+
+	while (ksu_kernel_read_compat(fp, &hdr, sizeof(hdr), &off) ==
+	       sizeof(hdr)) {
+		if (hdr.magic != JOURNAL_MAGIC ||
+		    hdr.len > sizeof(*profile) ||
+		    ksu_kernel_read_compat(fp, profile, hdr.len, &off) !=
+			hdr.len ||
+		    crc32(0, profile, hdr.len) != hdr.crc) {
+			// torn tail from an interrupted append, drop the rest
+			pr_warn("allowlist journal corrupted at record %u\n",
+				replayed);
 			break;
 		}
 
-		pr_info("load_allow_uid, name: %s, uid: %d, allow: %d\n",
-			profile.key, profile.current_uid, profile.allow_su);
-		ksu_set_app_profile(&profile, false);
+		switch (hdr.op) {
+		case JOURNAL_OP_ADD:
+		case JOURNAL_OP_UPDATE:
+			if (hdr.len != sizeof(*profile))
+				goto bad_record;
+			if (profile_valid(profile))
+				set_app_profile_locked(profile, false);
+			break;
+		case JOURNAL_OP_DELETE: {
+			struct journal_delete_record *del = (void *)profile;
+
+			if (hdr.len != sizeof(*del))
+				goto bad_record;
+			del->key[sizeof(del->key) - 1] = '\0';
+			del_app_profile_locked(del->uid, del->key, false);
+			break;
+		}
+		default:
+			goto bad_record;
+		}
+		replayed++;
+		continue;
+
+	bad_record:
+		pr_warn("allowlist journal bad record, op: %d, len: %u\n",
+			hdr.op, hdr.len);
+		break;
 	}
+	allow_uid_map_commit();
+	mutex_unlock(&allowlist_mutex);
 
-exit:
-	ksu_show_allow_list();
+	kfree(profile);
+close_file:
 	filp_close(fp, 0);
+	return replayed;
+}
+
+void ksu_load_allow_list(void)
+{
+	bool migrate;
+	u32 replayed;
+
+#ifdef CONFIG_KSU_DEBUG
+	// always allow adb shell by default
+	ksu_grant_root_to_shell();
+#endif // #ifdef CONFIG_KSU_DEBUG
+
+	// load allowlist now!
+	migrate = load_allow_list_snapshot();
+	replayed = replay_allow_list_journal();
+	pr_info("allowlist journal replayed %u records\n", replayed);
+
+	ksu_show_allow_list();
+
+	if (migrate || replayed) {
+		// rewrite as v4 and fold the journal back into the snapshot
+		persistent_allow_list();
+	}
+}
+
+bool ksu_allowlist_test_and_clear_added(void)
+{
+	bool added;
+
+	mutex_lock(&allowlist_mutex);
+	added = allowlist_added;
+	allowlist_added = false;
+	mutex_unlock(&allowlist_mutex);
+
+	return added;
 }
 
 void ksu_prune_allowlist(bool (*is_uid_valid)(uid_t, char *, void *),
 			 void *data)
 {
 	struct perm_data *np = NULL;
-	struct perm_data *n = NULL;
+	struct hlist_node *n = NULL;
 	bool modified = false;
+	int bkt;
 
 	if (!ksu_boot_completed) {
 		pr_info("boot not completed, skip prune\n");
 		return;
 	}
 
-	// TODO: use RCU!
 	mutex_lock(&allowlist_mutex);
-	list_for_each_entry_safe (np, n, &allow_list, list) {
+	allow_uid_map_begin();
+	hash_for_each_safe (allow_list, bkt, n, np, node) {
 		uid_t uid = np->profile.current_uid;
 		char *package = np->profile.key;
 		// we use this uid for special cases, don't prune it!
@@ -539,34 +1346,20 @@ void ksu_prune_allowlist(bool (*is_uid_valid)(uid_t, char *, void *),
 		if (!is_preserved_uid && !is_uid_valid(uid, package, data)) {
 			modified = true;
 			pr_info("prune uid: %d, package: %s\n", uid, package);
-			list_del(&np->list);
-			if (likely(uid <= BITMAP_UID_MAX)) {
-				allow_list_bitmap[uid / BITS_PER_BYTE] &=
-				    ~(1 << (uid % BITS_PER_BYTE));
-			}
-			remove_uid_from_arr(uid);
-			smp_mb();
-			kfree(np);
+			del_app_profile_locked(uid, package, true);
 		}
 	}
+	allow_uid_map_commit();
 	mutex_unlock(&allowlist_mutex);
 
 	if (modified) {
-		persistent_allow_list();
+		schedule_allow_list_flush();
 	}
 }
 
 void ksu_allowlist_init(void)
 {
-	int i;
-
-	BUILD_BUG_ON(sizeof(allow_list_bitmap) != PAGE_SIZE);
-	BUILD_BUG_ON(sizeof(allow_list_arr) != PAGE_SIZE);
-
-	for (i = 0; i < ARRAY_SIZE(allow_list_arr); i++)
-		allow_list_arr[i] = -1;
-
-	INIT_LIST_HEAD(&allow_list);
+	hash_init(allow_list);
 
 	init_default_profiles();
 }
@@ -574,15 +1367,32 @@ void ksu_allowlist_init(void)
 void ksu_allowlist_exit(void)
 {
 	struct perm_data *np = NULL;
-	struct perm_data *n = NULL;
+	struct hlist_node *n = NULL;
+	struct deleted_profile *d, *tmp;
+	int bkt;
+
+	/*
+	 * A flush handed to init holds a module reference until it ran, so
+	 * none can be pending here, and allowlist_flush_work_func() can't
+	 * hand out another one once unloading started.
+	 */
+	cancel_delayed_work_sync(&allowlist_flush_work);
 
 	// free allowlist
 	mutex_lock(&allowlist_mutex);
-	list_for_each_entry_safe (np, n, &allow_list, list) {
-		list_del(&np->list);
-		kfree(np);
+	list_for_each_entry_safe (d, tmp, &deleted_profiles, list) {
+		list_del(&d->list);
+		kfree(d);
+	}
+	hash_for_each_safe (allow_list, bkt, n, np, node) {
+		hash_del_rcu(&np->node);
+		kfree_rcu(np, rcu);
 	}
+	allow_uid_map_destroy();
 	mutex_unlock(&allowlist_mutex);
+
+	// retired maps are freed by a callback in this module's text
+	rcu_barrier();
 }
 
 #ifdef CONFIG_KSU_MANUAL_SU
@@ -596,19 +1406,17 @@ bool ksu_temp_grant_root_once(uid_t uid)
 
 	const char *default_key = "com.temp.once";
 
-	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
+	struct app_profile *p = NULL;
 	bool found = false;
 	bool ok = false;
 
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
-		if (p->profile.current_uid == uid) {
-			strcpy(profile.key, p->profile.key);
-			found = true;
-			break;
-		}
+	rcu_read_lock();
+	p = ksu_get_app_profile_rcu(uid);
+	if (p) {
+		strcpy(profile.key, p->key);
+		found = true;
 	}
+	rcu_read_unlock();
 
 	if (!found) {
 		strcpy(profile.key, default_key);
@@ -643,18 +1451,16 @@ void ksu_temp_revoke_root_once(uid_t uid)
 
 	const char *default_key = "com.temp.once";
 
-	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
+	struct app_profile *p = NULL;
 	bool found = false;
 
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
-		if (p->profile.current_uid == uid) {
-			strcpy(profile.key, p->profile.key);
-			found = true;
-			break;
-		}
+	rcu_read_lock();
+	p = ksu_get_app_profile_rcu(uid);
+	if (p) {
+		strcpy(profile.key, p->key);
+		found = true;
 	}
+	rcu_read_unlock();
 
 	if (!found) {
 		strcpy(profile.key, default_key);
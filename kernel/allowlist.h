@@ -32,12 +32,30 @@ bool ksu_get_allow_list(int *array, int *length, bool allow);
 
 void ksu_prune_allowlist(bool (*is_uid_exist)(uid_t, char *, void *),
 			 void *data);
+// Whether profiles were added since the last call, true on the first one
+bool ksu_allowlist_test_and_clear_added(void);
 
 bool ksu_get_app_profile(struct app_profile *);
 bool ksu_set_app_profile(struct app_profile *, bool persist);
 
+/*
+ * Bulk profile access for the manager, using the profile_codec.h block
+ * encoding. The get variant returns a vmalloc'd buffer holding the
+ * profiles with uid_min <= uid <= uid_max. The set variant checks the
+ * whole buffer first and fails with -EINVAL without applying anything if
+ * a block or profile is bad, otherwise it applies every profile under one
+ * lock hold, schedules a single flush and returns how many were applied.
+ */
+void *ksu_get_app_profiles_encoded(uid_t uid_min, uid_t uid_max, size_t *size,
+				   u32 *count);
+int ksu_set_app_profiles_encoded(const void *buf, size_t size);
+
+// Caller must hold rcu_read_lock(), the returned profile is only valid until
+// the matching rcu_read_unlock().
+struct app_profile *ksu_get_app_profile_rcu(uid_t uid);
+
 bool ksu_uid_should_umount(uid_t uid);
-struct root_profile *ksu_get_root_profile(uid_t uid);
+void ksu_get_root_profile(uid_t uid, struct root_profile *profile);
 
 static inline bool is_appuid(uid_t uid)
 {
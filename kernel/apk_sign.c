@@ -1,7 +1,11 @@
 #include <linux/err.h>
 #include <linux/fs.h>
 #include <linux/gfp.h>
+#include <linux/hashtable.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/sizes.h>
 #include <linux/slab.h>
 #include <linux/version.h>
 #ifdef CONFIG_KSU_DEBUG
@@ -34,6 +38,37 @@ static apk_sign_key_t apk_sign_keys[] = {
     {EXPECTED_SIZE_SECOND, EXPECTED_HASH_SECOND}, // Second Manager
 };
 
+#define APK_EOCD_SIZE 22
+#define APK_EOCD_MAGIC 0x06054b50u
+#define APK_CD_ENTRY_SIZE 46
+#define APK_CD_ENTRY_MAGIC 0x02014b50u
+#define APK_SIG_BLOCK_MAGIC "APK Sig Block 42"
+#define APK_SIG_FOOTER_SIZE 0x18 // block size + magic
+#define APK_SIG_BLOCK_MAX SZ_4M
+#define APK_CD_MAX SZ_16M
+
+// Verification results of recently checked apks, under apk_sign_mutex
+struct apk_sign_cache_entry {
+	struct hlist_node node;
+	dev_t dev;
+	unsigned long ino;
+	loff_t size;
+	// ctime, unlike mtime, can't be set from userspace with utimensat()
+	s64 ctime_sec;
+	long ctime_nsec;
+	int signature_index; // -1 if the apk is not a manager
+};
+
+#define APK_SIGN_CACHE_MAX 1024
+
+static DEFINE_MUTEX(apk_sign_mutex);
+static DEFINE_HASHTABLE(apk_sign_cache, 8);
+static unsigned int apk_sign_cache_count;
+
+// allocated on first use, the crypto api may not be ready at init
+static struct crypto_shash *sha256_tfm;
+static struct sdesc *sha256_desc;
+
 static struct sdesc *init_sdesc(struct crypto_shash *alg)
 {
 	struct sdesc *sdesc;
@@ -47,229 +82,308 @@ static struct sdesc *init_sdesc(struct crypto_shash *alg)
 	return sdesc;
 }
 
-static int calc_hash(struct crypto_shash *alg, const unsigned char *data,
-		     unsigned int datalen, unsigned char *digest)
+static int ksu_sha256(const unsigned char *data, unsigned int datalen,
+		      unsigned char *digest)
 {
+	char *hash_alg_name = "sha256";
+	struct crypto_shash *alg;
 	struct sdesc *sdesc;
-	int ret;
 
-	sdesc = init_sdesc(alg);
-	if (IS_ERR(sdesc)) {
-		pr_info("can't alloc sdesc\n");
-		return PTR_ERR(sdesc);
+	lockdep_assert_held(&apk_sign_mutex);
+
+	if (!sha256_tfm) {
+		alg = crypto_alloc_shash(hash_alg_name, 0, 0);
+		if (IS_ERR(alg)) {
+			pr_info("can't alloc alg %s\n", hash_alg_name);
+			return PTR_ERR(alg);
+		}
+		sdesc = init_sdesc(alg);
+		if (IS_ERR(sdesc)) {
+			pr_info("can't alloc sdesc\n");
+			crypto_free_shash(alg);
+			return PTR_ERR(sdesc);
+		}
+		sha256_tfm = alg;
+		sha256_desc = sdesc;
 	}
 
-	ret = crypto_shash_digest(&sdesc->shash, data, datalen, digest);
-	kfree(sdesc);
-	return ret;
+	return crypto_shash_digest(&sha256_desc->shash, data, datalen, digest);
 }
 
-static int ksu_sha256(const unsigned char *data, unsigned int datalen,
-		      unsigned char *digest)
+// Bounds checked cursor over a buffer read from the apk
+struct apk_buf {
+	const u8 *p;
+	size_t len;
+};
+
+static bool apk_buf_u32(struct apk_buf *b, u32 *val)
 {
-	struct crypto_shash *alg;
-	char *hash_alg_name = "sha256";
-	int ret;
+	__le32 v;
 
-	alg = crypto_alloc_shash(hash_alg_name, 0, 0);
-	if (IS_ERR(alg)) {
-		pr_info("can't alloc alg %s\n", hash_alg_name);
-		return PTR_ERR(alg);
-	}
-	ret = calc_hash(alg, data, datalen, digest);
-	crypto_free_shash(alg);
-	return ret;
+	if (b->len < sizeof(v))
+		return false;
+	memcpy(&v, b->p, sizeof(v));
+	*val = le32_to_cpu(v);
+	b->p += sizeof(v);
+	b->len -= sizeof(v);
+	return true;
 }
 
-static bool check_block(struct file *fp, u32 *size4, loff_t *pos, u32 *offset,
-			int *matched_index)
+static const u8 *apk_buf_take(struct apk_buf *b, size_t n)
 {
-	int i;
-	apk_sign_key_t sign_key;
-	bool signature_valid = false;
+	const u8 *p = b->p;
+
+	if (b->len < n)
+		return NULL;
+	b->p += n;
+	b->len -= n;
+	return p;
+}
+
+static u16 apk_get_u16(const u8 *p)
+{
+	__le16 v;
+
+	memcpy(&v, p, sizeof(v));
+	return le16_to_cpu(v);
+}
 
-	ksu_kernel_read_compat(fp, size4, 0x4, pos); // signer-sequence length
-	ksu_kernel_read_compat(fp, size4, 0x4, pos); // signer length
-	ksu_kernel_read_compat(fp, size4, 0x4, pos); // signed data length
+static u32 apk_get_u32(const u8 *p)
+{
+	__le32 v;
 
-	*offset += 0x4 * 3;
+	memcpy(&v, p, sizeof(v));
+	return le32_to_cpu(v);
+}
 
-	ksu_kernel_read_compat(fp, size4, 0x4, pos); // digests-sequence length
+static u64 apk_get_u64(const u8 *p)
+{
+	__le64 v;
 
-	*pos += *size4;
-	*offset += 0x4 + *size4;
+	memcpy(&v, p, sizeof(v));
+	return le64_to_cpu(v);
+}
 
-	ksu_kernel_read_compat(fp, size4, 0x4, pos); // certificates length
-	ksu_kernel_read_compat(fp, size4, 0x4, pos); // certificate length
-	*offset += 0x4 * 2;
+static int apk_read_at(struct file *fp, void *buf, size_t len, loff_t pos)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = ksu_kernel_read_compat(fp, buf, len, &pos);
+		if (ret <= 0)
+			return ret < 0 ? ret : -EIO;
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
 
-	for (i = 0; i < ARRAY_SIZE(apk_sign_keys); i++) {
-		sign_key = apk_sign_keys[i];
+// Reads len bytes at pos into a new buffer, the caller kvfree()s it
+static u8 *apk_read_alloc(struct file *fp, size_t len, loff_t pos)
+{
+	u8 *buf = kvmalloc(len, GFP_KERNEL);
 
-		if (*size4 != sign_key.size)
+	if (!buf)
+		return NULL;
+	if (apk_read_at(fp, buf, len, pos)) {
+		kvfree(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+// v2 signer: signed data (digests, certificates, ...), signatures, key
+static bool check_block(struct apk_buf *signer, int *matched_index)
+{
+	unsigned char digest[SHA256_DIGEST_SIZE];
+	char hash_str[SHA256_DIGEST_SIZE * 2 + 1] = {0};
+	struct apk_buf b = *signer;
+	const u8 *cert;
+	bool hashed = false;
+	u32 size4;
+	int i;
+
+	if (!apk_buf_u32(&b, &size4) || // signer-sequence length
+	    !apk_buf_u32(&b, &size4) || // signer length
+	    !apk_buf_u32(&b, &size4) || // signed data length
+	    !apk_buf_u32(&b, &size4) || // digests-sequence length
+	    !apk_buf_take(&b, size4) ||
+	    !apk_buf_u32(&b, &size4) || // certificates length
+	    !apk_buf_u32(&b, &size4)) // certificate length
+		return false;
+
+	cert = apk_buf_take(&b, size4);
+	if (!cert)
+		return false;
+
+	for (i = 0; i < ARRAY_SIZE(apk_sign_keys); i++) {
+		if (size4 != apk_sign_keys[i].size)
 			continue;
-		*offset += *size4;
 
-#define CERT_MAX_LENGTH 1024
-		char cert[CERT_MAX_LENGTH];
-		if (*size4 > CERT_MAX_LENGTH) {
-			pr_info("cert length overlimit\n");
-			return false;
-		}
-		ksu_kernel_read_compat(fp, cert, *size4, pos);
-		unsigned char digest[SHA256_DIGEST_SIZE];
-		if (ksu_sha256(cert, *size4, digest) < 0) {
-			pr_info("sha256 error\n");
-			return false;
+		if (!hashed) {
+			if (ksu_sha256(cert, size4, digest) < 0) {
+				pr_info("sha256 error\n");
+				return false;
+			}
+			bin2hex(hash_str, digest, SHA256_DIGEST_SIZE);
+			hashed = true;
 		}
 
-		char hash_str[SHA256_DIGEST_SIZE * 2 + 1];
-		hash_str[SHA256_DIGEST_SIZE * 2] = '\0';
-
-		bin2hex(hash_str, digest, SHA256_DIGEST_SIZE);
 		pr_info("sha256: %s, expected: %s, index: %d\n", hash_str,
-			sign_key.sha256, i);
+			apk_sign_keys[i].sha256, i);
 
-		if (strcmp(sign_key.sha256, hash_str) == 0) {
-			signature_valid = true;
+		if (strcmp(apk_sign_keys[i].sha256, hash_str) == 0) {
 			if (matched_index) {
 				*matched_index = i;
 			}
-			break;
+			return true;
 		}
 	}
-	return signature_valid;
+	return false;
 }
 
-struct zip_entry_header {
-	uint32_t signature;
-	uint16_t version;
-	uint16_t flags;
-	uint16_t compression;
-	uint16_t mod_time;
-	uint16_t mod_date;
-	uint32_t crc32;
-	uint32_t compressed_size;
-	uint32_t uncompressed_size;
-	uint16_t file_name_length;
-	uint16_t extra_field_length;
-} __attribute__((packed));
-
 // This is a necessary but not sufficient condition, but it is enough for us
-static bool has_v1_signature_file(struct file *fp)
+static bool has_v1_signature_file(struct file *fp, u32 cd_offset, u32 cd_size)
 {
-	struct zip_entry_header header;
 	const char MANIFEST[] = "META-INF/MANIFEST.MF";
+	struct apk_buf b;
+	const u8 *entry;
+	u8 *cd;
+	bool found = false;
 
-	loff_t pos = 0;
+	if (cd_size > APK_CD_MAX)
+		return true; // don't trust what we can't read
 
-	while (ksu_kernel_read_compat(fp, &header,
-				      sizeof(struct zip_entry_header), &pos) ==
-	       sizeof(struct zip_entry_header)) {
-		if (header.signature != 0x04034b50) {
-			// ZIP magic: 'PK'
-			return false;
-		}
-		// Read the entry file name
-		if (header.file_name_length == sizeof(MANIFEST) - 1) {
-			char fileName[sizeof(MANIFEST)];
-			ksu_kernel_read_compat(fp, fileName,
-					       header.file_name_length, &pos);
-			fileName[header.file_name_length] = '\0';
-
-			// Check if the entry matches META-INF/MANIFEST.MF
-			if (strncmp(MANIFEST, fileName, sizeof(MANIFEST) - 1) ==
-			    0) {
-				return true;
-			}
-		} else {
-			// Skip the entry file name
-			pos += header.file_name_length;
+	cd = apk_read_alloc(fp, cd_size, cd_offset);
+	if (!cd)
+		return true;
+
+	b.p = cd;
+	b.len = cd_size;
+	while ((entry = apk_buf_take(&b, APK_CD_ENTRY_SIZE))) {
+		u16 name_len = apk_get_u16(entry + 28);
+		const u8 *name;
+
+		if (apk_get_u32(entry) != APK_CD_ENTRY_MAGIC)
+			break;
+
+		name = apk_buf_take(&b, name_len);
+		if (!name)
+			break;
+
+		// Check if the entry matches META-INF/MANIFEST.MF
+		if (name_len == sizeof(MANIFEST) - 1 &&
+		    !memcmp(name, MANIFEST, name_len)) {
+			found = true;
+			break;
 		}
 
-		// Skip to the next entry
-		pos += header.extra_field_length + header.compressed_size;
+		// Skip the extra field and comment
+		if (!apk_buf_take(&b, apk_get_u16(entry + 30) +
+					  apk_get_u16(entry + 32)))
+			break;
 	}
 
-	return false;
+	kvfree(cd);
+	return found;
 }
 
-static __always_inline bool check_v2_signature(char *path, int *signature_index)
+// Locates the end of central directory record in the last 64K of the apk
+static bool find_eocd(struct file *fp, loff_t size, u32 *cd_offset,
+		      u32 *cd_size)
 {
-	unsigned char buffer[0x11] = {0};
-	u32 size4;
-	u64 size8, size_of_block;
+	size_t tail_len = min_t(loff_t, size, 0xffff + APK_EOCD_SIZE);
+	const u8 *eocd;
+	bool found = false;
+	u8 *tail;
+	int i;
 
-	loff_t pos;
+	if (tail_len < APK_EOCD_SIZE)
+		return false;
+
+	tail = apk_read_alloc(fp, tail_len, size - tail_len);
+	if (!tail)
+		return false;
+
+	// https://en.wikipedia.org/wiki/Zip_(file_format)#End_of_central_directory_record_(EOCD)
+	for (i = 0; i + APK_EOCD_SIZE <= tail_len; i++) {
+		eocd = tail + tail_len - APK_EOCD_SIZE - i;
+		if (apk_get_u16(eocd + 20) == i &&
+		    apk_get_u32(eocd) == APK_EOCD_MAGIC) {
+			*cd_size = apk_get_u32(eocd + 12);
+			*cd_offset = apk_get_u32(eocd + 16);
+			found = true;
+			break;
+		}
+	}
+
+	kvfree(tail);
+	return found;
+}
+
+// Returns the index of the manager key the apk is signed with, or -1
+static int check_v2_signature(struct file *fp)
+{
+	loff_t size = i_size_read(file_inode(fp));
+	u64 size8, size_of_block;
+	struct apk_buf pairs;
+	u32 cd_offset, cd_size;
+	u8 footer[APK_SIG_FOOTER_SIZE];
+	u8 *block = NULL;
 
 	bool v2_signing_valid = false;
 	int v2_signing_blocks = 0;
 	bool v3_signing_exist = false;
 	bool v3_1_signing_exist = false;
 	int matched_index = -1;
-	int i;
-	struct file *fp;
 
-	fp = ksu_filp_open_compat(path, O_RDONLY, 0);
-	if (IS_ERR(fp)) {
-		pr_err("open %s error.\n", path);
-		return false;
+	if (!find_eocd(fp, size, &cd_offset, &cd_size)) {
+		pr_info("error: cannot find eocd\n");
+		return -1;
 	}
 
-	// disable inotify for this file
-	fp->f_mode |= FMODE_NONOTIFY;
+	if (cd_offset < APK_SIG_FOOTER_SIZE + 0x8 ||
+	    apk_read_at(fp, footer, sizeof(footer),
+			cd_offset - APK_SIG_FOOTER_SIZE))
+		return -1;
 
-	// https://en.wikipedia.org/wiki/Zip_(file_format)#End_of_central_directory_record_(EOCD)
-	for (i = 0;; ++i) {
-		unsigned short n;
-		pos = generic_file_llseek(fp, -i - 2, SEEK_END);
-		ksu_kernel_read_compat(fp, &n, 2, &pos);
-		if (n == i) {
-			pos -= 22;
-			ksu_kernel_read_compat(fp, &size4, 4, &pos);
-			if ((size4 ^ 0xcafebabeu) == 0xccfbf1eeu) {
-				break;
-			}
-		}
-		if (i == 0xffff) {
-			pr_info("error: cannot find eocd\n");
-			goto clean;
-		}
-	}
+	size8 = apk_get_u64(footer);
+	if (memcmp(footer + 0x8, APK_SIG_BLOCK_MAGIC, 0x10))
+		return -1;
 
-	pos += 12;
-	// offset
-	ksu_kernel_read_compat(fp, &size4, 0x4, &pos);
-	pos = size4 - 0x18;
+	if (size8 < APK_SIG_FOOTER_SIZE || size8 > APK_SIG_BLOCK_MAX ||
+	    size8 + 0x8 > cd_offset)
+		return -1;
 
-	ksu_kernel_read_compat(fp, &size8, 0x8, &pos);
-	ksu_kernel_read_compat(fp, buffer, 0x10, &pos);
-	if (strcmp((char *)buffer, "APK Sig Block 42")) {
-		goto clean;
-	}
+	// the whole block, from its leading size to the magic
+	block = apk_read_alloc(fp, size8 + 0x8, cd_offset - (size8 + 0x8));
+	if (!block)
+		return -1;
 
-	pos = size4 - (size8 + 0x8);
-	ksu_kernel_read_compat(fp, &size_of_block, 0x8, &pos);
-	if (size_of_block != size8) {
+	size_of_block = apk_get_u64(block);
+	if (size_of_block != size8)
 		goto clean;
-	}
 
-	int loop_count = 0;
-	while (loop_count++ < 10) {
-		uint32_t id;
-		uint32_t offset;
-		ksu_kernel_read_compat(fp, &size8, 0x8,
-				       &pos); // sequence length
-		if (size8 == size_of_block) {
+	pairs.p = block + 0x8;
+	pairs.len = size8 - APK_SIG_FOOTER_SIZE;
+	while (pairs.len) {
+		struct apk_buf value;
+		const u8 *pair;
+		u32 id;
+
+		pair = apk_buf_take(&pairs, 0xc);
+		if (!pair)
 			break;
-		}
-		ksu_kernel_read_compat(fp, &id, 0x4, &pos); // id
-		offset = 4;
+		size8 = apk_get_u64(pair); // sequence length
+		id = apk_get_u32(pair + 0x8);
+		if (size8 < 0x4 || size8 - 0x4 > pairs.len)
+			break;
+		value.len = size8 - 0x4;
+		value.p = apk_buf_take(&pairs, value.len);
+
 		if (id == 0x7109871au) {
 			v2_signing_blocks++;
-			bool result = check_block(fp, &size4, &pos, &offset,
-						  &matched_index);
-			if (result) {
+			if (check_block(&value, &matched_index)) {
 				v2_signing_valid = true;
 			}
 		} else if (id == 0xf05368c0u) {
@@ -283,7 +397,6 @@ static __always_inline bool check_v2_signature(char *path, int *signature_index)
 			pr_info("Unknown id: 0x%08x\n", id);
 #endif // #ifdef CONFIG_KSU_DEBUG
 		}
-		pos += (size8 - offset);
 	}
 
 	if (v2_signing_blocks != 1) {
@@ -294,31 +407,127 @@ static __always_inline bool check_v2_signature(char *path, int *signature_index)
 		v2_signing_valid = false;
 	}
 
-	if (v2_signing_valid) {
-		int has_v1_signing = has_v1_signature_file(fp);
-		if (has_v1_signing) {
-			pr_err("Unexpected v1 signature scheme found!\n");
-			filp_close(fp, 0);
-			return false;
-		}
+	if (v2_signing_valid && has_v1_signature_file(fp, cd_offset, cd_size)) {
+		pr_err("Unexpected v1 signature scheme found!\n");
+		v2_signing_valid = false;
 	}
 clean:
-	filp_close(fp, 0);
+	kvfree(block);
 
 	if (v3_signing_exist || v3_1_signing_exist) {
 #ifdef CONFIG_KSU_DEBUG
 		pr_err("Unexpected v3 signature scheme found!\n");
 #endif // #ifdef CONFIG_KSU_DEBUG
-		return false;
+		return -1;
 	}
 
-	if (v2_signing_valid) {
-		if (signature_index) {
-			*signature_index = matched_index;
-		}
-		return true;
+	return v2_signing_valid ? matched_index : -1;
+}
+
+static void apk_sign_cache_key(struct inode *inode,
+			       struct apk_sign_cache_entry *key)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
+	struct timespec64 ctime = inode_get_ctime(inode);
+#else
+	struct timespec64 ctime = {.tv_sec = inode->i_ctime.tv_sec,
+				   .tv_nsec = inode->i_ctime.tv_nsec};
+#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
+
+	key->dev = inode->i_sb->s_dev;
+	key->ino = inode->i_ino;
+	key->size = i_size_read(inode);
+	key->ctime_sec = ctime.tv_sec;
+	key->ctime_nsec = ctime.tv_nsec;
+}
+
+static struct apk_sign_cache_entry *
+apk_sign_cache_find(const struct apk_sign_cache_entry *key)
+{
+	struct apk_sign_cache_entry *pos;
+
+	hash_for_each_possible (apk_sign_cache, pos, node, key->ino) {
+		if (pos->ino == key->ino && pos->dev == key->dev)
+			return pos;
 	}
-	return false;
+	return NULL;
+}
+
+static void apk_sign_cache_clear(void)
+{
+	struct apk_sign_cache_entry *pos;
+	struct hlist_node *n;
+	int bkt;
+
+	hash_for_each_safe (apk_sign_cache, bkt, n, pos, node) {
+		hash_del(&pos->node);
+		kfree(pos);
+	}
+	apk_sign_cache_count = 0;
+}
+
+static void apk_sign_cache_store(const struct apk_sign_cache_entry *key,
+				 int signature_index)
+{
+	struct apk_sign_cache_entry *entry = apk_sign_cache_find(key);
+
+	if (!entry) {
+		// one entry per installed app, start over if that's exceeded
+		if (apk_sign_cache_count >= APK_SIGN_CACHE_MAX)
+			apk_sign_cache_clear();
+
+		entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+		if (!entry)
+			return;
+		hash_add(apk_sign_cache, &entry->node, key->ino);
+		apk_sign_cache_count++;
+	}
+
+	entry->dev = key->dev;
+	entry->ino = key->ino;
+	entry->size = key->size;
+	entry->ctime_sec = key->ctime_sec;
+	entry->ctime_nsec = key->ctime_nsec;
+	entry->signature_index = signature_index;
+}
+
+/*
+ * Returns the index of the matching manager key, or -1. Apks that haven't
+ * changed since they were last checked are answered from the cache.
+ */
+static int check_apk_cached(char *path)
+{
+	struct apk_sign_cache_entry key, *cached;
+	struct file *fp;
+	int ret;
+
+	fp = ksu_filp_open_compat(path, O_RDONLY, 0);
+	if (IS_ERR(fp)) {
+		pr_err("open %s error.\n", path);
+		return -1;
+	}
+
+	// disable inotify for this file
+	fp->f_mode |= FMODE_NONOTIFY;
+
+	mutex_lock(&apk_sign_mutex);
+
+	// taken before reading, a concurrent change will miss the cache
+	apk_sign_cache_key(file_inode(fp), &key);
+	cached = apk_sign_cache_find(&key);
+	if (cached && cached->size == key.size &&
+	    cached->ctime_sec == key.ctime_sec &&
+	    cached->ctime_nsec == key.ctime_nsec) {
+		ret = cached->signature_index;
+	} else {
+		ret = check_v2_signature(fp);
+		apk_sign_cache_store(&key, ret);
+	}
+
+	mutex_unlock(&apk_sign_mutex);
+
+	filp_close(fp, 0);
+	return ret;
 }
 
 #ifdef CONFIG_KSU_DEBUG
@@ -354,5 +563,17 @@ bool is_manager_apk(char *path)
 		return false;
 	}
 #endif // #ifdef CONFIG_KSU_SUPERKEY
-	return check_v2_signature(path, NULL);
-}
\ No newline at end of file
+	return check_apk_cached(path) >= 0;
+}
+
+void ksu_apk_sign_exit(void)
+{
+	mutex_lock(&apk_sign_mutex);
+	apk_sign_cache_clear();
+	kfree(sha256_desc);
+	sha256_desc = NULL;
+	if (sha256_tfm)
+		crypto_free_shash(sha256_tfm);
+	sha256_tfm = NULL;
+	mutex_unlock(&apk_sign_mutex);
+}
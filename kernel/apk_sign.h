@@ -6,4 +6,6 @@
 
 bool is_manager_apk(char *path);
 
+void ksu_apk_sign_exit(void);
+
 #endif // #ifndef __KSU_H_APK_V2_SIGN
@@ -27,6 +27,7 @@
 #include "kernel_compat.h"
 #include "klog.h" // IWYU pragma: keep
 #include "selinux/selinux.h"
+#include "status_page.h"
 #ifndef CONFIG_KSU_HYMOFS
 #include "syscall_hook_manager.h"
 #endif // #ifndef CONFIG_KSU_HYMOFS
@@ -152,7 +153,9 @@ void escape_with_root_profile(void)
 		return;
 	}
 
-	struct root_profile *profile = ksu_get_root_profile(cred->uid.val);
+	struct root_profile root_profile;
+	struct root_profile *profile = &root_profile;
+	ksu_get_root_profile(cred->uid.val, profile);
 
 	cred->uid.val = profile->uid;
 	cred->suid.val = profile->uid;
@@ -193,6 +196,7 @@ void escape_with_root_profile(void)
 	spin_unlock_irq(&p->sighand->siglock);
 
 	setup_selinux(profile->selinux_domain);
+	ksu_status_su_granted();
 #if __SULOG_GATE
 	ksu_sulog_report_su_grant(current_euid().val, NULL, "escape_to_root");
 #endif // #if __SULOG_GATE
@@ -292,7 +296,9 @@ void escape_to_root_for_cmd_su(uid_t target_uid, pid_t target_pid)
 		return;
 	}
 
-	struct root_profile *profile = ksu_get_root_profile(target_uid);
+	struct root_profile root_profile;
+	struct root_profile *profile = &root_profile;
+	ksu_get_root_profile(target_uid, profile);
 
 	newcreds->uid.val = profile->uid;
 	newcreds->suid.val = profile->uid;
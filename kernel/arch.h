@@ -32,6 +32,18 @@
 #define SYS_SETNS_SYMBOL sys_setns
 #endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
 
+#ifdef CONFIG_COMPAT
+// AArch32 EABI syscall numbers, they are ABI so it's safe to hardcode them.
+// Compat tasks keep their arguments in regs[0..5] like native ones.
+#define KSU_HAS_COMPAT_SYSCALLS
+#define __KSU_NR_compat_execve 11
+#define __KSU_NR_compat_clone 120
+#define __KSU_NR_compat_setresuid32 208
+#define __KSU_NR_compat_fstatat64 327
+#define __KSU_NR_compat_faccessat 334
+#define __KSU_NR_compat_clone3 435
+#endif // #ifdef CONFIG_COMPAT
+
 #elif defined(__x86_64__)
 
 #define __PT_PARM1_REG di
@@ -0,0 +1,214 @@
+#include <linux/anon_inodes.h>
+#include <linux/bitmap.h>
+#include <linux/fcntl.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/list.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+
+#include "events.h"
+#include "feature.h"
+#include "klog.h" // IWYU pragma: keep
+
+#define EVENT_MAX_FEATURES 128
+#define EVENT_READ_MAX 64
+
+struct event_reader {
+	struct list_head list;
+	u32 mask;
+	u32 pending; // bit n: a type n record is waiting
+	DECLARE_BITMAP(features, EVENT_MAX_FEATURES);
+};
+
+// everything below is under event_lock
+static DEFINE_SPINLOCK(event_lock);
+static LIST_HEAD(event_readers);
+static struct ksu_event event_latest[KSU_EVENT_MAX];
+static u64 feature_latest[EVENT_MAX_FEATURES];
+static DECLARE_WAIT_QUEUE_HEAD(event_wq);
+
+void ksu_event_notify(u32 type, u32 arg, u64 value)
+{
+	struct event_reader *r;
+	unsigned long flags;
+	bool wake = false;
+
+	if (type >= KSU_EVENT_MAX)
+		return;
+	if (type == KSU_EVENT_FEATURE && arg >= EVENT_MAX_FEATURES)
+		return;
+
+	spin_lock_irqsave(&event_lock, flags);
+	if (type == KSU_EVENT_FEATURE) {
+		feature_latest[arg] = value;
+	} else {
+		event_latest[type].arg = arg;
+		event_latest[type].value = value;
+	}
+	list_for_each_entry (r, &event_readers, list) {
+		if (!(r->mask & BIT(type)))
+			continue;
+		r->pending |= BIT(type);
+		if (type == KSU_EVENT_FEATURE)
+			__set_bit(arg, r->features);
+		wake = true;
+	}
+	spin_unlock_irqrestore(&event_lock, flags);
+
+	if (wake)
+		wake_up_interruptible(&event_wq);
+}
+
+static bool event_pending(struct event_reader *r)
+{
+	return READ_ONCE(r->pending) != 0;
+}
+
+// Types that don't fit stay pending for the next read
+static size_t event_take(struct event_reader *r, struct ksu_event *buf,
+			 size_t max)
+{
+	unsigned long flags;
+	size_t n = 0;
+	u32 type, id;
+
+	spin_lock_irqsave(&event_lock, flags);
+	for (type = 1; type < KSU_EVENT_MAX && n < max; type++) {
+		if (!(r->pending & BIT(type)))
+			continue;
+
+		if (type != KSU_EVENT_FEATURE) {
+			buf[n] = event_latest[type];
+			buf[n++].type = type;
+			r->pending &= ~BIT(type);
+			continue;
+		}
+
+		for_each_set_bit (id, r->features, EVENT_MAX_FEATURES) {
+			if (n >= max)
+				break;
+			buf[n].type = type;
+			buf[n].arg = id;
+			buf[n++].value = feature_latest[id];
+			__clear_bit(id, r->features);
+		}
+		if (bitmap_empty(r->features, EVENT_MAX_FEATURES))
+			r->pending &= ~BIT(type);
+	}
+	spin_unlock_irqrestore(&event_lock, flags);
+
+	return n;
+}
+
+static ssize_t event_read(struct file *fp, char __user *ubuf, size_t count,
+			  loff_t *ppos)
+{
+	struct event_reader *r = fp->private_data;
+	struct ksu_event *buf;
+	size_t max = min_t(size_t, count / sizeof(*buf), EVENT_READ_MAX);
+	ssize_t n;
+	int ret;
+
+	// records are never split across reads
+	if (!max)
+		return -EINVAL;
+
+	while (!event_pending(r)) {
+		if (fp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(event_wq, event_pending(r));
+		if (ret)
+			return ret;
+	}
+
+	buf = kmalloc_array(max, sizeof(*buf), GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	n = event_take(r, buf, max) * sizeof(*buf);
+	if (copy_to_user(ubuf, buf, n))
+		n = -EFAULT;
+	kfree(buf);
+
+	return n;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+static __poll_t event_poll(struct file *fp, struct poll_table_struct *pts)
+#else
+static unsigned int event_poll(struct file *fp, struct poll_table_struct *pts)
+#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
+{
+	struct event_reader *r = fp->private_data;
+
+	poll_wait(fp, &event_wq, pts);
+	return event_pending(r) ? POLLIN | POLLRDNORM : 0;
+}
+
+static int event_release(struct inode *inode, struct file *fp)
+{
+	struct event_reader *r = fp->private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&event_lock, flags);
+	list_del(&r->list);
+	spin_unlock_irqrestore(&event_lock, flags);
+
+	kfree(r);
+	return 0;
+}
+
+// The module stays pinned while an event fd is open
+static const struct file_operations event_fops = {
+    .owner = THIS_MODULE,
+    .read = event_read,
+    .poll = event_poll,
+    .release = event_release,
+};
+
+int ksu_event_install_fd(u32 mask)
+{
+	struct event_reader *r;
+	struct file *fp;
+	unsigned long flags;
+	u32 all = GENMASK(KSU_EVENT_MAX - 1, 1);
+	int fd;
+
+	BUILD_BUG_ON(KSU_FEATURE_MAX > EVENT_MAX_FEATURES);
+
+	if (mask & ~all)
+		return -EINVAL;
+
+	r = kzalloc(sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return -ENOMEM;
+	r->mask = mask ? mask : all;
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0) {
+		kfree(r);
+		return fd;
+	}
+
+	fp = anon_inode_getfile("[ksu_events]", &event_fops, r,
+				O_RDONLY | O_CLOEXEC);
+	if (IS_ERR(fp)) {
+		pr_err("events: failed to create event file\n");
+		put_unused_fd(fd);
+		kfree(r);
+		return PTR_ERR(fp);
+	}
+
+	spin_lock_irqsave(&event_lock, flags);
+	list_add_tail(&r->list, &event_readers);
+	spin_unlock_irqrestore(&event_lock, flags);
+
+	fd_install(fd, fp);
+
+	return fd;
+}
@@ -0,0 +1,33 @@
+#ifndef __KSU_H_EVENTS
+#define __KSU_H_EVENTS
+
+#include <linux/types.h>
+
+enum ksu_event_type {
+	KSU_EVENT_ALLOWLIST = 1, // value: allowlist generation
+	KSU_EVENT_MANAGER, // arg: manager uid, value: manager generation
+	KSU_EVENT_FEATURE, // arg: feature id, value: its current value
+	KSU_EVENT_PACKAGES, // arg: packages changed, 0 if unknown
+	KSU_EVENT_MODULE_MOUNTED,
+	KSU_EVENT_BOOT_COMPLETED,
+	KSU_EVENT_MAX,
+};
+
+/*
+ * read() on an event fd yields whole records. Events coalesce: a reader
+ * holds at most one pending record per type, or per feature id, and it
+ * carries the latest arg and value when read.
+ */
+struct ksu_event {
+	__u32 type; // enum ksu_event_type
+	__u32 arg;
+	__u64 value;
+};
+
+// Safe from any context, wakes up the event fds subscribed to type
+void ksu_event_notify(u32 type, u32 arg, u64 value);
+
+// mask bit n set: subscribe to type n, 0 for all of them
+int ksu_event_install_fd(u32 mask);
+
+#endif // #ifndef __KSU_H_EVENTS
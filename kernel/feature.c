@@ -1,5 +1,6 @@
 #include "feature.h"
 #include "klog.h" // IWYU pragma: keep
+#include "status_page.h"
 
 #include <linux/mutex.h>
 
@@ -7,6 +8,16 @@ static const struct ksu_feature_handler *feature_handlers[KSU_FEATURE_MAX];
 
 static DEFINE_MUTEX(feature_mutex);
 
+// caller must hold feature_mutex
+static void feature_publish_locked(const struct ksu_feature_handler *handler)
+{
+	u64 value = 0;
+
+	if (handler->get_handler && handler->get_handler(&value))
+		return;
+	ksu_status_set_feature(handler->feature_id, value, true);
+}
+
 int ksu_register_feature_handler(const struct ksu_feature_handler *handler)
 {
 	if (!handler) {
@@ -34,6 +45,7 @@ int ksu_register_feature_handler(const struct ksu_feature_handler *handler)
 	}
 
 	feature_handlers[handler->feature_id] = handler;
+	feature_publish_locked(handler);
 
 	pr_info("feature: registered handler for %s (id=%u)\n",
 		handler->name ? handler->name : "unknown", handler->feature_id);
@@ -60,6 +72,7 @@ int ksu_unregister_feature_handler(u32 feature_id)
 	}
 
 	feature_handlers[feature_id] = NULL;
+	ksu_status_set_feature(feature_id, 0, false);
 
 	pr_info("feature: unregistered handler for id=%u\n", feature_id);
 
@@ -143,6 +156,9 @@ int ksu_set_feature(u32 feature_id, u64 value)
 	if (ret) {
 		pr_err("feature: set_handler for %u failed: %d\n", feature_id,
 		       ret);
+	} else {
+		// handlers may clamp the value, publish what they kept
+		feature_publish_locked(handler);
 	}
 
 out:
@@ -8,6 +8,10 @@ enum ksu_feature_id {
 	KSU_FEATURE_KERNEL_UMOUNT = 1,
 	KSU_FEATURE_ENHANCED_SECURITY = 2,
 	KSU_FEATURE_SULOG = 100,
+	KSU_FEATURE_HOOK_STATS = 101,
+	KSU_FEATURE_SULOG_FSYNC_INTERVAL = 102,
+	KSU_FEATURE_THRONE_DEBOUNCE = 103,
+	KSU_FEATURE_THRONE_MAX_DELAY = 104,
 
 	KSU_FEATURE_MAX
 };
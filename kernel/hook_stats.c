@@ -0,0 +1,180 @@
+#include <linux/bitops.h>
+#include <linux/cpumask.h>
+#include <linux/jump_label.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#include "feature.h"
+#include "hook_stats.h"
+#include "klog.h" // IWYU pragma: keep
+#include "supercalls.h"
+
+struct hook_stat {
+	u64 count;
+	u64 total_ns;
+	u32 hist[KSU_HOOK_STAT_HIST_BUCKETS];
+};
+
+DEFINE_STATIC_KEY_FALSE(ksu_hook_stats_key);
+
+// allocated at init, a static per-cpu array this size won't fit an LKM
+static struct hook_stat __percpu *hook_stats;
+
+// slots without a name are unused and not reported
+static const char *hook_stat_names[KSU_HOOK_STAT_MAX] = {
+    [KSU_HOOK_STAT_SYS_NEWFSTATAT] = "sys_newfstatat",
+    [KSU_HOOK_STAT_SYS_FACCESSAT] = "sys_faccessat",
+    [KSU_HOOK_STAT_SYS_EXECVE] = "sys_execve",
+    [KSU_HOOK_STAT_SYS_SETRESUID] = "sys_setresuid",
+    [KSU_HOOK_STAT_SYS_CLONE] = "sys_clone",
+    [KSU_HOOK_STAT_SETUID] = "setuid",
+    [KSU_HOOK_STAT_UMOUNT] = "umount_task_work",
+    [KSU_HOOK_STAT_THRONE] = "track_throne",
+    [KSU_HOOK_STAT_SULOG_FLUSH] = "sulog_flush",
+};
+
+void __ksu_hook_stats_record(unsigned int id, u64 delta_ns)
+{
+	unsigned int bucket;
+
+	if (unlikely(id >= KSU_HOOK_STAT_MAX))
+		return;
+
+	bucket = min_t(unsigned int, fls64(delta_ns),
+		       KSU_HOOK_STAT_HIST_BUCKETS - 1);
+
+	// hooks may be preempted, every counter is updated on its own
+	this_cpu_inc(hook_stats[id].count);
+	this_cpu_add(hook_stats[id].total_ns, delta_ns);
+	this_cpu_inc(hook_stats[id].hist[bucket]);
+}
+
+void ksu_hook_stats_set_name(unsigned int id, const char *name)
+{
+	if (id < KSU_HOOK_STAT_MAX)
+		hook_stat_names[id] = name;
+}
+
+static void hook_stats_sum(unsigned int id, struct ksu_hook_stat_entry *entry)
+{
+	int cpu, i;
+
+	for_each_possible_cpu (cpu) {
+		const struct hook_stat *s = per_cpu_ptr(hook_stats, cpu) + id;
+
+		entry->count += READ_ONCE(s->count);
+		entry->total_ns += READ_ONCE(s->total_ns);
+		for (i = 0; i < KSU_HOOK_STAT_HIST_BUCKETS; i++)
+			entry->hist[i] += READ_ONCE(s->hist[i]);
+	}
+}
+
+static void hook_stats_reset(void)
+{
+	int cpu;
+
+	// racing updates on other cpus may survive, good enough for stats
+	for_each_possible_cpu (cpu)
+		memset(per_cpu_ptr(hook_stats, cpu), 0,
+		       sizeof(struct hook_stat) * KSU_HOOK_STAT_MAX);
+}
+
+int ksu_hook_stats_copy(void __user *buf, u32 max_entries, u32 *count,
+			bool reset)
+{
+	struct ksu_hook_stat_entry *entry;
+	unsigned int id;
+	u32 n = 0;
+	int ret = 0;
+
+	BUILD_BUG_ON(ARRAY_SIZE(entry->hist) != KSU_HOOK_STAT_HIST_BUCKETS);
+
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry)
+		return -ENOMEM;
+
+	for (id = 0; id < KSU_HOOK_STAT_MAX; id++) {
+		if (!hook_stat_names[id])
+			continue;
+
+		if (n >= max_entries) {
+			ret = -ENOSPC;
+			break;
+		}
+
+		memset(entry, 0, sizeof(*entry));
+		strscpy(entry->name, hook_stat_names[id], sizeof(entry->name));
+		if (hook_stats)
+			hook_stats_sum(id, entry);
+
+		if (copy_to_user((struct ksu_hook_stat_entry __user *)buf + n,
+				 entry, sizeof(*entry))) {
+			ret = -EFAULT;
+			break;
+		}
+		n++;
+	}
+
+	kfree(entry);
+
+	if (!ret && reset && hook_stats)
+		hook_stats_reset();
+
+	*count = n;
+	return ret;
+}
+
+static int hook_stats_feature_get(u64 *value)
+{
+	*value = static_key_enabled(&ksu_hook_stats_key) ? 1 : 0;
+	return 0;
+}
+
+static int hook_stats_feature_set(u64 value)
+{
+	bool enable = value != 0;
+
+	if (enable && !hook_stats)
+		return -ENOMEM;
+
+	if (enable)
+		static_branch_enable(&ksu_hook_stats_key);
+	else
+		static_branch_disable(&ksu_hook_stats_key);
+
+	pr_info("hook_stats: set to %d\n", enable);
+	return 0;
+}
+
+static const struct ksu_feature_handler hook_stats_handler = {
+    .feature_id = KSU_FEATURE_HOOK_STATS,
+    .name = "hook_stats",
+    .get_handler = hook_stats_feature_get,
+    .set_handler = hook_stats_feature_set,
+};
+
+void ksu_hook_stats_init(void)
+{
+	hook_stats =
+	    __alloc_percpu(sizeof(struct hook_stat) * KSU_HOOK_STAT_MAX,
+			   __alignof__(struct hook_stat));
+	if (!hook_stats)
+		pr_err("hook_stats: alloc failed\n");
+
+	if (ksu_register_feature_handler(&hook_stats_handler)) {
+		pr_err("Failed to register hook_stats feature handler\n");
+	}
+}
+
+void ksu_hook_stats_exit(void)
+{
+	ksu_unregister_feature_handler(KSU_FEATURE_HOOK_STATS);
+	static_branch_disable(&ksu_hook_stats_key);
+	// let tracepoint handlers that still saw the key finish recording
+	synchronize_rcu();
+	free_percpu(hook_stats);
+	hook_stats = NULL;
+}
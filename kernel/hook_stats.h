@@ -0,0 +1,53 @@
+#ifndef __KSU_H_HOOK_STATS
+#define __KSU_H_HOOK_STATS
+
+#include <linux/jump_label.h>
+#include <linux/ktime.h>
+#include <linux/types.h>
+
+enum ksu_hook_stat_id {
+	KSU_HOOK_STAT_SYS_NEWFSTATAT,
+	KSU_HOOK_STAT_SYS_FACCESSAT,
+	KSU_HOOK_STAT_SYS_EXECVE,
+	KSU_HOOK_STAT_SYS_SETRESUID,
+	KSU_HOOK_STAT_SYS_CLONE,
+	KSU_HOOK_STAT_SETUID,
+	KSU_HOOK_STAT_UMOUNT,
+	KSU_HOOK_STAT_THRONE,
+	KSU_HOOK_STAT_SULOG_FLUSH,
+	// one slot per entry of the supercall handler table
+	KSU_HOOK_STAT_IOCTL,
+	KSU_HOOK_STAT_MAX = KSU_HOOK_STAT_IOCTL + 48,
+};
+
+// bucket n counts calls that took [2^(n-1), 2^n) ns, the last one the rest
+#define KSU_HOOK_STAT_HIST_BUCKETS 32
+
+DECLARE_STATIC_KEY_FALSE(ksu_hook_stats_key);
+
+void __ksu_hook_stats_record(unsigned int id, u64 delta_ns);
+
+// Returns 0 while stats are off, so the hooks only pay for a patched branch
+static __always_inline u64 ksu_hook_stats_start(void)
+{
+	if (static_branch_unlikely(&ksu_hook_stats_key))
+		return ktime_get_ns();
+	return 0;
+}
+
+static __always_inline void ksu_hook_stats_end(unsigned int id, u64 start)
+{
+	if (static_branch_unlikely(&ksu_hook_stats_key) && start)
+		__ksu_hook_stats_record(id, ktime_get_ns() - start);
+}
+
+void ksu_hook_stats_set_name(unsigned int id, const char *name);
+
+int ksu_hook_stats_copy(void __user *buf, u32 max_entries, u32 *count,
+			bool reset);
+
+void ksu_hook_stats_init(void);
+
+void ksu_hook_stats_exit(void);
+
+#endif // #ifndef __KSU_H_HOOK_STATS
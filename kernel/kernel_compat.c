@@ -7,7 +7,13 @@
 #endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
 #include "kernel_compat.h"
 #include "klog.h" // IWYU pragma: keep
+#include <linux/dcache.h>
+#include <linux/err.h>
+#include <linux/mount.h>
+#include <linux/namei.h>
+#include <linux/string.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 10, 0) ||                           \
     defined(CONFIG_IS_HW_HISI) || defined(CONFIG_KSU_ALLOWLIST_WORKAROUND)
@@ -83,6 +89,173 @@ ssize_t ksu_kernel_write_compat(struct file *p, const void *buf, size_t count,
 #endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
 }
 
+void *ksu_read_file_compat(const char *filename, size_t max_size,
+			   size_t *size)
+{
+	struct file *fp;
+	loff_t off = 0;
+	size_t len;
+	ssize_t ret;
+	char *buf;
+
+	fp = ksu_filp_open_compat(filename, O_RDONLY, 0);
+	if (IS_ERR(fp))
+		return ERR_CAST(fp);
+
+	len = i_size_read(file_inode(fp));
+	if (len > max_size) {
+		pr_err("%s too large: %zu\n", filename, len);
+		buf = ERR_PTR(-EFBIG);
+		goto close_file;
+	}
+
+	// one extra byte so text files can be parsed as a C string
+	buf = vmalloc(len + 1);
+	if (!buf) {
+		buf = ERR_PTR(-ENOMEM);
+		goto close_file;
+	}
+
+	while (off < len) {
+		ret = ksu_kernel_read_compat(fp, buf + off, len - off, &off);
+		if (ret <= 0)
+			break;
+	}
+	buf[off] = '\0';
+	*size = off;
+
+close_file:
+	filp_close(fp, NULL);
+	return buf;
+}
+
+static int do_vfs_rename(struct vfsmount *mnt, struct dentry *dir,
+			 struct dentry *old_dentry, struct dentry *new_dentry)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 17, 0)
+	struct renamedata rd = {
+	    .mnt_idmap = mnt_idmap(mnt),
+	    .old_parent = dir,
+	    .old_dentry = old_dentry,
+	    .new_parent = dir,
+	    .new_dentry = new_dentry,
+	};
+
+	return vfs_rename(&rd);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	struct renamedata rd = {
+	    .old_mnt_idmap = mnt_idmap(mnt),
+	    .old_dir = d_inode(dir),
+	    .old_dentry = old_dentry,
+	    .new_mnt_idmap = mnt_idmap(mnt),
+	    .new_dir = d_inode(dir),
+	    .new_dentry = new_dentry,
+	};
+
+	return vfs_rename(&rd);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 12, 0)
+	struct renamedata rd = {
+	    .old_mnt_userns = mnt_user_ns(mnt),
+	    .old_dir = d_inode(dir),
+	    .old_dentry = old_dentry,
+	    .new_mnt_userns = mnt_user_ns(mnt),
+	    .new_dir = d_inode(dir),
+	    .new_dentry = new_dentry,
+	};
+
+	return vfs_rename(&rd);
+#else
+	return vfs_rename(d_inode(dir), old_dentry, d_inode(dir), new_dentry,
+			  NULL, 0);
+#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
+}
+
+int ksu_rename_compat(const struct path *root, const char *oldname,
+		      const char *newname)
+{
+	const char *base = kbasename(newname);
+	struct dentry *dir, *new_dentry, *trap;
+	struct path old_path;
+	int err;
+
+	if (root)
+		err = vfs_path_lookup(root->dentry, root->mnt, oldname, 0,
+				      &old_path);
+	else
+		err = kern_path(oldname, 0, &old_path);
+	if (err)
+		return err;
+
+	err = mnt_want_write(old_path.mnt);
+	if (err)
+		goto put_path;
+
+	dir = dget_parent(old_path.dentry);
+	trap = lock_rename(dir, dir);
+	if (IS_ERR(trap)) {
+		err = PTR_ERR(trap);
+		goto put_dir;
+	}
+
+	// oldname may have been renamed or removed since the lookup
+	if (old_path.dentry->d_parent != dir || d_unhashed(old_path.dentry)) {
+		err = -ENOENT;
+		goto unlock;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+	new_dentry = lookup_noperm(&(struct qstr)QSTR_INIT(base, strlen(base)),
+				   dir);
+#else
+	new_dentry = lookup_one_len(base, dir, strlen(base));
+#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
+	if (IS_ERR(new_dentry)) {
+		err = PTR_ERR(new_dentry);
+		goto unlock;
+	}
+
+	err = do_vfs_rename(old_path.mnt, dir, old_path.dentry, new_dentry);
+	dput(new_dentry);
+
+unlock:
+	unlock_rename(dir, dir);
+put_dir:
+	dput(dir);
+	mnt_drop_write(old_path.mnt);
+put_path:
+	path_put(&old_path);
+	return err;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+long ksu_copy_from_user_nofault(void *dst, const void __user *src, size_t size)
+{
+	return copy_from_user_nofault(dst, src, size);
+}
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0)
+long ksu_copy_from_user_nofault(void *dst, const void __user *src, size_t size)
+{
+	return probe_user_read(dst, src, size);
+}
+#else
+long ksu_copy_from_user_nofault(void *dst, const void __user *src, size_t size)
+{
+	mm_segment_t old_fs = get_fs();
+	long ret;
+
+	if (!ksu_access_ok(src, size))
+		return -EFAULT;
+
+	set_fs(USER_DS);
+	pagefault_disable();
+	ret = __copy_from_user_inatomic(dst, src, size);
+	pagefault_enable();
+	set_fs(old_fs);
+
+	return ret ? -EFAULT : 0;
+}
+#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0) ||                           \
     defined(KSU_OPTIONAL_STRNCPY)
 long ksu_strncpy_from_user_nofault(char *dst, const void __user *unsafe_addr,
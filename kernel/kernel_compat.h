@@ -10,12 +10,25 @@
 extern long ksu_strncpy_from_user_nofault(char *dst,
 					  const void __user *unsafe_addr,
 					  long count);
+// Returns 0 if all size bytes were copied, never sleeps or faults pages in
+extern long ksu_copy_from_user_nofault(void *dst, const void __user *src,
+				       size_t size);
 extern struct file *ksu_filp_open_compat(const char *filename, int flags,
 					 umode_t mode);
 extern ssize_t ksu_kernel_read_compat(struct file *p, void *buf, size_t count,
 				      loff_t *pos);
 extern ssize_t ksu_kernel_write_compat(struct file *p, const void *buf,
 				       size_t count, loff_t *pos);
+// Read a whole file into a NUL terminated vmalloc buffer, free with vfree().
+extern void *ksu_read_file_compat(const char *filename, size_t max_size,
+				  size_t *size);
+/*
+ * Rename oldname over newname, which must live in the same directory (only
+ * its last component is used). Paths are looked up from root, or from the
+ * caller's root if it is NULL. Returns 0 or a negative errno.
+ */
+extern int ksu_rename_compat(const struct path *root, const char *oldname,
+			     const char *newname);
 
 #ifndef CONFIG_KSU_LKM
 #include "linux/key.h"
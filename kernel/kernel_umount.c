@@ -1,10 +1,14 @@
 #include <linux/cred.h>
 #include <linux/fs.h>
+#include <linux/jump_label.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
 #include <linux/mount.h>
 #include <linux/namei.h>
 #include <linux/nsproxy.h>
 #include <linux/path.h>
 #include <linux/printk.h>
+#include <linux/rcupdate.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/task_work.h>
@@ -18,6 +22,7 @@
 
 #include "allowlist.h"
 #include "feature.h"
+#include "hook_stats.h"
 #include "kernel_compat.h"
 #include "kernel_umount.h"
 #include "klog.h" // IWYU pragma: keep
@@ -28,18 +33,22 @@
 
 #include "sulog.h"
 
-static bool ksu_kernel_umount_enabled = true;
+// checked on every setuid of a marked task
+static DEFINE_STATIC_KEY_TRUE(ksu_kernel_umount_key);
 
 static int kernel_umount_feature_get(u64 *value)
 {
-	*value = ksu_kernel_umount_enabled ? 1 : 0;
+	*value = static_key_enabled(&ksu_kernel_umount_key) ? 1 : 0;
 	return 0;
 }
 
 static int kernel_umount_feature_set(u64 value)
 {
 	bool enable = value != 0;
-	ksu_kernel_umount_enabled = enable;
+	if (enable)
+		static_branch_enable(&ksu_kernel_umount_key);
+	else
+		static_branch_disable(&ksu_kernel_umount_key);
 	pr_info("kernel_umount: set to %d\n", enable);
 	return 0;
 }
@@ -103,6 +112,359 @@ void try_umount(const char *mnt, int flags)
 	ksu_umount_mnt(mnt, &path, flags);
 }
 
+/*
+ * Flat copy of mount_list for the umount task_work, rebuilt whenever the list
+ * changes. The mounts themselves can't be resolved ahead of time: each app
+ * unmounts from its own copy of the mount tree, and holding a reference on a
+ * mount makes a plain umount of it fail with -EBUSY.
+ */
+struct umount_snapshot {
+	struct kref ref;
+	struct rcu_head rcu;
+	unsigned int count;
+	struct {
+		const char *path; // points into the string area after entries
+		unsigned int flags;
+	} entries[];
+};
+
+static struct umount_snapshot __rcu *umount_snapshot;
+
+static void umount_snapshot_release(struct kref *ref)
+{
+	struct umount_snapshot *s =
+	    container_of(ref, struct umount_snapshot, ref);
+
+	kfree_rcu(s, rcu);
+}
+
+static struct umount_snapshot *umount_snapshot_get(void)
+{
+	struct umount_snapshot *s;
+
+	rcu_read_lock();
+	s = rcu_dereference(umount_snapshot);
+	if (s && !kref_get_unless_zero(&s->ref))
+		s = NULL;
+	rcu_read_unlock();
+
+	return s;
+}
+
+static void umount_snapshot_put(struct umount_snapshot *s)
+{
+	if (s)
+		kref_put(&s->ref, umount_snapshot_release);
+}
+
+static void umount_snapshot_publish(struct umount_snapshot *s)
+{
+	struct umount_snapshot *old;
+
+	old = rcu_dereference_protected(umount_snapshot,
+					lockdep_is_held(&mount_list_lock));
+	rcu_assign_pointer(umount_snapshot, s);
+	umount_snapshot_put(old);
+}
+
+// caller must hold mount_list_lock
+void ksu_umount_list_changed(void)
+{
+	struct umount_snapshot *s = NULL;
+	struct mount_entry *entry;
+	unsigned int count = 0, i = 0;
+	size_t size, len, strings = 0;
+	char *p;
+
+	list_for_each_entry (entry, &mount_list, list) {
+		strings += strlen(entry->umountable) + 1;
+		count++;
+	}
+
+	// without a snapshot the task_work walks mount_list itself
+	if (!count)
+		goto publish;
+
+	size = sizeof(*s) + count * sizeof(s->entries[0]);
+	s = kmalloc(size + strings, GFP_KERNEL);
+	if (!s) {
+		pr_warn("umount: no memory for the list snapshot\n");
+		goto publish;
+	}
+
+	kref_init(&s->ref);
+	s->count = count;
+	p = (char *)s + size;
+	list_for_each_entry (entry, &mount_list, list) {
+		len = strlen(entry->umountable) + 1;
+		memcpy(p, entry->umountable, len);
+		s->entries[i].path = p;
+		s->entries[i++].flags = entry->flags;
+		p += len;
+	}
+
+publish:
+	umount_snapshot_publish(s);
+	ksu_umount_plans_invalidate();
+}
+
+/*
+ * Every child of a zygote starts in a copy of the zygote's mount namespace,
+ * so the first child works out which entries are mounted there and in what
+ * order to unmount them, and its siblings replay that. struct mnt_namespace
+ * is private to fs/, so plans are keyed by the zygote process instead.
+ *
+ * A plan only knows the mounts that were there when it was built. It goes
+ * stale when the list changes, on every module mounted report and on boot
+ * completed; anything mounted later without one of those is left out until
+ * then, so late mounts should be followed by `ksud kernel
+ * notify-module-mounted`.
+ */
+struct umount_plan_key {
+	pid_t tgid;
+	u64 start_time;
+};
+
+struct umount_plan {
+	struct kref ref;
+	struct rcu_head rcu;
+	struct umount_plan_key key;
+	unsigned int generation;
+	struct umount_snapshot *snap; // holds a reference
+	unsigned int count;
+	unsigned int order[]; // indexes into snap->entries
+};
+
+// zygote, zygote64 and a couple of app zygotes
+#define UMOUNT_PLAN_SLOTS 4
+
+static struct umount_plan __rcu *umount_plans[UMOUNT_PLAN_SLOTS];
+static DEFINE_SPINLOCK(umount_plan_lock);
+static unsigned int umount_plan_next;
+// bumped on list changes, mount reports and boot completed
+static atomic_t umount_plan_gen = ATOMIC_INIT(0);
+
+static atomic_t umount_plans_built = ATOMIC_INIT(0);
+static unsigned int umount_plan_last_size;
+static u64 umount_plan_last_build_ns;
+static atomic64_t umount_plan_hits = ATOMIC64_INIT(0);
+static atomic64_t umount_plan_skipped = ATOMIC64_INIT(0);
+
+void ksu_umount_plans_invalidate(void)
+{
+	atomic_inc(&umount_plan_gen);
+}
+
+void ksu_umount_plan_stats(u32 *built, u32 *size, u64 *build_ns, u64 *hits,
+			   u64 *skipped)
+{
+	*built = atomic_read(&umount_plans_built);
+	*size = READ_ONCE(umount_plan_last_size);
+	*build_ns = READ_ONCE(umount_plan_last_build_ns);
+	*hits = atomic64_read(&umount_plan_hits);
+	*skipped = atomic64_read(&umount_plan_skipped);
+}
+
+static void umount_plan_release(struct kref *ref)
+{
+	struct umount_plan *plan = container_of(ref, struct umount_plan, ref);
+
+	umount_snapshot_put(plan->snap);
+	kfree_rcu(plan, rcu);
+}
+
+static void umount_plan_put(struct umount_plan *plan)
+{
+	if (plan)
+		kref_put(&plan->ref, umount_plan_release);
+}
+
+static void umount_plan_key_current(struct umount_plan_key *key)
+{
+	struct task_struct *parent;
+
+	rcu_read_lock();
+	parent = rcu_dereference(current->real_parent);
+	key->tgid = parent->tgid;
+	key->start_time = parent->start_time;
+	rcu_read_unlock();
+}
+
+static bool umount_plan_key_equal(const struct umount_plan_key *a,
+				  const struct umount_plan_key *b)
+{
+	return a->tgid == b->tgid && a->start_time == b->start_time;
+}
+
+static struct umount_plan *umount_plan_get(const struct umount_plan_key *key)
+{
+	unsigned int gen = atomic_read(&umount_plan_gen);
+	struct umount_plan *plan, *found = NULL;
+	int i;
+
+	rcu_read_lock();
+	for (i = 0; i < UMOUNT_PLAN_SLOTS; i++) {
+		plan = rcu_dereference(umount_plans[i]);
+		if (!plan || plan->generation != gen ||
+		    !umount_plan_key_equal(&plan->key, key))
+			continue;
+		if (kref_get_unless_zero(&plan->ref))
+			found = plan;
+		break;
+	}
+	rcu_read_unlock();
+
+	return found;
+}
+
+// Takes over the caller's reference, NULL clears every slot
+static void umount_plan_publish(struct umount_plan *plan)
+{
+	struct umount_plan *old[UMOUNT_PLAN_SLOTS] = {NULL};
+	struct umount_plan *cur;
+	int i, slot = -1;
+
+	spin_lock(&umount_plan_lock);
+	for (i = 0; i < UMOUNT_PLAN_SLOTS; i++) {
+		cur = rcu_dereference_protected(
+		    umount_plans[i], lockdep_is_held(&umount_plan_lock));
+		if (!plan) {
+			old[i] = cur;
+			RCU_INIT_POINTER(umount_plans[i], NULL);
+		} else if (slot < 0 &&
+			   (!cur || umount_plan_key_equal(&cur->key,
+							  &plan->key))) {
+			slot = i;
+		}
+	}
+	if (plan) {
+		if (slot < 0)
+			slot = umount_plan_next++ % UMOUNT_PLAN_SLOTS;
+		old[0] = rcu_dereference_protected(
+		    umount_plans[slot], lockdep_is_held(&umount_plan_lock));
+		rcu_assign_pointer(umount_plans[slot], plan);
+	}
+	spin_unlock(&umount_plan_lock);
+
+	for (i = 0; i < UMOUNT_PLAN_SLOTS; i++)
+		umount_plan_put(old[i]);
+}
+
+static void umount_plan_run(struct umount_plan *plan)
+{
+	const struct umount_snapshot *s = plan->snap;
+	unsigned int i, idx;
+
+	for (i = 0; i < plan->count; i++) {
+		idx = plan->order[i];
+		try_umount(s->entries[idx].path, s->entries[idx].flags);
+	}
+
+	atomic64_inc(&umount_plan_hits);
+	atomic64_add(s->count - plan->count, &umount_plan_skipped);
+}
+
+/*
+ * Resolves every entry in the caller's namespace and unmounts what is there,
+ * children before their parents. Mounts below an MNT_DETACH entry go away
+ * with it and are dropped, and so are duplicates of the same mount. Returns
+ * the plan for the caller's siblings, or NULL if there is no memory for it.
+ */
+static struct umount_plan *umount_plan_build(struct umount_snapshot *s,
+					     const struct umount_plan_key *key,
+					     unsigned int gen)
+{
+	u64 start = ktime_get_ns();
+	struct umount_plan *plan;
+	struct path *paths;
+	unsigned int *depth;
+	unsigned int i, j, n = 0, tmp;
+	bool *keep;
+
+	plan = kzalloc(sizeof(*plan) + s->count * sizeof(plan->order[0]),
+		       GFP_KERNEL);
+	paths = kcalloc(s->count, sizeof(*paths), GFP_KERNEL);
+	depth = kcalloc(s->count, sizeof(*depth), GFP_KERNEL);
+	keep = kcalloc(s->count, sizeof(*keep), GFP_KERNEL);
+	if (!plan || !paths || !depth || !keep) {
+		kfree(plan);
+		plan = NULL;
+		for (i = 0; i < s->count; i++)
+			try_umount(s->entries[i].path, s->entries[i].flags);
+		goto out;
+	}
+
+	for (i = 0; i < s->count; i++) {
+		if (kern_path(s->entries[i].path, 0, &paths[i])) {
+			paths[i].mnt = NULL;
+			continue;
+		}
+		keep[i] = paths[i].dentry == paths[i].mnt->mnt_root;
+		for (j = 0; j < i && keep[i]; j++) {
+			// the first entry for a mount wins
+			if (keep[j] && paths[j].mnt == paths[i].mnt)
+				keep[i] = false;
+		}
+	}
+
+	for (i = 0; i < s->count; i++) {
+		for (j = 0; j < s->count && keep[i]; j++) {
+			if (i != j && keep[j] &&
+			    (s->entries[j].flags & MNT_DETACH) &&
+			    path_is_under(&paths[i], &paths[j]))
+				keep[i] = false;
+		}
+	}
+
+	for (i = 0; i < s->count; i++) {
+		if (!keep[i]) {
+			if (paths[i].mnt)
+				path_put(&paths[i]);
+			continue;
+		}
+		for (j = 0; j < s->count; j++) {
+			if (i != j && keep[j] &&
+			    path_is_under(&paths[i], &paths[j]))
+				depth[i]++;
+		}
+		plan->order[n++] = i;
+	}
+
+	// deepest first, a mount is below every mount its parent is below
+	for (i = 1; i < n; i++) {
+		tmp = plan->order[i];
+		for (j = i; j > 0 && depth[plan->order[j - 1]] < depth[tmp];
+		     j--)
+			plan->order[j] = plan->order[j - 1];
+		plan->order[j] = tmp;
+	}
+
+	for (i = 0; i < n; i++) {
+		j = plan->order[i];
+		ksu_umount_mnt(s->entries[j].path, &paths[j],
+			       s->entries[j].flags);
+	}
+
+	kref_init(&plan->ref);
+	kref_get(&s->ref);
+	plan->snap = s;
+	plan->key = *key;
+	plan->generation = gen;
+	plan->count = n;
+
+	atomic_inc(&umount_plans_built);
+	WRITE_ONCE(umount_plan_last_size, n);
+	WRITE_ONCE(umount_plan_last_build_ns, ktime_get_ns() - start);
+	pr_info("umount: plan for zygote %d: %u of %u mounts, %llu ns\n",
+		key->tgid, n, s->count, umount_plan_last_build_ns);
+
+out:
+	kfree(keep);
+	kfree(depth);
+	kfree(paths);
+	return plan;
+}
+
 struct umount_tw {
 	struct callback_head cb;
 };
@@ -110,20 +472,38 @@ struct umount_tw {
 static void umount_tw_func(struct callback_head *cb)
 {
 	struct umount_tw *tw = container_of(cb, struct umount_tw, cb);
+	u64 start = ksu_hook_stats_start();
 	const struct cred *saved = override_creds(ksu_cred);
-
+	unsigned int gen = atomic_read(&umount_plan_gen);
+	struct umount_plan_key key;
+	struct umount_plan *plan;
+	struct umount_snapshot *s;
 	struct mount_entry *entry;
-	down_read(&mount_list_lock);
-	list_for_each_entry (entry, &mount_list, list) {
-		pr_info("%s: unmounting: %s flags 0x%x\n", __func__,
-			entry->umountable, entry->flags);
-		try_umount(entry->umountable, entry->flags);
+
+	umount_plan_key_current(&key);
+	plan = umount_plan_get(&key);
+	if (plan) {
+		umount_plan_run(plan);
+		umount_plan_put(plan);
+	} else if ((s = umount_snapshot_get())) {
+		plan = umount_plan_build(s, &key, gen);
+		if (plan)
+			umount_plan_publish(plan);
+		umount_snapshot_put(s);
+	} else {
+		down_read(&mount_list_lock);
+		list_for_each_entry (entry, &mount_list, list) {
+			pr_info("%s: unmounting: %s flags 0x%x\n", __func__,
+				entry->umountable, entry->flags);
+			try_umount(entry->umountable, entry->flags);
+		}
+		up_read(&mount_list_lock);
 	}
-	up_read(&mount_list_lock);
 
 	revert_creds(saved);
 
 	kfree(tw);
+	ksu_hook_stats_end(KSU_HOOK_STAT_UMOUNT, start);
 }
 
 int ksu_handle_umount(uid_t old_uid, uid_t new_uid)
@@ -135,7 +515,7 @@ int ksu_handle_umount(uid_t old_uid, uid_t new_uid)
 		return 0;
 	}
 
-	if (!ksu_kernel_umount_enabled) {
+	if (!static_branch_likely(&ksu_kernel_umount_key)) {
 		return 0;
 	}
 
@@ -176,7 +556,7 @@ int ksu_handle_umount(uid_t old_uid, uid_t new_uid)
 	pr_info("handle umount for uid: %d, pid: %d\n", new_uid, current->pid);
 
 #if __SULOG_GATE
-	{
+	if (ksu_sulog_wants(SULOG_SYSCALL, new_uid)) {
 		char uid_str[16];
 		snprintf(uid_str, sizeof(uid_str), "%d", new_uid);
 		ksu_sulog_report_syscall(new_uid, NULL, "setuid", uid_str);
@@ -208,4 +588,9 @@ void ksu_kernel_umount_init(void)
 void ksu_kernel_umount_exit(void)
 {
 	ksu_unregister_feature_handler(KSU_FEATURE_KERNEL_UMOUNT);
+
+	umount_plan_publish(NULL);
+	down_write(&mount_list_lock);
+	umount_snapshot_publish(NULL);
+	up_write(&mount_list_lock);
 }
\ No newline at end of file
@@ -15,11 +15,22 @@ int ksu_handle_umount(uid_t old_uid, uid_t new_uid);
 struct mount_entry {
 	char *umountable;
 	unsigned int flags;
+	unsigned int hash;
 	struct list_head list;
+	struct hlist_node node;
 };
 extern struct list_head mount_list;
 extern struct rw_semaphore mount_list_lock;
 
+// Call with mount_list_lock held after changing mount_list
+void ksu_umount_list_changed(void);
+
+// Drop the per-zygote umount plans once the mounts may have changed
+void ksu_umount_plans_invalidate(void);
+
+void ksu_umount_plan_stats(u32 *built, u32 *size, u64 *build_ns, u64 *hits,
+			   u64 *skipped);
+
 void try_umount(const char *mnt, int flags);
 
 #endif // #ifndef __KSU_H_KERNEL_UMOUNT
@@ -34,10 +34,14 @@
 #endif // #if !defined(CONFIG_KSU_HYMOFS) && !def...
 
 #include "allowlist.h"
+#include "apk_sign.h"
 #include "feature.h"
+#include "hook_stats.h"
 #include "klog.h"
 #include "ksu.h"
 #include "ksud.h"
+#include "selinux/selinux.h"
+#include "status_page.h"
 #include "supercalls.h"
 #include "superkey.h"
 #include "throne_tracker.h"
@@ -196,6 +200,7 @@ int ksu_yield(void)
 	ksu_allowlist_exit();
 	ksu_observer_exit();
 	ksu_throne_tracker_exit();
+	ksu_apk_sign_exit();
 
 #if !defined(CONFIG_KSU_HYMOFS) && !defined(CONFIG_KSU_MANUAL_HOOK)
 	ksu_ksud_exit();
@@ -207,7 +212,10 @@ int ksu_yield(void)
 	ksu_setuid_hook_exit();
 	yukisu_custom_config_exit();
 	ksu_supercalls_exit();
+	ksu_hook_stats_exit();
 	ksu_feature_exit();
+	ksu_status_page_exit();
+	ksu_selinux_exit();
 
 	pr_info("KernelSU GKI yielded successfully, LKM can take over now\n");
 	return 0;
@@ -262,8 +270,14 @@ int __init kernelsu_init(void)
 		pr_err("prepare cred failed!\n");
 	}
 
+	ksu_status_page_init();
+
 	ksu_feature_init();
 
+	ksu_hook_stats_init();
+
+	ksu_selinux_init();
+
 	ksu_supercalls_init();
 
 	// Initialize SuperKey authentication (APatch-style)
@@ -323,6 +337,7 @@ void kernelsu_exit(void)
 	ksu_allowlist_exit();
 
 	ksu_throne_tracker_exit();
+	ksu_apk_sign_exit();
 
 #ifdef CONFIG_KSU_LKM
 	ksu_observer_exit();
@@ -348,8 +363,14 @@ void kernelsu_exit(void)
 
 	ksu_supercalls_exit();
 
+	ksu_hook_stats_exit();
+
 	ksu_feature_exit();
 
+	ksu_status_page_exit();
+
+	ksu_selinux_exit();
+
 	if (ksu_cred) {
 		put_cred(ksu_cred);
 	}
@@ -31,6 +31,8 @@
 
 #include "allowlist.h"
 #include "arch.h"
+#include "events.h"
+#include "kernel_umount.h"
 #ifdef CONFIG_KSU_LKM
 #include "sucompat.h"
 #else
@@ -41,6 +43,7 @@ static bool is_boot_phase = true;
 #include "ksud.h"
 #include "manager.h"
 #include "selinux/selinux.h"
+#include "status_page.h"
 #include "throne_tracker.h"
 #include "util.h"
 
@@ -151,11 +154,17 @@ void on_module_mounted(void)
 {
 	pr_info("on_module_mounted!\n");
 	ksu_module_mounted = true;
+	ksu_umount_plans_invalidate();
+	ksu_event_notify(KSU_EVENT_MODULE_MOUNTED, 0, 0);
 }
 
 void on_boot_completed(void)
 {
 	ksu_boot_completed = true;
+	ksu_status_set_flag(KSU_STATUS_F_BOOT_COMPLETED, true);
+	// service scripts may have mounted more since zygote's first children
+	ksu_umount_plans_invalidate();
+	ksu_event_notify(KSU_EVENT_BOOT_COMPLETED, 0, 0);
 	pr_info("on_boot_completed!\n");
 	track_throne(true);
 }
@@ -605,6 +614,7 @@ bool ksu_is_safe_mode()
 		pr_info(
 		    "KEY_VOLUMEDOWN pressed max times, safe mode detected!\n");
 		safe_mode = true;
+		ksu_status_set_flag(KSU_STATUS_F_SAFE_MODE, true);
 		return true;
 	}
 
@@ -2,6 +2,8 @@
 #define __KSU_H_KSU_MANAGER
 
 #include "allowlist.h"
+#include "status_page.h"
+#include <linux/atomic.h>
 #include <linux/cred.h>
 #include <linux/types.h>
 
@@ -13,6 +15,15 @@
 
 extern uid_t ksu_manager_uid; // full uid
 extern uid_t ksu_manager_appid; // appid (0-99999)
+// bumped whenever is_manager() may change its answer
+extern atomic_t ksu_manager_generation;
+
+static inline void ksu_manager_changed(void)
+{
+	// pairs with the acquire in ksu_ioctl_permitted()
+	smp_mb__before_atomic();
+	ksu_status_manager_changed(atomic_inc_return(&ksu_manager_generation));
+}
 
 // SuperKey support
 #ifdef CONFIG_KSU_SUPERKEY
@@ -75,6 +86,7 @@ static inline uid_t ksu_get_manager_uid(void)
 static inline void ksu_set_manager_uid(uid_t uid)
 {
 	ksu_manager_uid = uid;
+	ksu_manager_changed();
 }
 
 static inline void ksu_set_manager_appid(uid_t appid)
@@ -83,11 +95,13 @@ static inline void ksu_set_manager_appid(uid_t appid)
 	// Also set full uid (use current user's uid)
 	ksu_manager_uid =
 	    current_uid().val / PER_USER_RANGE * PER_USER_RANGE + appid;
+	ksu_manager_changed();
 }
 
 static inline void ksu_invalidate_manager_uid(void)
 {
 	ksu_manager_uid = KSU_INVALID_UID;
+	ksu_manager_changed();
 #ifdef CONFIG_KSU_SUPERKEY
 	superkey_invalidate();
 #endif // #ifdef CONFIG_KSU_SUPERKEY
@@ -96,6 +110,7 @@ static inline void ksu_invalidate_manager_uid(void)
 static inline void ksu_invalidate_manager_appid(void)
 {
 	ksu_manager_appid = KSU_INVALID_UID;
+	ksu_manager_changed();
 #ifdef CONFIG_KSU_SUPERKEY
 	superkey_invalidate();
 #endif // #ifdef CONFIG_KSU_SUPERKEY
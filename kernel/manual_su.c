@@ -2,11 +2,14 @@
 #include <linux/cred.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/jump_label.h>
 #include <linux/mm.h>
+#include <linux/mutex.h>
 #include <linux/printk.h>
 #include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/uaccess.h>
+#include <linux/workqueue.h>
 
 #include "allowlist.h"
 #include "app_profile.h"
@@ -25,6 +28,27 @@ static struct ksu_token_entry auth_tokens[MAX_TOKENS] = {0};
 static int token_count = 0;
 static DEFINE_SPINLOCK(token_lock);
 
+DEFINE_STATIC_KEY_FALSE(ksu_manual_su_pending_key);
+// serializes flipping the key against pending_cnt
+static DEFINE_MUTEX(pending_key_lock);
+
+// static_branch_disable() may sleep, so the last removal from the syscall
+// path defers it here
+static void pending_key_work_func(struct work_struct *work)
+{
+	mutex_lock(&pending_key_lock);
+	if (!READ_ONCE(pending_cnt))
+		static_branch_disable(&ksu_manual_su_pending_key);
+	mutex_unlock(&pending_key_lock);
+}
+static DECLARE_WORK(pending_key_work, pending_key_work_func);
+
+// call once the syscall hooks that queue pending_key_work are gone
+void ksu_manual_su_exit(void)
+{
+	cancel_work_sync(&pending_key_work);
+}
+
 static char *get_token_from_envp(void)
 {
 	struct mm_struct *mm;
@@ -340,6 +364,8 @@ void remove_pending_root(uid_t uid)
 					"calls\n",
 					uid, REMOVE_DELAY_CALLS);
 				ksu_temp_revoke_root_once(uid);
+				if (!pending_cnt)
+					schedule_work(&pending_key_work);
 			} else {
 				pr_info("pending_root: UID %d remove_call=%d "
 					"(<%d)\n",
@@ -366,11 +392,14 @@ static void add_pending_root(uid_t uid)
 		}
 	}
 	pending_uids[pending_cnt++] = (struct pending_uid){uid, 0};
+	mutex_lock(&pending_key_lock);
+	static_branch_enable(&ksu_manual_su_pending_key);
+	mutex_unlock(&pending_key_lock);
 	ksu_temp_grant_root_once(uid);
 	pr_info("pending_root: cached UID %d\n", uid);
 }
 
-void ksu_try_escalate_for_uid(uid_t uid)
+void __ksu_try_escalate_for_uid(uid_t uid)
 {
 	if (!is_pending_root(uid))
 		return;
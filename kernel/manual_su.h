@@ -1,6 +1,7 @@
 #ifndef __KSU_MANUAL_SU_H
 #define __KSU_MANUAL_SU_H
 
+#include <linux/jump_label.h>
 #include <linux/sched.h>
 #include <linux/types.h>
 #include <linux/version.h>
@@ -45,5 +46,15 @@ struct ksu_token_entry {
 int ksu_handle_manual_su_request(int option, struct manual_su_request *request);
 bool is_pending_root(uid_t uid);
 void remove_pending_root(uid_t uid);
-void ksu_try_escalate_for_uid(uid_t uid);
+void __ksu_try_escalate_for_uid(uid_t uid);
+void ksu_manual_su_exit(void);
+
+// enabled only while there are pending uids, so task_alloc/clone stays cheap
+DECLARE_STATIC_KEY_FALSE(ksu_manual_su_pending_key);
+
+static inline void ksu_try_escalate_for_uid(uid_t uid)
+{
+	if (static_branch_unlikely(&ksu_manual_su_pending_key))
+		__ksu_try_escalate_for_uid(uid);
+}
 #endif // #ifndef __KSU_MANUAL_SU_H
@@ -40,7 +40,7 @@ static int ksu_handle_inode_event(struct fsnotify_mark *mark, u32 mask,
 	if (file_name->len == 13 &&
 	    !memcmp(file_name->name, "packages.list", 13)) {
 		pr_info("packages.list detected: %d\n", mask);
-		track_throne(false);
+		ksu_throne_tracker_schedule();
 	}
 	return 0;
 }
@@ -53,7 +53,7 @@ static KSU_DECL_FSNOTIFY_OPS(ksu_handle_generic_event)
 	if (ksu_fname_len(file_name) == 13 &&
 	    !memcmp(ksu_fname_arg(file_name), "packages.list", 13)) {
 		pr_info("packages.list detected: %d\n", mask);
-		track_throne(false);
+		ksu_throne_tracker_schedule();
 	}
 	return 0;
 }
@@ -0,0 +1,439 @@
+#include <linux/crc32.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/types.h>
+
+#include "klog.h" // IWYU pragma: keep
+#include "profile_codec.h"
+
+struct codec_writer {
+	u8 *p;
+	u8 *end;
+	bool overflow;
+};
+
+struct codec_reader {
+	const u8 *p;
+	const u8 *end;
+	bool error;
+};
+
+static void put_bytes(struct codec_writer *w, const void *src, size_t len)
+{
+	if (w->overflow || len > w->end - w->p) {
+		w->overflow = true;
+		return;
+	}
+	memcpy(w->p, src, len);
+	w->p += len;
+}
+
+static void put_u8(struct codec_writer *w, u8 v)
+{
+	put_bytes(w, &v, 1);
+}
+
+static void put_varint(struct codec_writer *w, u64 v)
+{
+	do {
+		u8 b = v & 0x7f;
+
+		v >>= 7;
+		if (v)
+			b |= 0x80;
+		put_u8(w, b);
+	} while (v);
+}
+
+static void put_string(struct codec_writer *w, const char *s, size_t max)
+{
+	size_t len = strnlen(s, max);
+
+	put_varint(w, len);
+	put_bytes(w, s, len);
+}
+
+static u64 get_varint(struct codec_reader *r)
+{
+	u64 v = 0;
+	int shift = 0;
+
+	while (!r->error) {
+		u8 b;
+
+		if (r->p >= r->end || shift > 63) {
+			r->error = true;
+			break;
+		}
+		b = *r->p++;
+		v |= (u64)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return v;
+		shift += 7;
+	}
+
+	return 0;
+}
+
+static u8 get_u8(struct codec_reader *r)
+{
+	if (r->error || r->p >= r->end) {
+		r->error = true;
+		return 0;
+	}
+	return *r->p++;
+}
+
+// dst always ends up NUL terminated
+static void get_string(struct codec_reader *r, char *dst, size_t size)
+{
+	u64 len = get_varint(r);
+
+	if (r->error || len >= size || len > r->end - r->p) {
+		r->error = true;
+		dst[0] = '\0';
+		return;
+	}
+	memcpy(dst, r->p, len);
+	dst[len] = '\0';
+	r->p += len;
+}
+
+/*
+ * use_default grants keep their root profile too: the su path doesn't look
+ * at it, but GET_APP_PROFILE hands it back and profile_valid() wants the
+ * domain.
+ */
+static bool has_root_profile(const struct app_profile *profile)
+{
+	return profile->allow_su;
+}
+
+static u32 clamped_groups(const struct root_profile *rp)
+{
+	return clamp_t(s32, rp->groups_count, 0, KSU_MAX_GROUPS);
+}
+
+static u8 profile_flags(const struct app_profile *profile)
+{
+	u8 flags = 0;
+
+	if (profile->allow_su) {
+		flags |= KSU_PROFILE_F_ALLOW_SU | KSU_PROFILE_F_ROOT_PROFILE;
+		if (profile->rp_config.use_default)
+			flags |= KSU_PROFILE_F_USE_DEFAULT;
+		if (profile->rp_config.template_name[0])
+			flags |= KSU_PROFILE_F_TEMPLATE;
+	} else {
+		if (profile->nrp_config.use_default)
+			flags |= KSU_PROFILE_F_USE_DEFAULT;
+		if (profile->nrp_config.profile.umount_modules)
+			flags |= KSU_PROFILE_F_UMOUNT_MODULES;
+	}
+
+	return flags;
+}
+
+size_t ksu_profile_encode_bound(u32 count)
+{
+	u32 blocks = max_t(u32, 1, DIV_ROUND_UP(count,
+						KSU_PROFILE_BLOCK_RECORDS));
+
+	return blocks * (sizeof(struct ksu_profile_block_hdr) + 5) +
+	       (size_t)count * KSU_PROFILE_RECORD_MAX;
+}
+
+size_t ksu_profile_encode_block(void *buf, size_t size,
+				struct app_profile *const *profiles, u32 count)
+{
+	struct ksu_profile_block_hdr hdr = {.count = count};
+	struct codec_writer w;
+	const char **domains;
+	u32 ndomains = 0;
+	u32 i, j;
+
+	if (size < sizeof(hdr))
+		return 0;
+
+	domains = kmalloc_array(max_t(u32, count, 1), sizeof(*domains),
+				GFP_KERNEL);
+	if (!domains)
+		return 0;
+
+	// collect the distinct domains first, records refer to them by index
+	for (i = 0; i < count; i++) {
+		const char *domain;
+
+		if (!has_root_profile(profiles[i]))
+			continue;
+		domain = profiles[i]->rp_config.profile.selinux_domain;
+		for (j = 0; j < ndomains; j++) {
+			if (!strncmp(domains[j], domain, KSU_SELINUX_DOMAIN))
+				break;
+		}
+		if (j == ndomains)
+			domains[ndomains++] = domain;
+	}
+
+	w.p = (u8 *)buf + sizeof(hdr);
+	w.end = (u8 *)buf + size;
+	w.overflow = false;
+
+	put_varint(&w, ndomains);
+	for (i = 0; i < ndomains; i++)
+		put_string(&w, domains[i], KSU_SELINUX_DOMAIN);
+
+	for (i = 0; i < count; i++) {
+		const struct app_profile *profile = profiles[i];
+		const struct root_profile *rp = &profile->rp_config.profile;
+		u8 flags = profile_flags(profile);
+		u32 groups_count;
+
+		put_varint(&w, profile->version);
+		put_varint(&w, (u32)profile->current_uid);
+		put_string(&w, profile->key, KSU_MAX_PACKAGE_NAME);
+		put_u8(&w, flags);
+
+		if (flags & KSU_PROFILE_F_TEMPLATE)
+			put_string(&w, profile->rp_config.template_name,
+				   KSU_MAX_PACKAGE_NAME);
+
+		if (!(flags & KSU_PROFILE_F_ROOT_PROFILE))
+			continue;
+
+		groups_count = clamped_groups(rp);
+		put_varint(&w, (u32)rp->uid);
+		put_varint(&w, (u32)rp->gid);
+		put_varint(&w, groups_count);
+		for (j = 0; j < groups_count; j++)
+			put_varint(&w, (u32)rp->groups[j]);
+		put_varint(&w, rp->capabilities.effective);
+		put_varint(&w, rp->capabilities.permitted);
+		put_varint(&w, rp->capabilities.inheritable);
+		for (j = 0; j < ndomains; j++) {
+			if (!strncmp(domains[j], rp->selinux_domain,
+				     KSU_SELINUX_DOMAIN))
+				break;
+		}
+		put_varint(&w, j);
+		put_varint(&w, (u32)rp->namespaces);
+	}
+
+	kfree(domains);
+
+	if (w.overflow)
+		return 0;
+
+	hdr.len = w.p - ((u8 *)buf + sizeof(hdr));
+	hdr.crc = crc32(0, (u8 *)buf + sizeof(hdr), hdr.len);
+	memcpy(buf, &hdr, sizeof(hdr));
+
+	return sizeof(hdr) + hdr.len;
+}
+
+// smallest record: version, current_uid, key length and flags
+#define PROFILE_RECORD_MIN 4
+
+static bool decode_record(struct codec_reader *r, struct app_profile *profile,
+			  char (*domains)[KSU_SELINUX_DOMAIN], u64 ndomains)
+{
+	struct root_profile *rp = &profile->rp_config.profile;
+	u64 domain;
+	u32 j;
+	u8 flags;
+
+	memset(profile, 0, sizeof(*profile));
+	profile->version = get_varint(r);
+	profile->current_uid = (u32)get_varint(r);
+	get_string(r, profile->key, sizeof(profile->key));
+	flags = get_u8(r);
+
+	profile->allow_su = !!(flags & KSU_PROFILE_F_ALLOW_SU);
+	if (profile->allow_su) {
+		profile->rp_config.use_default =
+		    !!(flags & KSU_PROFILE_F_USE_DEFAULT);
+	} else {
+		profile->nrp_config.use_default =
+		    !!(flags & KSU_PROFILE_F_USE_DEFAULT);
+		profile->nrp_config.profile.umount_modules =
+		    !!(flags & KSU_PROFILE_F_UMOUNT_MODULES);
+	}
+
+	if (flags & KSU_PROFILE_F_TEMPLATE)
+		get_string(r, profile->rp_config.template_name,
+			   sizeof(profile->rp_config.template_name));
+
+	if (!(flags & KSU_PROFILE_F_ROOT_PROFILE))
+		return !r->error;
+
+	rp->uid = (u32)get_varint(r);
+	rp->gid = (u32)get_varint(r);
+	rp->groups_count = (u32)get_varint(r);
+	if (rp->groups_count < 0 || rp->groups_count > KSU_MAX_GROUPS)
+		return false;
+	for (j = 0; j < rp->groups_count; j++)
+		rp->groups[j] = (u32)get_varint(r);
+	rp->capabilities.effective = get_varint(r);
+	rp->capabilities.permitted = get_varint(r);
+	rp->capabilities.inheritable = get_varint(r);
+	domain = get_varint(r);
+	if (r->error || domain >= ndomains)
+		return false;
+	memcpy(rp->selinux_domain, domains[domain],
+	       sizeof(rp->selinux_domain));
+	rp->namespaces = (u32)get_varint(r);
+
+	return !r->error;
+}
+
+bool ksu_profile_equal(const struct app_profile *a,
+		       const struct app_profile *b)
+{
+	const struct root_profile *ra = &a->rp_config.profile;
+	const struct root_profile *rb = &b->rp_config.profile;
+
+	if (a->version != b->version || a->current_uid != b->current_uid ||
+	    strncmp(a->key, b->key, KSU_MAX_PACKAGE_NAME) ||
+	    a->allow_su != b->allow_su)
+		return false;
+
+	if (!a->allow_su)
+		return a->nrp_config.use_default == b->nrp_config.use_default &&
+		       a->nrp_config.profile.umount_modules ==
+			   b->nrp_config.profile.umount_modules;
+
+	return a->rp_config.use_default == b->rp_config.use_default &&
+	       !strncmp(a->rp_config.template_name, b->rp_config.template_name,
+			KSU_MAX_PACKAGE_NAME) &&
+	       ra->uid == rb->uid && ra->gid == rb->gid &&
+	       clamped_groups(ra) == clamped_groups(rb) &&
+	       !memcmp(ra->groups, rb->groups,
+		       clamped_groups(ra) * sizeof(ra->groups[0])) &&
+	       ra->capabilities.effective == rb->capabilities.effective &&
+	       ra->capabilities.permitted == rb->capabilities.permitted &&
+	       ra->capabilities.inheritable == rb->capabilities.inheritable &&
+	       !strncmp(ra->selinux_domain, rb->selinux_domain,
+			KSU_SELINUX_DOMAIN) &&
+	       ra->namespaces == rb->namespaces;
+}
+
+/*
+ * The whole block is decoded before cb sees any of it, so a block that
+ * turns out to be malformed halfway doesn't leave its first records
+ * applied.
+ */
+static int decode_block(const u8 *payload, u32 len, u32 count,
+			ksu_profile_decode_cb cb, void *data, bool *stop)
+{
+	struct codec_reader r = {.p = payload, .end = payload + len};
+	char(*domains)[KSU_SELINUX_DOMAIN] = NULL;
+	struct app_profile *profiles = NULL;
+	u64 ndomains;
+	u32 i;
+	int ret = -EINVAL;
+
+	ndomains = get_varint(&r);
+	// every domain is referenced by at least one record
+	if (r.error || ndomains > count || count > len / PROFILE_RECORD_MIN)
+		return -EINVAL;
+
+	if (!count)
+		return 0;
+
+	// app_profile is too big for the stack, and so is a block of them
+	profiles = kvmalloc_array(count, sizeof(*profiles), GFP_KERNEL);
+	if (!profiles)
+		return -ENOMEM;
+
+	if (ndomains) {
+		domains = kmalloc_array(ndomains, sizeof(*domains), GFP_KERNEL);
+		if (!domains) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < ndomains; i++)
+		get_string(&r, domains[i], sizeof(domains[i]));
+
+	for (i = 0; i < count; i++) {
+		if (!decode_record(&r, &profiles[i], domains, ndomains))
+			goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (cb(&profiles[i], data)) {
+			*stop = true;
+			i++;
+			break;
+		}
+	}
+	ret = i;
+
+out:
+	kfree(domains);
+	kvfree(profiles);
+	return ret;
+}
+
+static int decode_blocks(const void *buf, size_t size, bool strict,
+			 ksu_profile_decode_cb cb, void *data)
+{
+	const u8 *p = buf;
+	const u8 *end = p + size;
+	struct ksu_profile_block_hdr hdr;
+	bool stop = false;
+	int decoded = 0;
+	int ret;
+
+	while (!stop && end - p >= sizeof(hdr)) {
+		memcpy(&hdr, p, sizeof(hdr));
+		p += sizeof(hdr);
+
+		if (hdr.len > end - p) {
+			pr_err("profile block truncated: %u > %zu\n", hdr.len,
+			       (size_t)(end - p));
+			return -EINVAL;
+		}
+
+		if (crc32(0, p, hdr.len) != hdr.crc) {
+			pr_warn("profile block checksum mismatch, skip %u "
+				"profiles\n",
+				hdr.count);
+			if (strict)
+				return -EINVAL;
+		} else {
+			ret = decode_block(p, hdr.len, hdr.count, cb, data,
+					   &stop);
+			if (ret < 0) {
+				pr_warn("profile block malformed: %d\n", ret);
+				if (strict || ret == -ENOMEM)
+					return ret;
+			} else {
+				decoded += ret;
+			}
+		}
+
+		p += hdr.len;
+	}
+
+	if (strict && (stop || p != end))
+		return -EINVAL;
+
+	return decoded;
+}
+
+int ksu_profile_decode_blocks(const void *buf, size_t size,
+			      ksu_profile_decode_cb cb, void *data)
+{
+	return decode_blocks(buf, size, false, cb, data);
+}
+
+int ksu_profile_check_blocks(const void *buf, size_t size,
+			     ksu_profile_decode_cb cb, void *data)
+{
+	return decode_blocks(buf, size, true, cb, data);
+}
@@ -0,0 +1,94 @@
+#ifndef __KSU_H_PROFILE_CODEC
+#define __KSU_H_PROFILE_CODEC
+
+#include "app_profile.h"
+#include <linux/types.h>
+
+/*
+ * Compact app profile encoding, used by the v4 allowlist file.
+ *
+ * Profiles are grouped in self-contained blocks:
+ *
+ *   struct ksu_profile_block_hdr
+ *   varint  domain count, then for each: varint length + bytes
+ *   records[count]
+ *
+ * and every record only carries what differs from the defaults:
+ *
+ *   varint  version
+ *   varint  current_uid
+ *   varint  key length + bytes
+ *   u8      KSU_PROFILE_F_* flags
+ *   if TEMPLATE:     varint length + template_name bytes
+ *   if ROOT_PROFILE: varint uid, gid, groups_count, groups[],
+ *                    effective, permitted, inheritable,
+ *                    domain index, namespaces
+ *
+ * ROOT_PROFILE is set for every ALLOW_SU record, USE_DEFAULT grants
+ * included. Older encoders left it out for those, their decoded root
+ * profile is zeroed.
+ *
+ * Varints are unsigned LEB128, signed fields are stored as their u32 bit
+ * pattern. crc is crc32 over the block payload, so a damaged block only
+ * loses its own records.
+ */
+
+#define KSU_PROFILE_F_ALLOW_SU (1 << 0)
+#define KSU_PROFILE_F_USE_DEFAULT (1 << 1)
+#define KSU_PROFILE_F_UMOUNT_MODULES (1 << 2)
+#define KSU_PROFILE_F_TEMPLATE (1 << 3)
+#define KSU_PROFILE_F_ROOT_PROFILE (1 << 4)
+
+// records per block when encoding
+#define KSU_PROFILE_BLOCK_RECORDS 64
+
+// worst case encoded size of a single record and its domain entry
+#define KSU_PROFILE_RECORD_MAX                                                 \
+	(5 * 4 + KSU_MAX_PACKAGE_NAME * 2 + 1 + 5 * (4 + KSU_MAX_GROUPS) +    \
+	 10 * 3 + 5 * 2 + KSU_SELINUX_DOMAIN)
+
+struct ksu_profile_block_hdr {
+	u32 len; // payload length, without this header
+	u32 count;
+	u32 crc;
+};
+
+// Upper bound of the buffer needed to encode count profiles.
+size_t ksu_profile_encode_bound(u32 count);
+
+/*
+ * Encode count profiles as one block into buf. Returns the number of bytes
+ * written, or 0 if buf is too small.
+ */
+size_t ksu_profile_encode_block(void *buf, size_t size,
+				struct app_profile *const *profiles, u32 count);
+
+/*
+ * Compare the fields the encoding carries, true if b is what decoding the
+ * encoded a gives back.
+ */
+bool ksu_profile_equal(const struct app_profile *a,
+		       const struct app_profile *b);
+
+typedef int (*ksu_profile_decode_cb)(struct app_profile *profile, void *data);
+
+/*
+ * Decode all blocks in buf, cb is called for every profile and may stop
+ * the walk by returning non-zero. Blocks failing the checksum or not
+ * parsing are skipped as a whole, cb never sees part of a block.
+ * Returns the number of profiles decoded, or a negative errno if the
+ * buffer is malformed.
+ */
+int ksu_profile_decode_blocks(const void *buf, size_t size,
+			      ksu_profile_decode_cb cb, void *data);
+
+/*
+ * Strict variant of ksu_profile_decode_blocks() for buffers that must be
+ * taken as a whole: a checksum mismatch, a malformed or truncated block,
+ * trailing bytes or cb returning non-zero all fail the walk with -EINVAL
+ * (or -ENOMEM). Meant as a dry run before applying anything.
+ */
+int ksu_profile_check_blocks(const void *buf, size_t size,
+			     ksu_profile_decode_cb cb, void *data);
+
+#endif // #ifndef __KSU_H_PROFILE_CODEC
@@ -111,6 +111,9 @@ void apply_kernelsu_rules(void)
 	ksu_dontaudit(db, "untrusted_app", KERNEL_SU_DOMAIN, "dir", "getattr");
 #endif // #ifdef CONFIG_KSU_LKM
 	mutex_unlock(&ksu_rules);
+
+	// KERNEL_SU_DOMAIN may only exist from now on
+	ksu_refresh_cached_sids();
 }
 
 #define MAX_SEPOL_LEN 128
@@ -490,6 +493,10 @@ exit:
 	// only allow and xallow needs to reset avc cache, but we cannot do that
 	// because we are in atomic context. so we just reset it every time.
 	reset_avc_cache();
+	// rules never renumber a context, only a newly added type can make
+	// one of the cached contexts resolve
+	if (!ret && cmd == CMD_TYPE)
+		ksu_refresh_cached_sids();
 
 	return ret;
 }
\ No newline at end of file
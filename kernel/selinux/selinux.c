@@ -1,9 +1,11 @@
 #include "../klog.h" // IWYU pragma: keep
 #include "../ksu.h"
 #include "linux/cred.h"
+#include "linux/notifier.h"
 #include "linux/sched.h"
 #include "linux/version.h"
 #ifdef CONFIG_KSU_LKM
+#include "linux/security.h"
 #include "selinux.h"
 #include "objsec.h"
 #else
@@ -144,7 +146,65 @@ static void __security_release_secctx(struct lsm_context *cp)
 #define __security_release_secctx security_release_secctx
 #endif // #if LINUX_VERSION_CODE < KERNEL_VERSION...
 
-bool is_task_ksu_domain(const struct cred *cred)
+enum ksu_cached_sid {
+	KSU_SID_SU,
+	KSU_SID_ZYGOTE,
+	KSU_SID_INIT,
+	KSU_SID_COUNT,
+};
+
+static const char *const cached_sid_contexts[KSU_SID_COUNT] = {
+    [KSU_SID_SU] = KERNEL_SU_CONTEXT,
+    [KSU_SID_ZYGOTE] = "u:r:zygote:s0",
+    [KSU_SID_INIT] = "u:r:init:s0",
+};
+
+// 0 while the context is not (yet) in the loaded policy
+static u32 cached_sids[KSU_SID_COUNT] __read_mostly;
+
+static u32 resolve_sid(const char *context)
+{
+	struct lsm_context ctx;
+	u32 sid = 0;
+	bool match;
+
+	if (security_secctx_to_secid(context, strlen(context), &sid))
+		return 0;
+
+	// before the first policy load every context maps to the kernel sid,
+	// so only trust the sid if it maps back to what we asked for
+	if (__security_secid_to_secctx(sid, &ctx))
+		return 0;
+	match = ctx.len >= strlen(context) &&
+		!strncmp(context, ctx.context, strlen(context));
+	__security_release_secctx(&ctx);
+
+	return match ? sid : 0;
+}
+
+void ksu_refresh_cached_sids(void)
+{
+	bool changed = false;
+	u32 sid;
+	int i;
+
+	for (i = 0; i < KSU_SID_COUNT; i++) {
+		sid = resolve_sid(cached_sid_contexts[i]);
+		if (sid == cached_sids[i])
+			continue;
+		WRITE_ONCE(cached_sids[i], sid);
+		changed = true;
+	}
+
+	if (!changed)
+		return;
+
+	pr_info("selinux: cached sids su: %u, zygote: %u, init: %u\n",
+		cached_sids[KSU_SID_SU], cached_sids[KSU_SID_ZYGOTE],
+		cached_sids[KSU_SID_INIT]);
+}
+
+bool is_context(const struct cred *cred, const char *context)
 {
 	struct lsm_context ctx;
 	bool result;
@@ -164,50 +224,85 @@ bool is_task_ksu_domain(const struct cred *cred)
 	if (err) {
 		return false;
 	}
-	result = strncmp(KERNEL_SU_CONTEXT, ctx.context, ctx.len) == 0;
+	result = strncmp(context, ctx.context, ctx.len) == 0;
 	__security_release_secctx(&ctx);
 	return result;
 }
 
-bool is_ksu_domain(void)
-{
-	current_sid();
-	return is_task_ksu_domain(current_cred());
-}
-
-bool is_context(const struct cred *cred, const char *context)
+static bool is_cached_context(const struct cred *cred, enum ksu_cached_sid id)
 {
-	struct lsm_context ctx;
-	bool result;
-	if (!cred) {
-		return false;
-	}
+	u32 sid = READ_ONCE(cached_sids[id]);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 18, 0)
 	const struct task_security_struct *tsec;
 #else
 	const struct cred_security_struct *tsec;
 #endif // #if LINUX_VERSION_CODE < KERNEL_VERSION...
-	tsec = cred->security;
-	if (!tsec) {
+
+	if (unlikely(!sid))
+		return is_context(cred, cached_sid_contexts[id]);
+
+	if (!cred) {
 		return false;
 	}
-	int err = __security_secid_to_secctx(tsec->sid, &ctx);
-	if (err) {
+	tsec = cred->security;
+	if (!tsec) {
 		return false;
 	}
-	result = strncmp(context, ctx.context, ctx.len) == 0;
-	__security_release_secctx(&ctx);
-	return result;
+	return tsec->sid == sid;
+}
+
+bool is_task_ksu_domain(const struct cred *cred)
+{
+	return is_cached_context(cred, KSU_SID_SU);
+}
+
+bool is_ksu_domain(void)
+{
+	current_sid();
+	return is_task_ksu_domain(current_cred());
 }
 
 bool is_zygote(const struct cred *cred)
 {
-	return is_context(cred, "u:r:zygote:s0");
+	return is_cached_context(cred, KSU_SID_ZYGOTE);
 }
 
 bool is_init(const struct cred *cred)
 {
-	return is_context(cred, "u:r:init:s0");
+	return is_cached_context(cred, KSU_SID_INIT);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0)
+// policy reloads can renumber or drop our contexts
+static int ksu_policy_change_notify(struct notifier_block *nb,
+				    unsigned long event, void *data)
+{
+	if (event == LSM_POLICY_CHANGE)
+		ksu_refresh_cached_sids();
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ksu_policy_nb = {
+    .notifier_call = ksu_policy_change_notify,
+};
+#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
+
+void ksu_selinux_init(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0)
+	int ret = register_blocking_lsm_notifier(&ksu_policy_nb);
+
+	if (ret)
+		pr_err("selinux: register policy notifier failed: %d\n", ret);
+#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
+	ksu_refresh_cached_sids();
+}
+
+void ksu_selinux_exit(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0)
+	unregister_blocking_lsm_notifier(&ksu_policy_nb);
+#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
 }
 
 u32 ksu_get_ksu_file_sid()
@@ -33,6 +33,13 @@ bool is_init(const struct cred *cred);
 
 void apply_kernelsu_rules(void);
 
+// Re-resolve the sids behind is_task_ksu_domain(), is_zygote() and
+// is_init(), needed whenever the policy changes.
+void ksu_refresh_cached_sids(void);
+
+void ksu_selinux_init(void);
+void ksu_selinux_exit(void);
+
 u32 ksu_get_ksu_file_sid(void);
 
 int handle_sepolicy(unsigned long arg3, void __user *arg4);
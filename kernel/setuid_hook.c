@@ -36,6 +36,7 @@
 
 #include "allowlist.h"
 #include "feature.h"
+#include "hook_stats.h"
 #include "kernel_umount.h"
 #include "klog.h" // IWYU pragma: keep
 #include "manager.h"
@@ -108,7 +109,7 @@ static void ksu_install_manager_fd_tw_func(struct callback_head *cb)
 
 #ifndef CONFIG_KSU_HYMOFS
 /* Manual hook version - KSU handles hiding via syscall hooks */
-int ksu_handle_setuid(uid_t new_uid, uid_t old_uid, uid_t euid)
+static int __ksu_handle_setuid(uid_t new_uid, uid_t old_uid, uid_t euid)
 { // (new_euid)
 	if (old_uid != new_uid)
 		pr_info("handle_setresuid from %d to %d\n", old_uid, new_uid);
@@ -223,7 +224,7 @@ int ksu_handle_setuid(uid_t new_uid, uid_t old_uid, uid_t euid)
 #else // ifndef CONFIG_KSU_HYMOFS
 /* HymoFS inline hook version - Mark processes at setuid time for efficient
  * hiding */
-int ksu_handle_setuid(uid_t new_uid, uid_t old_uid, uid_t euid)
+static int __ksu_handle_setuid(uid_t new_uid, uid_t old_uid, uid_t euid)
 {
 	// if old process is root, ignore it.
 	if (old_uid != 0 && ksu_enhanced_security_enabled) {
@@ -342,6 +343,15 @@ do_umount:
 }
 #endif // #ifndef CONFIG_KSU_HYMOFS
 
+int ksu_handle_setuid(uid_t new_uid, uid_t old_uid, uid_t euid)
+{
+	u64 start = ksu_hook_stats_start();
+	int ret = __ksu_handle_setuid(new_uid, old_uid, euid);
+
+	ksu_hook_stats_end(KSU_HOOK_STAT_SETUID, start);
+	return ret;
+}
+
 int ksu_handle_setresuid(uid_t ruid, uid_t euid, uid_t suid)
 {
 	// we rely on the fact that zygote always call setresuid(3) with same
@@ -0,0 +1,173 @@
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/version.h>
+
+#include "events.h"
+#include "feature.h"
+#include "klog.h" // IWYU pragma: keep
+#include "ksu.h"
+#include "ksud.h"
+#include "manager.h"
+#include "status_page.h"
+#include "supercalls.h"
+
+static struct ksu_status_page *status;
+// serializes writers, readers only ever look at seq
+static DEFINE_SPINLOCK(status_lock);
+
+// Returns false without a page, otherwise the caller updates and ends it
+static bool status_write_begin(unsigned long *flags)
+{
+	spin_lock_irqsave(&status_lock, *flags);
+	if (!status) {
+		spin_unlock_irqrestore(&status_lock, *flags);
+		return false;
+	}
+	WRITE_ONCE(status->seq, status->seq + 1);
+	smp_wmb();
+	return true;
+}
+
+static void status_write_end(unsigned long flags)
+{
+	smp_wmb();
+	WRITE_ONCE(status->seq, status->seq + 1);
+	spin_unlock_irqrestore(&status_lock, flags);
+}
+
+void ksu_status_set_flag(u32 flag, bool set)
+{
+	unsigned long flags;
+
+	if (!status_write_begin(&flags))
+		return;
+	if (set)
+		status->flags |= flag;
+	else
+		status->flags &= ~flag;
+	status_write_end(flags);
+}
+
+void ksu_status_set_feature(u32 feature_id, u64 value, bool supported)
+{
+	u64 bit = 1ULL << (feature_id % 64);
+	unsigned long flags;
+
+	if (feature_id >= KSU_STATUS_MAX_FEATURES)
+		return;
+
+	if (status_write_begin(&flags)) {
+		status->features[feature_id] = supported ? value : 0;
+		if (supported)
+			status->feature_supported[feature_id / 64] |= bit;
+		else
+			status->feature_supported[feature_id / 64] &= ~bit;
+		status_write_end(flags);
+	}
+
+	ksu_event_notify(KSU_EVENT_FEATURE, feature_id, supported ? value : 0);
+}
+
+void ksu_status_manager_changed(u32 generation)
+{
+	uid_t uid = ksu_get_manager_uid();
+	unsigned long flags;
+
+	if (status_write_begin(&flags)) {
+		status->manager_uid = uid;
+		status->manager_gen = generation;
+		status_write_end(flags);
+	}
+
+	ksu_event_notify(KSU_EVENT_MANAGER, uid, generation);
+}
+
+void ksu_status_allowlist_changed(void)
+{
+	unsigned long flags;
+	u32 generation = 0;
+
+	if (status_write_begin(&flags)) {
+		generation = ++status->allowlist_gen;
+		status_write_end(flags);
+	}
+
+	ksu_event_notify(KSU_EVENT_ALLOWLIST, 0, generation);
+}
+
+void ksu_status_su_granted(void)
+{
+	unsigned long flags;
+
+	if (!status_write_begin(&flags))
+		return;
+	status->su_grants++;
+	status_write_end(flags);
+}
+
+int ksu_status_page_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	if (!status)
+		return -ENODEV;
+
+	/*
+	 * Any process can get the driver fd, but the page holds what the
+	 * manager_or_root() ioctls guard (manager uid, features, hook type,
+	 * grants), so apply the same check here.
+	 */
+	if (current_uid().val != 0 && !is_manager())
+		return -EPERM;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE ||
+	    (vma->vm_flags & VM_WRITE))
+		return -EINVAL;
+
+	// the fd is O_RDWR, keep mprotect() from making the page writable
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_mod(vma, VM_DONTEXPAND | VM_DONTDUMP, VM_MAYWRITE);
+#else
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
+
+	return vm_insert_page(vma, vma->vm_start, virt_to_page(status));
+}
+
+void ksu_status_page_init(void)
+{
+	BUILD_BUG_ON(sizeof(struct ksu_status_page) > PAGE_SIZE);
+	BUILD_BUG_ON(KSU_FEATURE_MAX > KSU_STATUS_MAX_FEATURES);
+
+	status = (struct ksu_status_page *)get_zeroed_page(GFP_KERNEL);
+	if (!status) {
+		pr_err("status_page: alloc failed\n");
+		return;
+	}
+
+	status->magic = KSU_STATUS_MAGIC;
+	status->version = KERNEL_SU_VERSION;
+	status->manager_uid = ksu_get_manager_uid();
+	status->manager_gen = atomic_read(&ksu_manager_generation);
+	status->flags |= ksu_boot_completed ? KSU_STATUS_F_BOOT_COMPLETED : 0;
+	strscpy(status->hook_type, ksu_hook_type(), sizeof(status->hook_type));
+#ifdef MODULE
+	status->flags |= KSU_STATUS_F_LKM;
+#endif // #ifdef MODULE
+}
+
+void ksu_status_page_exit(void)
+{
+	struct ksu_status_page *page;
+	unsigned long flags;
+
+	spin_lock_irqsave(&status_lock, flags);
+	page = status;
+	status = NULL;
+	spin_unlock_irqrestore(&status_lock, flags);
+
+	// mappings hold their own reference on the page
+	if (page)
+		free_page((unsigned long)page);
+}
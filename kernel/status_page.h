@@ -0,0 +1,54 @@
+#ifndef __KSU_H_STATUS_PAGE
+#define __KSU_H_STATUS_PAGE
+
+#include <linux/types.h>
+
+struct file;
+struct vm_area_struct;
+
+#define KSU_STATUS_MAGIC 0x5355534b // "KSUS"
+#define KSU_STATUS_MAX_FEATURES 128
+
+#define KSU_STATUS_F_LKM (1 << 0)
+#define KSU_STATUS_F_SAFE_MODE (1 << 1)
+#define KSU_STATUS_F_BOOT_COMPLETED (1 << 2)
+
+/*
+ * Read-only page mmap()ed from the driver fd, by root or the manager only.
+ * seq is odd while the kernel updates the page, readers copy what they need
+ * and retry if seq was odd or has changed since they started.
+ */
+struct ksu_status_page {
+	__u32 magic;
+	__u32 seq;
+	__u32 version; // KERNEL_SU_VERSION
+	__u32 flags; // KSU_STATUS_F_*
+	__u32 manager_uid; // (__u32)-1 without a manager
+	__u32 manager_gen; // changes whenever the manager does
+	__u32 allowlist_gen; // changes whenever an app profile does
+	__u32 _reserved;
+	__u64 su_grants; // root escalations since boot
+	char hook_type[32];
+	__u64 feature_supported[KSU_STATUS_MAX_FEATURES / 64];
+	__u64 features[KSU_STATUS_MAX_FEATURES]; // value of feature id n
+};
+
+void ksu_status_set_flag(u32 flag, bool set);
+
+// These also raise the matching event, see events.h
+
+void ksu_status_set_feature(u32 feature_id, u64 value, bool supported);
+
+void ksu_status_manager_changed(u32 generation);
+
+void ksu_status_allowlist_changed(void);
+
+void ksu_status_su_granted(void);
+
+int ksu_status_page_mmap(struct file *filp, struct vm_area_struct *vma);
+
+void ksu_status_page_init(void);
+
+void ksu_status_page_exit(void);
+
+#endif // #ifndef __KSU_H_STATUS_PAGE
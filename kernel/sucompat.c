@@ -1,4 +1,5 @@
 #include <linux/mm.h>
+#include <linux/percpu.h>
 #include <linux/preempt.h>
 #include <linux/printk.h>
 #include <linux/version.h>
@@ -10,6 +11,7 @@
 #include <asm/current.h>
 #include <linux/cred.h>
 #include <linux/fs.h>
+#include <linux/jump_label.h>
 #include <linux/ptrace.h>
 #include <linux/types.h>
 #include <linux/uaccess.h>
@@ -49,6 +51,8 @@
 #define SH_PATH "/system/bin/sh"
 
 bool ksu_su_compat_enabled __read_mostly = true;
+// mirrors ksu_su_compat_enabled for the syscall dispatch fast path
+DEFINE_STATIC_KEY_TRUE(ksu_su_compat_key);
 
 #if defined(CONFIG_KSU_MANUAL_HOOK) || defined(CONFIG_KSU_HYMOFS)
 EXPORT_SYMBOL(ksu_su_compat_enabled);
@@ -64,6 +68,10 @@ static int su_compat_feature_set(u64 value)
 {
 	bool enable = value != 0;
 	ksu_su_compat_enabled = enable;
+	if (enable)
+		static_branch_enable(&ksu_su_compat_key);
+	else
+		static_branch_disable(&ksu_su_compat_key);
 	pr_info("su_compat: set to %d\n", enable);
 	return 0;
 }
@@ -95,7 +103,51 @@ static const char sh_path[] = SH_PATH;
 static const char su_path[] = SU_PATH;
 static const char ksud_path[] = KSUD_PATH;
 
-extern bool ksu_kernel_umount_enabled;
+#ifdef CONFIG_KSU_LKM
+#define su_copy_nofault(dst, src, size) copy_from_user_nofault(dst, src, size)
+#else
+#define su_copy_nofault(dst, src, size)                                        \
+	ksu_copy_from_user_nofault(dst, src, size)
+#endif // #ifdef CONFIG_KSU_LKM
+
+static DEFINE_PER_CPU(unsigned long, su_prefilter_checked);
+static DEFINE_PER_CPU(unsigned long, su_prefilter_skipped);
+
+/*
+ * Almost nothing a root app stats is su. su_path is 15 bytes with its NUL,
+ * so two overlapping 8 byte loads at offset 0 and 7 cover all of it, and
+ * only an exact match goes on to the full copy and compare.
+ */
+static bool su_path_prefilter(const char __user *filename)
+{
+	u64 head, tail;
+
+	BUILD_BUG_ON(sizeof(su_path) != 15);
+
+	this_cpu_inc(su_prefilter_checked);
+
+	if (su_copy_nofault(&head, filename, sizeof(head)) ||
+	    memcmp(&head, su_path, sizeof(head)) ||
+	    su_copy_nofault(&tail, filename + 7, sizeof(tail)) ||
+	    memcmp(&tail, su_path + 7, sizeof(tail))) {
+		this_cpu_inc(su_prefilter_skipped);
+		return false;
+	}
+
+	return true;
+}
+
+void ksu_sucompat_prefilter_stats(u64 *checked, u64 *skipped)
+{
+	int cpu;
+
+	*checked = 0;
+	*skipped = 0;
+	for_each_possible_cpu (cpu) {
+		*checked += per_cpu(su_prefilter_checked, cpu);
+		*skipped += per_cpu(su_prefilter_skipped, cpu);
+	}
+}
 
 // the call from execve_handler_pre won't provided correct value for
 // __never_use_argument, use them after fix execve_handler_pre, keeping them for
@@ -253,6 +305,9 @@ int ksu_handle_faccessat(int *dfd, const char __user **filename_user, int *mode,
 	if (!ksu_is_allow_uid_for_current(current_uid().val))
 		return 0;
 
+	if (likely(!su_path_prefilter(*filename_user)))
+		return 0;
+
 #ifdef CONFIG_KSU_LKM
 	strncpy_from_user_nofault(path, *filename_user, sizeof(path));
 #else
@@ -314,6 +369,9 @@ int ksu_handle_stat(int *dfd, const char __user **filename_user, int *flags)
 	if (!ksu_is_allow_uid_for_current(current_uid().val))
 		return 0;
 
+	if (likely(!su_path_prefilter(*filename_user)))
+		return 0;
+
 #ifdef CONFIG_KSU_LKM
 	strncpy_from_user_nofault(path, *filename_user, sizeof(path));
 #else
@@ -1,12 +1,18 @@
 #ifndef __KSU_H_SUCOMPAT
 #define __KSU_H_SUCOMPAT
+#include <linux/jump_label.h>
 #include <linux/types.h>
 
 extern bool ksu_su_compat_enabled;
+DECLARE_STATIC_KEY_TRUE(ksu_su_compat_key);
 
 void ksu_sucompat_init(void);
 void ksu_sucompat_exit(void);
 
+// How many stat/faccessat paths went through the su path prefilter and how
+// many of them it rejected without a full copy.
+void ksu_sucompat_prefilter_stats(u64 *checked, u64 *skipped);
+
 // Handler functions exported for hook_manager
 int ksu_handle_faccessat(int *dfd, const char __user **filename_user, int *mode,
 			 int *__unused_flags);
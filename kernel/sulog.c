@@ -1,4 +1,6 @@
+#include <linux/anon_inodes.h>
 #include <linux/cred.h>
+#include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/kernel.h>
 #include <linux/pid.h>
@@ -14,23 +16,120 @@
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
 #include <linux/sched/task.h>
 #endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
+#include <linux/atomic.h>
+#include <linux/fs_struct.h>
+#include <linux/ioctl.h>
+#include <linux/kthread.h>
 #include <linux/ktime.h>
 #include <linux/mm.h>
 #include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/rcupdate.h>
 #include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
 
 #include "feature.h"
+#include "hook_stats.h"
 #include "kernel_compat.h"
 #include "klog.h"
 #include "ksu.h"
 #include "sulog.h"
+#include "supercalls.h"
 
 #if __SULOG_GATE
 
-struct dedup_entry dedup_tbl[SULOG_COMM_LEN];
-static DEFINE_SPINLOCK(dedup_lock);
-static LIST_HEAD(sulog_queue);
+/*
+ * Every cpu owns a ring of fixed size records. Producers reserve a slot with
+ * a cmpxchg on their own cpu's head and publish it by storing its sequence,
+ * so reporting never takes a lock or allocates. The writer kthread is the
+ * only consumer, it drains the rings in timestamp order, formats the lines
+ * and appends them to the log file in batches.
+ */
+struct sulog_slot {
+	unsigned long seq; // position + 1 once the record is complete
+	struct sulog_record rec;
+};
+
+struct sulog_ring {
+	unsigned long head; // next position to reserve, owning cpu only
+	unsigned long tail; // next position to consume, consumer only
+	atomic_long_t dropped; // records lost because the ring was full
+	struct sulog_slot slots[SULOG_RING_SIZE];
+};
+
+struct sulog_writer {
+	struct task_struct *task;
+	struct sulog_ring **rings; // stays valid until the writer is stopped
+	struct path root; // kthreads start out in the initial rootfs
+	struct file *fp;
+	loff_t pos;
+	char *buf; // formatted lines not yet written
+	size_t len;
+	bool dirty; // written since the last fsync
+	unsigned long last_sync;
+};
+
+/*
+ * The writer also copies every record it drains into the stream, a ring of
+ * the last SULOG_STREAM_SIZE records that stream fds read from. Each reader
+ * keeps its own cursor, one that fell more than a ring behind skips ahead and
+ * gets a SULOG_DROPPED record for what it missed.
+ */
+struct sulog_stream {
+	spinlock_t lock;
+	unsigned long head; // records published so far
+	struct sulog_record *recs;
+};
+
+struct sulog_reader {
+	unsigned long pos; // next record to read, under the stream lock
+};
+
+static struct sulog_ring **sulog_rings __read_mostly;
+static struct sulog_writer writer;
+static DECLARE_WAIT_QUEUE_HEAD(sulog_writer_wq);
+// records pushed since the writer last drained the rings
+static atomic_t sulog_unflushed = ATOMIC_INIT(0);
+
+static struct sulog_stream stream = {
+    .lock = __SPIN_LOCK_UNLOCKED(stream.lock),
+};
+static DECLARE_WAIT_QUEUE_HEAD(sulog_stream_wq);
+static atomic_t sulog_stream_readers = ATOMIC_INIT(0);
+
+struct sulog_dedup_slot {
+	spinlock_t lock;
+	u32 hash; // of the event last logged from this slot
+	u32 since; // seconds, when it was logged
+	u32 repeats; // dropped since, aggregate mode only
+	u64 last_ns; // time of the latest repeat
+	struct sulog_record rec; // the event last logged
+};
+
+static struct sulog_dedup_slot dedup_tbl[SULOG_DEDUP_SLOTS];
+// slots holding repeats the writer has yet to log
+static atomic_t sulog_aggregated = ATOMIC_INIT(0);
+
+// every type but SULOG_DROPPED, which can't be filtered
+#define SULOG_TYPE_MASK_ALL ((1U << SULOG_DROPPED) - 1)
+#define SULOG_FILTER_IOCTLS 256
+
+struct sulog_filter {
+	struct rcu_head rcu;
+	u32 type_mask;
+	u32 uid_count;
+	u32 uids[KSU_SULOG_FILTER_MAX_UIDS];
+	DECLARE_BITMAP(ioctls, SULOG_FILTER_IOCTLS);
+};
+
+// NULL until the first KSU_SULOG_FILTER_SET, logs everything
+static struct sulog_filter __rcu *sulog_filter;
+static DEFINE_MUTEX(sulog_filter_mutex);
+static bool sulog_aggregate __read_mostly;
+
 static bool sulog_enabled __read_mostly = true;
+static u32 sulog_fsync_interval __read_mostly = SULOG_FSYNC_INTERVAL;
 
 static int sulog_feature_get(u64 *value)
 {
@@ -53,13 +152,34 @@ static const struct ksu_feature_handler sulog_handler = {
     .set_handler = sulog_feature_set,
 };
 
-static void get_timestamp(char *buf, size_t len)
+static int sulog_fsync_interval_get(u64 *value)
+{
+	*value = sulog_fsync_interval;
+	return 0;
+}
+
+static int sulog_fsync_interval_set(u64 value)
+{
+	if (value > SULOG_FSYNC_INTERVAL_MAX)
+		return -EINVAL;
+	WRITE_ONCE(sulog_fsync_interval, value);
+	pr_info("sulog: fsync interval set to %llus\n", value);
+	return 0;
+}
+
+static const struct ksu_feature_handler sulog_fsync_interval_handler = {
+    .feature_id = KSU_FEATURE_SULOG_FSYNC_INTERVAL,
+    .name = "sulog_fsync_interval",
+    .get_handler = sulog_fsync_interval_get,
+    .set_handler = sulog_fsync_interval_set,
+};
+
+static void get_timestamp(u64 ts_ns, char *buf, size_t len)
 {
-	struct timespec64 ts;
 	struct tm tm;
+	time64_t secs = div_u64(ts_ns, NSEC_PER_SEC);
 
-	ktime_get_real_ts64(&ts);
-	time64_to_tm(ts.tv_sec - sys_tz.tz_minuteswest * 60, 0, &tm);
+	time64_to_tm(secs - sys_tz.tz_minuteswest * 60, 0, &tm);
 
 	snprintf(buf, len, "%04ld-%02d-%02d %02d:%02d:%02d", tm.tm_year + 1900,
 		 tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
@@ -127,270 +247,883 @@ static void sanitize_string(char *str, size_t len)
 	str[write_pos] = '\0';
 }
 
-static bool dedup_should_print(uid_t uid, u8 type, const char *content,
-			       size_t len)
+static bool sulog_filter_match(const struct sulog_filter *f, u8 type,
+			       uid_t uid)
 {
-	struct dedup_key key = {
-	    .crc = dedup_calc_hash(content, len),
-	    .uid = uid,
-	    .type = type,
-	};
-	u64 now = ktime_get_ns();
-	u64 delta_ns = (u64)DEDUP_SECS * (u64)NSEC_PER_SEC;
+	u32 i;
+
+	if (!(f->type_mask & BIT(type)))
+		return false;
+	for (i = 0; i < f->uid_count; i++) {
+		if (f->uids[i] == uid)
+			return false;
+	}
+	return true;
+}
 
-	u32 idx = key.crc & (SULOG_COMM_LEN - 1);
-	spin_lock(&dedup_lock);
+// ioctl_nr is the _IOC_NR of an audited supercall, or -1
+static bool sulog_filter_check(u8 type, uid_t uid, int ioctl_nr)
+{
+	const struct sulog_filter *f;
+	bool ret = true;
 
-	struct dedup_entry *e = &dedup_tbl[idx];
-	if (e->key.crc == key.crc && e->key.uid == key.uid &&
-	    e->key.type == key.type && (now - e->ts_ns) < delta_ns) {
-		spin_unlock(&dedup_lock);
+	// nothing to log into before post-fs-data
+	if (!sulog_enabled || !smp_load_acquire(&sulog_rings))
 		return false;
+
+	rcu_read_lock();
+	f = rcu_dereference(sulog_filter);
+	if (f) {
+		ret = sulog_filter_match(f, type, uid) &&
+		      (ioctl_nr < 0 || !test_bit(ioctl_nr, f->ioctls));
 	}
+	rcu_read_unlock();
+
+	return ret;
+}
+
+bool ksu_sulog_wants(u8 type, uid_t uid)
+{
+	return sulog_filter_check(type, uid, -1);
+}
 
-	e->key = key;
-	e->ts_ns = now;
-	spin_unlock(&dedup_lock);
+bool ksu_sulog_wants_ioctl(unsigned int cmd, uid_t uid)
+{
+	return sulog_filter_check(SULOG_SYSCALL, uid, _IOC_NR(cmd));
+}
+
+void ksu_sulog_get_filter(struct ksu_sulog_filter_cmd *cmd)
+{
+	const struct sulog_filter *f;
+	int i;
+
+	cmd->flags = sulog_aggregate ? KSU_SULOG_FILTER_AGGREGATE : 0;
+	cmd->type_mask = SULOG_TYPE_MASK_ALL;
+	cmd->uid_count = 0;
+	memset(cmd->ioctl_mask, 0, sizeof(cmd->ioctl_mask));
+
+	rcu_read_lock();
+	f = rcu_dereference(sulog_filter);
+	if (f) {
+		cmd->type_mask = f->type_mask;
+		cmd->uid_count = f->uid_count;
+		memcpy(cmd->uids, f->uids, sizeof(cmd->uids));
+		for_each_set_bit (i, f->ioctls, SULOG_FILTER_IOCTLS)
+			cmd->ioctl_mask[i / 64] |= 1ULL << (i % 64);
+	}
+	rcu_read_unlock();
+}
+
+int ksu_sulog_set_filter(const struct ksu_sulog_filter_cmd *cmd)
+{
+	struct sulog_filter *f, *old;
+	int i;
+
+	BUILD_BUG_ON(sizeof(cmd->ioctl_mask) * 8 != SULOG_FILTER_IOCTLS);
+
+	if (cmd->uid_count > KSU_SULOG_FILTER_MAX_UIDS ||
+	    cmd->flags & ~KSU_SULOG_FILTER_AGGREGATE)
+		return -EINVAL;
+
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
+
+	f->type_mask = cmd->type_mask & SULOG_TYPE_MASK_ALL;
+	f->uid_count = cmd->uid_count;
+	memcpy(f->uids, cmd->uids, sizeof(f->uids));
+	for (i = 0; i < SULOG_FILTER_IOCTLS; i++) {
+		if (cmd->ioctl_mask[i / 64] & (1ULL << (i % 64)))
+			__set_bit(i, f->ioctls);
+	}
+
+	mutex_lock(&sulog_filter_mutex);
+	old = rcu_dereference_protected(
+	    sulog_filter, lockdep_is_held(&sulog_filter_mutex));
+	rcu_assign_pointer(sulog_filter, f);
+	WRITE_ONCE(sulog_aggregate,
+		   !!(cmd->flags & KSU_SULOG_FILTER_AGGREGATE));
+	mutex_unlock(&sulog_filter_mutex);
+
+	if (old)
+		kfree_rcu(old, rcu);
+
+	pr_info("sulog: filter set, types: 0x%x, uids: %u, aggregate: %d\n",
+		f->type_mask, f->uid_count, sulog_aggregate);
+	return 0;
+}
+
+// Takes the repeats counted in a locked slot as one "xN" record
+static bool dedup_take_repeats(struct sulog_dedup_slot *slot,
+			       struct sulog_record *rec)
+{
+	if (!slot->repeats)
+		return false;
+
+	memcpy(rec, &slot->rec, sizeof(*rec));
+	rec->ts_ns = slot->last_ns;
+	rec->count = min_t(u32, slot->repeats, U16_MAX);
+	slot->repeats = 0;
+	atomic_dec(&sulog_aggregated);
 	return true;
 }
 
-static void sulog_process_queue(void)
+static void sulog_ring_push(const struct sulog_record *rec);
+
+/*
+ * Repeats of an event within DEDUP_SECS of its last log are dropped. In
+ * aggregate mode they are counted instead, and logged as a single record
+ * once the window is over, see sulog_writer_sweep().
+ */
+static bool dedup_should_log(const struct sulog_record *rec)
 {
-	struct file *fp;
-	struct sulog_entry *entry, *tmp;
-	LIST_HEAD(local_queue);
-	loff_t pos = 0;
-	unsigned long flags;
-	const struct cred *old_cred;
+	// everything but the timestamp, strings are zero padded
+	size_t off = offsetof(struct sulog_record, uid);
+	u32 hash = dedup_calc_hash((const char *)rec + off, sizeof(*rec) - off);
+	u32 now = (u32)ktime_get_seconds();
+	struct sulog_dedup_slot *slot =
+	    &dedup_tbl[hash & (SULOG_DEDUP_SLOTS - 1)];
+	struct sulog_record folded;
+	bool fold;
+
+	spin_lock(&slot->lock);
+	if (slot->hash == hash && now - slot->since < DEDUP_SECS) {
+		if (READ_ONCE(sulog_aggregate)) {
+			if (!slot->repeats++)
+				atomic_inc(&sulog_aggregated);
+			slot->last_ns = rec->ts_ns;
+		}
+		spin_unlock(&slot->lock);
+		return false;
+	}
 
-	spin_lock_irqsave(&dedup_lock, flags);
-	list_splice_init(&sulog_queue, &local_queue);
-	spin_unlock_irqrestore(&dedup_lock, flags);
+	// the window is over or another event takes the slot
+	fold = dedup_take_repeats(slot, &folded);
+	slot->hash = hash;
+	slot->since = now;
+	memcpy(&slot->rec, rec, sizeof(*rec));
+	spin_unlock(&slot->lock);
 
-	if (list_empty(&local_queue))
+	if (fold)
+		sulog_ring_push(&folded);
+	return true;
+}
+
+static void sulog_kick_writer(void)
+{
+	int n = atomic_inc_return(&sulog_unflushed);
+
+	// wake on the first record to start the batch timer and on a full one
+	if (n == 1 || n == SULOG_BATCH_RECORDS)
+		wake_up(&sulog_writer_wq);
+}
+
+static void sulog_ring_push(const struct sulog_record *rec)
+{
+	struct sulog_ring **rings;
+	struct sulog_ring *ring;
+	struct sulog_slot *slot;
+	unsigned long head;
+
+	// the preempt disabled section also keeps the rings from being freed
+	preempt_disable();
+	rings = smp_load_acquire(&sulog_rings);
+	// rings are set up at post-fs-data
+	if (!rings) {
+		preempt_enable();
 		return;
+	}
+	ring = rings[smp_processor_id()];
+	do {
+		head = READ_ONCE(ring->head);
+		if (head - smp_load_acquire(&ring->tail) >= SULOG_RING_SIZE) {
+			atomic_long_inc(&ring->dropped);
+			preempt_enable();
+			return;
+		}
+	} while (cmpxchg_local(&ring->head, head, head + 1) != head);
+
+	slot = &ring->slots[head & (SULOG_RING_SIZE - 1)];
+	memcpy(&slot->rec, rec, sizeof(*rec));
+	smp_store_release(&slot->seq, head + 1);
+	preempt_enable();
+
+	sulog_kick_writer();
+}
+
+static struct sulog_slot *sulog_ring_peek(struct sulog_ring *ring)
+{
+	unsigned long tail = ring->tail;
+	struct sulog_slot *slot = &ring->slots[tail & (SULOG_RING_SIZE - 1)];
+
+	// reserved but not yet published records wait for the next flush
+	if (smp_load_acquire(&slot->seq) != tail + 1)
+		return NULL;
+	return slot;
+}
+
+// Pops the oldest published record of all cpus, writer thread only
+static bool sulog_ring_pop(struct sulog_record *rec)
+{
+	struct sulog_ring *oldest = NULL;
+	struct sulog_slot *slot, *oldest_slot = NULL;
+	int cpu;
+
+	for_each_possible_cpu (cpu) {
+		slot = sulog_ring_peek(writer.rings[cpu]);
+		if (!slot)
+			continue;
+		if (!oldest_slot || slot->rec.ts_ns < oldest_slot->rec.ts_ns) {
+			oldest = writer.rings[cpu];
+			oldest_slot = slot;
+		}
+	}
+
+	if (!oldest)
+		return false;
+
+	memcpy(rec, &oldest_slot->rec, sizeof(*rec));
+	smp_store_release(&oldest->tail, oldest->tail + 1);
+	return true;
+}
+
+static long sulog_take_dropped(void)
+{
+	long dropped = 0;
+	int cpu;
 
-	old_cred = override_creds(ksu_cred);
+	for_each_possible_cpu (cpu)
+		dropped += atomic_long_xchg(&writer.rings[cpu]->dropped, 0);
+	return dropped;
+}
+
+static int sulog_format_event(const struct sulog_record *rec, char *buf,
+			      size_t len)
+{
+	char timestamp[32];
+	bool ok = rec->result != 0;
+
+	get_timestamp(rec->ts_ns, timestamp, sizeof(timestamp));
+
+	switch (rec->type) {
+	case SULOG_SU_GRANT:
+		return scnprintf(buf, len,
+				"[%s] SU_GRANT: UID=%u COMM=%s METHOD=%s "
+				"PID=%u\n",
+				timestamp, rec->uid, rec->comm, rec->name,
+				rec->pid);
+	case SULOG_SU_ATTEMPT:
+		return scnprintf(buf, len,
+				"[%s] SU_EXEC: UID=%u COMM=%s TARGET=%s "
+				"RESULT=%s PID=%u\n",
+				timestamp, rec->uid, rec->comm, rec->arg,
+				ok ? "SUCCESS" : "DENIED", rec->pid);
+	case SULOG_PERM_CHECK:
+		return scnprintf(buf, len,
+				"[%s] PERM_CHECK: UID=%u COMM=%s RESULT=%s "
+				"PID=%u\n",
+				timestamp, rec->uid, rec->comm,
+				ok ? "ALLOWED" : "DENIED", rec->pid);
+	case SULOG_MANAGER_OP:
+		return scnprintf(buf, len,
+				"[%s] MANAGER_OP: OP=%s MANAGER_UID=%u "
+				"TARGET_UID=%u COMM=%s PID=%u\n",
+				timestamp, rec->name, rec->uid, rec->target_uid,
+				rec->comm, rec->pid);
+	case SULOG_SYSCALL:
+		return scnprintf(buf, len,
+				"[%s] SYSCALL: UID=%u COMM=%s SYSCALL=%s "
+				"ARGS=%s PID=%u\n",
+				timestamp, rec->uid, rec->comm, rec->name,
+				rec->arg, rec->pid);
+	case SULOG_DROPPED:
+		return scnprintf(buf, len, "[%s] OVERFLOW: DROPPED=%u\n",
+				 timestamp, rec->dropped);
+	default:
+		return 0;
+	}
+}
+
+static int sulog_format(const struct sulog_record *rec, char *buf, size_t len)
+{
+	int n = sulog_format_event(rec, buf, len);
+
+	// aggregated records end in the number of repeats
+	if (n > 0 && rec->count)
+		n += scnprintf(buf + n - 1, len - n + 1, " x%u\n", rec->count) -
+		     1;
+	return n;
+}
+
+static void sulog_dropped_record(struct sulog_record *rec, unsigned long n)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->ts_ns = ktime_get_real_ns();
+	rec->type = SULOG_DROPPED;
+	rec->dropped = min_t(unsigned long, n, U32_MAX);
+}
+
+static void sulog_stream_publish(const struct sulog_record *rec)
+{
+	spin_lock(&stream.lock);
+	memcpy(&stream.recs[stream.head & (SULOG_STREAM_SIZE - 1)], rec,
+	       sizeof(*rec));
+	stream.head++;
+	spin_unlock(&stream.lock);
+}
+
+static struct file *sulog_open(const char *name, int flags)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 12, 0)
+	return file_open_root(&writer.root, name, flags, 0640);
+#else
+	return file_open_root(writer.root.dentry, writer.root.mnt, name, flags,
+			      0640);
+#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
+}
+
+static ssize_t sulog_write(struct file *fp, const void *buf, size_t len,
+			   loff_t *pos)
+{
 #ifdef CONFIG_KSU_LKM
-	fp = filp_open(SULOG_PATH, O_WRONLY | O_CREAT | O_APPEND, 0640);
+	return kernel_write(fp, buf, len, pos);
 #else
-	fp = ksu_filp_open_compat(SULOG_PATH, O_WRONLY | O_CREAT | O_APPEND,
-				  0640);
+	return ksu_kernel_write_compat(fp, buf, len, pos);
 #endif // #ifdef CONFIG_KSU_LKM
-	if (IS_ERR(fp)) {
-		pr_err("sulog: failed to open log file: %ld\n", PTR_ERR(fp));
-		goto revert_creds_out;
+}
+
+static void sulog_writer_sync(void);
+
+/*
+ * Shifts SULOG_PATH.<n> to .<n+1>, dropping the oldest segment, and renames
+ * the live file to .1, so the numbers always go from newest to oldest. The
+ * open file follows the rename and is closed for the next commit to open a
+ * fresh one. The live file is only truncated if it couldn't be renamed.
+ */
+static void sulog_rotate(void)
+{
+	char old[sizeof(SULOG_PATH) + 4], new[sizeof(SULOG_PATH) + 4];
+	int i, err;
+
+	sulog_writer_sync();
+
+	for (i = SULOG_SEGMENTS - 1; i >= 1; i--) {
+		snprintf(old, sizeof(old), SULOG_PATH ".%d", i);
+		snprintf(new, sizeof(new), SULOG_PATH ".%d", i + 1);
+		err = ksu_rename_compat(&writer.root, old, new);
+		if (err && err != -ENOENT)
+			pr_err("sulog: failed to rename %s: %d\n", old, err);
 	}
 
-	if (fp->f_inode->i_size > SULOG_MAX_SIZE) {
-		if (vfs_truncate(&fp->f_path, 0))
+	err = ksu_rename_compat(&writer.root, SULOG_PATH, SULOG_PATH ".1");
+	if (err) {
+		pr_err("sulog: failed to rotate log file: %d\n", err);
+		if (vfs_truncate(&writer.fp->f_path, 0))
 			pr_err("sulog: failed to truncate log file\n");
-		pos = 0;
-	} else {
-		pos = fp->f_inode->i_size;
+		writer.pos = 0;
+		return;
 	}
 
-	list_for_each_entry (entry, &local_queue, list)
-#ifdef CONFIG_KSU_LKM
-		kernel_write(fp, entry->content, strlen(entry->content), &pos);
-#else
-		ksu_kernel_write_compat(fp, entry->content,
-					strlen(entry->content), &pos);
-#endif // #ifdef CONFIG_KSU_LKM
+	filp_close(writer.fp, NULL);
+	writer.fp = NULL;
+}
 
-	vfs_fsync(fp, 0);
-	filp_close(fp, 0);
+static bool sulog_writer_open(void)
+{
+	writer.fp = sulog_open(SULOG_PATH, O_RDWR | O_CREAT | O_APPEND);
+	if (IS_ERR(writer.fp)) {
+		pr_err("sulog: failed to open log file: %ld\n",
+		       PTR_ERR(writer.fp));
+		writer.fp = NULL;
+		return false;
+	}
+	writer.pos = i_size_read(file_inode(writer.fp));
+	return true;
+}
 
-revert_creds_out:
-	revert_creds(old_cred);
+static void sulog_writer_commit(void)
+{
+	ssize_t ret;
+
+	if (!writer.len)
+		return;
+
+	if (!writer.fp && !sulog_writer_open())
+		goto out;
 
-	list_for_each_entry_safe (entry, tmp, &local_queue, list) {
-		list_del(&entry->list);
-		kfree(entry);
+	if (writer.pos + writer.len > SULOG_SEGMENT_SIZE) {
+		sulog_rotate();
+		if (!writer.fp && !sulog_writer_open())
+			goto out;
 	}
+
+	ret = sulog_write(writer.fp, writer.buf, writer.len, &writer.pos);
+	if (ret != (ssize_t)writer.len) {
+		pr_err("sulog: lost %zu bytes, write returned %zd\n",
+		       writer.len, ret);
+		if (ret < 0) {
+			// the next commit reopens it, the file may be gone
+			filp_close(writer.fp, NULL);
+			writer.fp = NULL;
+			goto out;
+		}
+	}
+	writer.dirty = true;
+out:
+	// records are consumed anyway to free the rings
+	writer.len = 0;
 }
 
-static void sulog_task_work_handler(struct callback_head *work)
+static void sulog_writer_append(const char *line, size_t len)
 {
-	sulog_process_queue();
-	kfree(work);
+	if (writer.len + len > SULOG_BATCH_SIZE)
+		sulog_writer_commit();
+	memcpy(writer.buf + writer.len, line, len);
+	writer.len += len;
 }
 
-static void sulog_schedule_task_work(void)
+static bool sulog_fsync_due(void)
 {
-	struct task_struct *tsk;
-	struct callback_head *cb;
-	int ret;
+	unsigned long interval = READ_ONCE(sulog_fsync_interval) * HZ;
 
-	tsk = get_pid_task(find_vpid(1), PIDTYPE_PID);
-	if (!tsk) {
-		pr_err("sulog: failed to find init task\n");
+	return time_after_eq(jiffies, writer.last_sync + interval);
+}
+
+static void sulog_writer_sync(void)
+{
+	if (!writer.fp || !writer.dirty)
+		return;
+	vfs_fsync(writer.fp, 0);
+	writer.dirty = false;
+	writer.last_sync = jiffies;
+}
+
+static void sulog_writer_emit(const struct sulog_record *rec)
+{
+	char line[SULOG_ENTRY_MAX_LEN];
+	int len;
+
+	sulog_stream_publish(rec);
+	len = sulog_format(rec, line, sizeof(line));
+	if (len > 0)
+		sulog_writer_append(line, len);
+}
+
+// Logs the repeats of windows that ended without the event coming back
+static void sulog_writer_sweep(void)
+{
+	struct sulog_dedup_slot *slot;
+	struct sulog_record rec;
+	u32 now = (u32)ktime_get_seconds();
+	bool fold;
+	int i;
+
+	if (!atomic_read(&sulog_aggregated))
 		return;
+
+	for (i = 0; i < SULOG_DEDUP_SLOTS; i++) {
+		slot = &dedup_tbl[i];
+		if (!READ_ONCE(slot->repeats))
+			continue;
+
+		spin_lock(&slot->lock);
+		fold = now - slot->since >= DEDUP_SECS &&
+		       dedup_take_repeats(slot, &rec);
+		spin_unlock(&slot->lock);
+
+		if (fold)
+			sulog_writer_emit(&rec);
 	}
+}
+
+static void sulog_writer_flush(void)
+{
+	struct sulog_record rec;
+	unsigned long head = stream.head;
+	long dropped;
+	u64 start = ksu_hook_stats_start();
+
+	atomic_set(&sulog_unflushed, 0);
 
-	cb = kzalloc(sizeof(*cb), GFP_ATOMIC);
-	if (!cb) {
-		pr_err("sulog: failed to allocate task_work callback\n");
-		goto put_task;
+	dropped = sulog_take_dropped();
+	if (dropped) {
+		sulog_dropped_record(&rec, dropped);
+		sulog_writer_emit(&rec);
 	}
 
-	cb->func = sulog_task_work_handler;
+	sulog_writer_sweep();
+
+	while (sulog_ring_pop(&rec))
+		sulog_writer_emit(&rec);
+
+	// readers get the records before they hit the disk
+	if (stream.head != head)
+		wake_up_interruptible(&sulog_stream_wq);
+
+	sulog_writer_commit();
+
+	if (sulog_fsync_due())
+		sulog_writer_sync();
 
-	ret = task_work_add(tsk, cb, TWA_RESUME);
-	if (ret) {
-		pr_err("sulog: failed to queue task work: %d\n", ret);
-		kfree(cb);
+	ksu_hook_stats_end(KSU_HOOK_STAT_SULOG_FLUSH, start);
+}
+
+// How long the writer may idle before an fsync or aggregate record is due
+static long sulog_writer_timeout(void)
+{
+	long timeout = MAX_SCHEDULE_TIMEOUT;
+
+	if (writer.dirty)
+		timeout = READ_ONCE(sulog_fsync_interval) * HZ;
+	if (atomic_read(&sulog_aggregated))
+		timeout = min_t(long, timeout, DEDUP_SECS * HZ);
+	return timeout;
+}
+
+static int sulog_writer_fn(void *data)
+{
+	const struct cred *old_cred = override_creds(ksu_cred);
+
+	writer.last_sync = jiffies;
+
+	while (!kthread_should_stop()) {
+		// idle until the first record, or until something is due
+		wait_event_interruptible_timeout(
+		    sulog_writer_wq,
+		    kthread_should_stop() || atomic_read(&sulog_unflushed),
+		    sulog_writer_timeout());
+
+		// then give the batch some time to fill up, unless someone is
+		// tailing the stream
+		if (atomic_read(&sulog_unflushed) &&
+		    !atomic_read(&sulog_stream_readers))
+			wait_event_interruptible_timeout(
+			    sulog_writer_wq,
+			    kthread_should_stop() ||
+				atomic_read(&sulog_unflushed) >=
+				    SULOG_BATCH_RECORDS,
+			    SULOG_FLUSH_DELAY);
+
+		sulog_writer_flush();
 	}
 
-put_task:
-	put_task_struct(tsk);
+	sulog_writer_flush();
+	sulog_writer_sync();
+	if (writer.fp)
+		filp_close(writer.fp, NULL);
+	writer.fp = NULL;
+
+	revert_creds(old_cred);
+	return 0;
 }
 
-static void sulog_add_entry(char *log_buf, size_t len, uid_t uid, u8 dedup_type)
+static bool sulog_stream_gone(void)
 {
-	struct sulog_entry *entry;
-	unsigned long flags;
+	return !READ_ONCE(stream.recs);
+}
 
-	if (!sulog_enabled || !log_buf || len == 0)
-		return;
+// true once sulog exited too, so readers wake up and see the end
+static bool sulog_stream_pending(struct sulog_reader *r)
+{
+	return READ_ONCE(stream.head) != READ_ONCE(r->pos) ||
+	       sulog_stream_gone();
+}
 
-	if (!dedup_should_print(uid, dedup_type, log_buf, len))
-		return;
+// Fills buf with the records after the reader's cursor and advances it
+static size_t sulog_stream_take(struct sulog_reader *r,
+				struct sulog_record *buf, size_t max)
+{
+	size_t n = 0;
+
+	spin_lock(&stream.lock);
+	if (!stream.recs)
+		goto out;
+	if (stream.head - r->pos > SULOG_STREAM_SIZE) {
+		sulog_dropped_record(&buf[n++],
+				     stream.head - r->pos - SULOG_STREAM_SIZE);
+		r->pos = stream.head - SULOG_STREAM_SIZE;
+	}
+	while (n < max && r->pos != stream.head) {
+		memcpy(&buf[n++],
+		       &stream.recs[r->pos++ & (SULOG_STREAM_SIZE - 1)],
+		       sizeof(*buf));
+	}
+out:
+	spin_unlock(&stream.lock);
 
-	entry = kzalloc(sizeof(*entry), GFP_ATOMIC);
-	if (!entry)
-		return;
+	return n;
+}
+
+static ssize_t sulog_stream_read(struct file *fp, char __user *ubuf,
+				 size_t count, loff_t *ppos)
+{
+	struct sulog_reader *r = fp->private_data;
+	struct sulog_record *buf;
+	size_t max = min_t(size_t, count / sizeof(*buf), SULOG_STREAM_READ_MAX);
+	ssize_t n;
+	int ret;
+
+	// records are never split across reads
+	if (!max)
+		return -EINVAL;
+
+	while (!sulog_stream_pending(r)) {
+		if (fp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(sulog_stream_wq,
+					       sulog_stream_pending(r));
+		if (ret)
+			return ret;
+	}
 
-	KSU_STRSCPY(entry->content, log_buf, SULOG_ENTRY_MAX_LEN);
+	buf = kmalloc_array(max, sizeof(*buf), GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
 
-	spin_lock_irqsave(&dedup_lock, flags);
-	list_add_tail(&entry->list, &sulog_queue);
-	spin_unlock_irqrestore(&dedup_lock, flags);
+	// 0 once sulog exited, end of file for the reader
+	n = sulog_stream_take(r, buf, max) * sizeof(*buf);
+	if (copy_to_user(ubuf, buf, n))
+		n = -EFAULT;
+	kfree(buf);
 
-	sulog_schedule_task_work();
+	return n;
 }
 
-void ksu_sulog_report_su_grant(uid_t uid, const char *comm, const char *method)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+static __poll_t sulog_stream_poll(struct file *fp,
+				  struct poll_table_struct *pts)
+#else
+static unsigned int sulog_stream_poll(struct file *fp,
+				      struct poll_table_struct *pts)
+#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
 {
-	char log_buf[SULOG_ENTRY_MAX_LEN];
-	char timestamp[32];
-	char full_comm[SULOG_COMM_LEN];
+	struct sulog_reader *r = fp->private_data;
+
+	poll_wait(fp, &sulog_stream_wq, pts);
+	if (sulog_stream_gone())
+		return POLLIN | POLLRDNORM | POLLHUP;
+	return sulog_stream_pending(r) ? POLLIN | POLLRDNORM : 0;
+}
+
+static int sulog_stream_release(struct inode *inode, struct file *fp)
+{
+	atomic_dec(&sulog_stream_readers);
+	kfree(fp->private_data);
+	return 0;
+}
+
+/*
+ * Built-in kernels aren't pinned by .owner and yield tears sulog down too, so
+ * open readers may outlive the stream and get EOF once it is gone.
+ */
+static const struct file_operations sulog_stream_fops = {
+    .owner = THIS_MODULE,
+    .read = sulog_stream_read,
+    .poll = sulog_stream_poll,
+    .release = sulog_stream_release,
+};
+
+int ksu_sulog_install_stream_fd(u32 flags)
+{
+	struct sulog_reader *r;
+	struct file *fp;
+	int fd;
+
+	// the stream exists from post-fs-data on
+	if (!READ_ONCE(stream.recs))
+		return -ENODEV;
 
-	if (!sulog_enabled)
+	r = kzalloc(sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return -ENOMEM;
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0) {
+		kfree(r);
+		return fd;
+	}
+
+	fp = anon_inode_getfile("[ksu_sulog]", &sulog_stream_fops, r,
+				O_RDONLY | O_CLOEXEC);
+	if (IS_ERR(fp)) {
+		pr_err("sulog: failed to create stream file\n");
+		put_unused_fd(fd);
+		kfree(r);
+		return PTR_ERR(fp);
+	}
+
+	spin_lock(&stream.lock);
+	r->pos = stream.head;
+	if (flags & KSU_SULOG_STREAM_BACKLOG)
+		r->pos -= min_t(unsigned long, stream.head, SULOG_STREAM_SIZE);
+	spin_unlock(&stream.lock);
+
+	atomic_inc(&sulog_stream_readers);
+	fd_install(fd, fp);
+
+	return fd;
+}
+
+static void sulog_add_entry(struct sulog_record *rec)
+{
+	rec->ts_ns = ktime_get_real_ns();
+
+	if (!dedup_should_log(rec))
 		return;
 
-	get_timestamp(timestamp, sizeof(timestamp));
-	ksu_get_cmdline(full_comm, comm, sizeof(full_comm));
+	sulog_ring_push(rec);
+}
 
-	sanitize_string(full_comm, sizeof(full_comm));
+static void sulog_init_record(struct sulog_record *rec, u8 type, uid_t uid,
+			      const char *comm)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->type = type;
+	rec->uid = uid;
+	rec->pid = current->pid;
 
-	snprintf(log_buf, sizeof(log_buf),
-		 "[%s] SU_GRANT: UID=%d COMM=%s METHOD=%s PID=%d\n", timestamp,
-		 uid, full_comm, method ? method : "unknown", current->pid);
+	ksu_get_cmdline(rec->comm, comm, sizeof(rec->comm));
+	sanitize_string(rec->comm, sizeof(rec->comm));
+}
 
-	sulog_add_entry(log_buf, strlen(log_buf), uid, DEDUP_SU_GRANT);
+void ksu_sulog_report_su_grant(uid_t uid, const char *comm, const char *method)
+{
+	struct sulog_record rec;
+
+	if (!ksu_sulog_wants(SULOG_SU_GRANT, uid))
+		return;
+
+	sulog_init_record(&rec, SULOG_SU_GRANT, uid, comm);
+	KSU_STRSCPY(rec.name, method ? method : "unknown", sizeof(rec.name));
+
+	sulog_add_entry(&rec);
 }
 
 void ksu_sulog_report_su_attempt(uid_t uid, const char *comm,
 				 const char *target_path, bool success)
 {
-	char log_buf[SULOG_ENTRY_MAX_LEN];
-	char timestamp[32];
-	char full_comm[SULOG_COMM_LEN];
+	struct sulog_record rec;
 
-	if (!sulog_enabled)
+	if (!ksu_sulog_wants(SULOG_SU_ATTEMPT, uid))
 		return;
 
-	get_timestamp(timestamp, sizeof(timestamp));
-	ksu_get_cmdline(full_comm, comm, sizeof(full_comm));
-
-	sanitize_string(full_comm, sizeof(full_comm));
-
-	snprintf(log_buf, sizeof(log_buf),
-		 "[%s] SU_EXEC: UID=%d COMM=%s TARGET=%s RESULT=%s PID=%d\n",
-		 timestamp, uid, full_comm,
-		 target_path ? target_path : "unknown",
-		 success ? "SUCCESS" : "DENIED", current->pid);
+	sulog_init_record(&rec, SULOG_SU_ATTEMPT, uid, comm);
+	KSU_STRSCPY(rec.arg, target_path ? target_path : "unknown",
+		    sizeof(rec.arg));
+	rec.result = success;
 
-	sulog_add_entry(log_buf, strlen(log_buf), uid, DEDUP_SU_ATTEMPT);
+	sulog_add_entry(&rec);
 }
 
 void ksu_sulog_report_permission_check(uid_t uid, const char *comm,
 				       bool allowed)
 {
-	char log_buf[SULOG_ENTRY_MAX_LEN];
-	char timestamp[32];
-	char full_comm[SULOG_COMM_LEN];
+	struct sulog_record rec;
 
-	if (!sulog_enabled)
+	if (!ksu_sulog_wants(SULOG_PERM_CHECK, uid))
 		return;
 
-	get_timestamp(timestamp, sizeof(timestamp));
-	ksu_get_cmdline(full_comm, comm, sizeof(full_comm));
-
-	sanitize_string(full_comm, sizeof(full_comm));
+	sulog_init_record(&rec, SULOG_PERM_CHECK, uid, comm);
+	rec.result = allowed;
 
-	snprintf(log_buf, sizeof(log_buf),
-		 "[%s] PERM_CHECK: UID=%d COMM=%s RESULT=%s PID=%d\n",
-		 timestamp, uid, full_comm, allowed ? "ALLOWED" : "DENIED",
-		 current->pid);
-
-	sulog_add_entry(log_buf, strlen(log_buf), uid, DEDUP_PERM_CHECK);
+	sulog_add_entry(&rec);
 }
 
 void ksu_sulog_report_manager_operation(const char *operation,
 					uid_t manager_uid, uid_t target_uid)
 {
-	char log_buf[SULOG_ENTRY_MAX_LEN];
-	char timestamp[32];
-	char full_comm[SULOG_COMM_LEN];
+	struct sulog_record rec;
 
-	if (!sulog_enabled)
+	if (!ksu_sulog_wants(SULOG_MANAGER_OP, manager_uid))
 		return;
 
-	get_timestamp(timestamp, sizeof(timestamp));
-	ksu_get_cmdline(full_comm, NULL, sizeof(full_comm));
+	sulog_init_record(&rec, SULOG_MANAGER_OP, manager_uid, NULL);
+	KSU_STRSCPY(rec.name, operation ? operation : "unknown",
+		    sizeof(rec.name));
+	rec.target_uid = target_uid;
 
-	sanitize_string(full_comm, sizeof(full_comm));
-
-	snprintf(log_buf, sizeof(log_buf),
-		 "[%s] MANAGER_OP: OP=%s MANAGER_UID=%d TARGET_UID=%d COMM=%s "
-		 "PID=%d\n",
-		 timestamp, operation ? operation : "unknown", manager_uid,
-		 target_uid, full_comm, current->pid);
-
-	sulog_add_entry(log_buf, strlen(log_buf), manager_uid,
-			DEDUP_MANAGER_OP);
+	sulog_add_entry(&rec);
 }
 
 void ksu_sulog_report_syscall(uid_t uid, const char *comm, const char *syscall,
 			      const char *args)
 {
-	char log_buf[SULOG_ENTRY_MAX_LEN];
-	char timestamp[32];
-	char full_comm[SULOG_COMM_LEN];
+	struct sulog_record rec;
 
-	if (!sulog_enabled)
+	if (!ksu_sulog_wants(SULOG_SYSCALL, uid))
 		return;
 
-	get_timestamp(timestamp, sizeof(timestamp));
-	ksu_get_cmdline(full_comm, comm, sizeof(full_comm));
+	sulog_init_record(&rec, SULOG_SYSCALL, uid, comm);
+	KSU_STRSCPY(rec.name, syscall ? syscall : "unknown", sizeof(rec.name));
+	KSU_STRSCPY(rec.arg, args ? args : "none", sizeof(rec.arg));
 
-	sanitize_string(full_comm, sizeof(full_comm));
+	sulog_add_entry(&rec);
+}
 
-	snprintf(log_buf, sizeof(log_buf),
-		 "[%s] SYSCALL: UID=%d COMM=%s SYSCALL=%s ARGS=%s PID=%d\n",
-		 timestamp, uid, full_comm, syscall ? syscall : "unknown",
-		 args ? args : "none", current->pid);
+static void sulog_free_rings(struct sulog_ring **rings)
+{
+	int cpu;
 
-	sulog_add_entry(log_buf, strlen(log_buf), uid, DEDUP_SYSCALL);
+	for_each_possible_cpu (cpu)
+		vfree(rings[cpu]);
+	kfree(rings);
 }
 
 int ksu_sulog_init(void)
 {
+	struct sulog_ring **rings;
+	int cpu, i;
+
+	rings = kcalloc(nr_cpu_ids, sizeof(*rings), GFP_KERNEL);
+	if (!rings)
+		return -ENOMEM;
+
+	for_each_possible_cpu (cpu) {
+		rings[cpu] = vzalloc(sizeof(struct sulog_ring));
+		if (!rings[cpu]) {
+			pr_err("sulog: failed to allocate ring for cpu %d\n",
+			       cpu);
+			sulog_free_rings(rings);
+			return -ENOMEM;
+		}
+	}
+
+	writer.buf = vmalloc(SULOG_BATCH_SIZE);
+	if (!writer.buf) {
+		sulog_free_rings(rings);
+		return -ENOMEM;
+	}
+
+	stream.recs = vzalloc(sizeof(*stream.recs) * SULOG_STREAM_SIZE);
+	if (!stream.recs) {
+		vfree(writer.buf);
+		writer.buf = NULL;
+		sulog_free_rings(rings);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < SULOG_DEDUP_SLOTS; i++)
+		spin_lock_init(&dedup_tbl[i].lock);
+
+	// called from ksud at post-fs-data, which sees /data like init does
+	get_fs_root(current->fs, &writer.root);
+
+	writer.rings = rings;
+	smp_store_release(&sulog_rings, rings);
+
+	writer.task = kthread_run(sulog_writer_fn, NULL, "ksu_sulog");
+	if (IS_ERR(writer.task)) {
+		pr_err("sulog: failed to start writer: %ld\n",
+		       PTR_ERR(writer.task));
+		writer.task = NULL;
+	}
+
 	if (ksu_register_feature_handler(&sulog_handler)) {
 		pr_err("Failed to register sulog feature handler\n");
 	}
+	if (ksu_register_feature_handler(&sulog_fsync_interval_handler)) {
+		pr_err("Failed to register sulog_fsync_interval handler\n");
+	}
 
 	pr_info("sulog: initialized successfully\n");
 	return 0;
@@ -398,21 +1131,49 @@ int ksu_sulog_init(void)
 
 void ksu_sulog_exit(void)
 {
-	struct sulog_entry *entry, *tmp;
-	unsigned long flags;
+	struct sulog_ring **rings = writer.rings;
+	struct sulog_record *recs;
+	struct sulog_filter *filter;
 
 	ksu_unregister_feature_handler(KSU_FEATURE_SULOG);
+	ksu_unregister_feature_handler(KSU_FEATURE_SULOG_FSYNC_INTERVAL);
 
 	sulog_enabled = false;
 
-	sulog_process_queue();
+	if (!rings)
+		goto out;
 
-	spin_lock_irqsave(&dedup_lock, flags);
-	list_for_each_entry_safe (entry, tmp, &sulog_queue, list) {
-		list_del(&entry->list);
-		kfree(entry);
-	}
-	spin_unlock_irqrestore(&dedup_lock, flags);
+	// let producers that still saw the rings finish their push
+	WRITE_ONCE(sulog_rings, NULL);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 20, 0)
+	synchronize_sched();
+#else
+	synchronize_rcu();
+#endif // #if LINUX_VERSION_CODE < KERNEL_VERSION...
+
+	// the writer drains the rings one last time before it exits
+	if (writer.task)
+		kthread_stop(writer.task);
+	writer.task = NULL;
+
+	writer.rings = NULL;
+	sulog_free_rings(rings);
+	vfree(writer.buf);
+	writer.buf = NULL;
+	spin_lock(&stream.lock);
+	recs = stream.recs;
+	stream.recs = NULL;
+	spin_unlock(&stream.lock);
+	vfree(recs);
+	// blocked readers return end of file now
+	wake_up_interruptible_all(&sulog_stream_wq);
+	path_put(&writer.root);
+
+out:
+	filter = rcu_dereference_protected(sulog_filter, true);
+	RCU_INIT_POINTER(sulog_filter, NULL);
+	if (filter)
+		kfree_rcu(filter, rcu);
 
 	pr_info("sulog: cleaned up successfully\n");
 }
@@ -12,9 +12,22 @@
 extern struct timezone sys_tz;
 
 #define SULOG_PATH "/data/adb/ksu/log/sulog.log"
-#define SULOG_MAX_SIZE (32 * 1024 * 1024) // 128MB
+// the live file rotates into SULOG_PATH.1 ... SULOG_PATH.<SULOG_SEGMENTS>,
+// numbered from newest to oldest
+#define SULOG_SEGMENT_SIZE (8 * 1024 * 1024)
+#define SULOG_SEGMENTS 4
+#define SULOG_BATCH_SIZE (16 * 1024)
+#define SULOG_BATCH_RECORDS 64
+// how long the writer lets a batch fill up
+#define SULOG_FLUSH_DELAY (HZ / 2)
+// seconds between fsyncs of the live file, 0 syncs every batch
+#define SULOG_FSYNC_INTERVAL 5
+#define SULOG_FSYNC_INTERVAL_MAX 3600
+// records kept for stream readers, a power of two
+#define SULOG_STREAM_SIZE 1024
+// records copied out per read() on a stream fd
+#define SULOG_STREAM_READ_MAX 32
 #define SULOG_ENTRY_MAX_LEN 512
-#define SULOG_COMM_LEN 256
 #define DEDUP_SECS 10
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
@@ -51,24 +64,35 @@ static inline void time64_to_tm(time64_t totalsecs, int offset,
 }
 #endif // #if LINUX_VERSION_CODE < KERNEL_VERSION...
 
-struct dedup_key {
-	u32 crc;
-	uid_t uid;
-	u8 type;
-	u8 _pad[1];
+// per-cpu ring size in records, a power of two
+#define SULOG_RING_SIZE 256
+#define SULOG_DEDUP_SLOTS 256
+
+enum sulog_event_type {
+	SULOG_SU_GRANT = 0,
+	SULOG_SU_ATTEMPT,
+	SULOG_PERM_CHECK,
+	SULOG_MANAGER_OP,
+	SULOG_SYSCALL,
+	// records lost before reaching the file or this reader
+	SULOG_DROPPED,
 };
 
-struct dedup_entry {
-	struct dedup_key key;
-	u64 ts_ns;
-};
-
-enum {
-	DEDUP_SU_GRANT = 0,
-	DEDUP_SU_ATTEMPT,
-	DEDUP_PERM_CHECK,
-	DEDUP_MANAGER_OP,
-	DEDUP_SYSCALL,
+// Fixed size binary event, formatted into a log line by the consumer
+struct sulog_record {
+	__u64 ts_ns; // CLOCK_REALTIME
+	__u32 uid; // manager uid for SULOG_MANAGER_OP
+	__u32 pid;
+	union {
+		__u32 target_uid; // SULOG_MANAGER_OP
+		__u32 dropped; // SULOG_DROPPED
+	};
+	__u8 type; // enum sulog_event_type
+	__u8 result; // SU_ATTEMPT, PERM_CHECK: 1 allowed, 0 denied
+	__u16 count; // repeats folded into this record in aggregate mode
+	char comm[48]; // caller command line, truncated
+	char name[24]; // su method, manager operation or syscall name
+	char arg[32]; // su target path or syscall arguments
 };
 
 static inline u32 dedup_calc_hash(const char *content, size_t len)
@@ -76,10 +100,11 @@ static inline u32 dedup_calc_hash(const char *content, size_t len)
 	return crc32(0, content, len);
 }
 
-struct sulog_entry {
-	struct list_head list;
-	char content[SULOG_ENTRY_MAX_LEN];
-};
+// Whether an event would pass the configured filter, callers that build
+// arguments for a report check this first so filtered events cost nothing
+bool ksu_sulog_wants(u8 type, uid_t uid);
+// Same for the audit record of a supercall
+bool ksu_sulog_wants_ioctl(unsigned int cmd, uid_t uid);
 
 void ksu_sulog_report_su_grant(uid_t uid, const char *comm, const char *method);
 void ksu_sulog_report_su_attempt(uid_t uid, const char *comm,
@@ -91,6 +116,14 @@ void ksu_sulog_report_manager_operation(const char *operation,
 void ksu_sulog_report_syscall(uid_t uid, const char *comm, const char *syscall,
 			      const char *args);
 
+// Installs a read()/poll() fd streaming sulog records, see
+// KSU_IOCTL_GET_SULOG_FD
+int ksu_sulog_install_stream_fd(u32 flags);
+
+struct ksu_sulog_filter_cmd;
+void ksu_sulog_get_filter(struct ksu_sulog_filter_cmd *cmd);
+int ksu_sulog_set_filter(const struct ksu_sulog_filter_cmd *cmd);
+
 int ksu_sulog_init(void);
 void ksu_sulog_exit(void);
 #endif // #if __SULOG_GATE
@@ -6,6 +6,7 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/hashtable.h>
 #include <linux/kprobes.h>
 #include <linux/seccomp.h>
 #include <linux/slab.h>
@@ -13,6 +14,7 @@
 #include <linux/task_work.h>
 #include <linux/uaccess.h>
 #include <linux/version.h>
+#include <linux/vmalloc.h>
 
 #ifdef CONFIG_KSU_HYMOFS
 #include <linux/namei.h>
@@ -23,8 +25,10 @@
 
 #include "allowlist.h"
 #include "arch.h"
+#include "events.h"
 #include "feature.h"
 #include "file_wrapper.h"
+#include "hook_stats.h"
 
 #ifndef CONFIG_KSU_LKM
 #include "kernel_compat.h"
@@ -40,6 +44,8 @@
 #include "manager.h"
 #include "seccomp_cache.h"
 #include "selinux/selinux.h"
+#include "status_page.h"
+#include "sucompat.h"
 #include "sulog.h"
 #include "supercalls.h"
 
@@ -336,6 +342,174 @@ static int do_set_app_profile(void __user *arg)
 	return 0;
 }
 
+static int do_get_app_profiles(void __user *arg)
+{
+	struct ksu_get_app_profiles_cmd cmd;
+	size_t size = 0;
+	void *buf;
+	int ret = 0;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd))) {
+		pr_err("get_app_profiles: copy_from_user failed\n");
+		return -EFAULT;
+	}
+
+	if (cmd.uid_min > cmd.uid_max)
+		return -EINVAL;
+
+	buf = ksu_get_app_profiles_encoded(cmd.uid_min, cmd.uid_max, &size,
+					   &cmd.count);
+	if (!buf)
+		return -ENOMEM;
+
+	cmd.size = size;
+	if (size > cmd.buf_size) {
+		// tell the caller how much it needs
+		cmd.count = 0;
+		ret = -ENOSPC;
+	} else if (copy_to_user((void __user *)cmd.arg, buf, size)) {
+		pr_err("get_app_profiles: copy_to_user failed\n");
+		vfree(buf);
+		return -EFAULT;
+	}
+	vfree(buf);
+
+	if (copy_to_user(arg, &cmd, sizeof(cmd))) {
+		pr_err("get_app_profiles: copy_to_user failed\n");
+		return -EFAULT;
+	}
+
+	return ret;
+}
+
+static int do_set_app_profiles(void __user *arg)
+{
+	struct ksu_set_app_profiles_cmd cmd;
+	void *buf;
+	int ret;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd))) {
+		pr_err("set_app_profiles: copy_from_user failed\n");
+		return -EFAULT;
+	}
+
+	if (!cmd.buf_size || cmd.buf_size > KSU_APP_PROFILES_MAX_SIZE)
+		return -EINVAL;
+
+	buf = vmalloc(cmd.buf_size);
+	if (!buf)
+		return -ENOMEM;
+
+	if (copy_from_user(buf, (void __user *)cmd.arg, cmd.buf_size)) {
+		pr_err("set_app_profiles: copy_from_user failed\n");
+		vfree(buf);
+		return -EFAULT;
+	}
+
+	ret = ksu_set_app_profiles_encoded(buf, cmd.buf_size);
+	vfree(buf);
+	if (ret < 0)
+		return ret;
+
+	cmd.count = ret;
+	if (copy_to_user(arg, &cmd, sizeof(cmd))) {
+		pr_err("set_app_profiles: copy_to_user failed\n");
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static int do_get_stats(void __user *arg)
+{
+	struct ksu_get_stats_cmd cmd;
+	u64 checked, skipped;
+	int ret;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd))) {
+		pr_err("get_stats: copy_from_user failed\n");
+		return -EFAULT;
+	}
+
+	ret = ksu_hook_stats_copy((void __user *)cmd.arg, cmd.max_entries,
+				  &cmd.count,
+				  cmd.flags & KSU_GET_STATS_FLAG_RESET);
+	if (ret)
+		return ret;
+
+	ksu_sucompat_prefilter_stats(&checked, &skipped);
+	cmd.enabled = static_key_enabled(&ksu_hook_stats_key);
+	cmd.prefilter_checked = checked;
+	cmd.prefilter_skipped = skipped;
+	ksu_umount_plan_stats(&cmd.umount_plans, &cmd.umount_plan_size,
+			      &cmd.umount_plan_build_ns, &cmd.umount_plan_hits,
+			      &cmd.umount_plan_skipped);
+
+	if (copy_to_user(arg, &cmd, sizeof(cmd))) {
+		pr_err("get_stats: copy_to_user failed\n");
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static int do_get_event_fd(void __user *arg)
+{
+	struct ksu_get_event_fd_cmd cmd;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd))) {
+		pr_err("get_event_fd: copy_from_user failed\n");
+		return -EFAULT;
+	}
+
+	return ksu_event_install_fd(cmd.mask);
+}
+
+#if __SULOG_GATE
+static int do_get_sulog_fd(void __user *arg)
+{
+	struct ksu_get_sulog_fd_cmd cmd;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd))) {
+		pr_err("get_sulog_fd: copy_from_user failed\n");
+		return -EFAULT;
+	}
+
+	return ksu_sulog_install_stream_fd(cmd.flags);
+}
+
+static int do_sulog_filter(void __user *arg)
+{
+	struct ksu_sulog_filter_cmd cmd;
+	int ret;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd))) {
+		pr_err("sulog_filter: copy_from_user failed\n");
+		return -EFAULT;
+	}
+
+	switch (cmd.op) {
+	case KSU_SULOG_FILTER_GET:
+		ksu_sulog_get_filter(&cmd);
+		break;
+	case KSU_SULOG_FILTER_SET:
+		ret = ksu_sulog_set_filter(&cmd);
+		if (ret)
+			return ret;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (copy_to_user(arg, &cmd, sizeof(cmd))) {
+		pr_err("sulog_filter: copy_to_user failed\n");
+		return -EFAULT;
+	}
+
+	return 0;
+}
+#endif // #if __SULOG_GATE
+
 static int do_get_feature(void __user *arg)
 {
 	struct ksu_get_feature_cmd cmd;
@@ -575,6 +749,217 @@ static int do_nuke_ext4_sysfs(void __user *arg)
 
 struct list_head mount_list = LIST_HEAD_INIT(mount_list);
 DECLARE_RWSEM(mount_list_lock);
+// mount_list indexed by path, under mount_list_lock
+static DEFINE_HASHTABLE(mount_hash, 8);
+
+static unsigned int umount_path_hash(const char *path)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 8, 0)
+	return full_name_hash(path, strlen(path));
+#else
+	return full_name_hash(NULL, path, strlen(path));
+#endif // #if LINUX_VERSION_CODE < KERNEL_VERSION...
+}
+
+static struct mount_entry *mount_list_find(const char *path)
+{
+	unsigned int hash = umount_path_hash(path);
+	struct mount_entry *entry;
+
+	hash_for_each_possible (mount_hash, entry, node, hash) {
+		if (entry->hash == hash && !strcmp(entry->umountable, path))
+			return entry;
+	}
+	return NULL;
+}
+
+static struct mount_entry *mount_entry_alloc(const char *path, u32 flags)
+{
+	struct mount_entry *entry;
+
+	entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry)
+		return NULL;
+
+	entry->umountable = kstrdup(path, GFP_KERNEL);
+	if (!entry->umountable) {
+		kfree(entry);
+		return NULL;
+	}
+	entry->flags = flags;
+	entry->hash = umount_path_hash(path);
+	INIT_LIST_HEAD(&entry->list);
+	return entry;
+}
+
+static void mount_entry_free(struct mount_entry *entry)
+{
+	kfree(entry->umountable);
+	kfree(entry);
+}
+
+// Returns false if the path is already listed, entry is left untouched then
+static bool mount_list_insert(struct mount_entry *entry)
+{
+	if (mount_list_find(entry->umountable))
+		return false;
+
+	list_add(&entry->list, &mount_list);
+	hash_add(mount_hash, &entry->node, entry->hash);
+	return true;
+}
+
+static void mount_list_remove(struct mount_entry *entry)
+{
+	list_del(&entry->list);
+	hash_del(&entry->node);
+	mount_entry_free(entry);
+}
+
+/*
+ * Unpacks a KSU_UMOUNT_*_BULK buffer into a list of fresh entries in buffer
+ * order. Returns the number of records or a negative errno.
+ */
+static int umount_bulk_parse(const char *buf, size_t size,
+			     struct list_head *out)
+{
+	struct mount_entry *entry;
+	size_t pos = 0, len;
+	u32 flags;
+	int n = 0;
+
+	while (pos < size) {
+		if (size - pos < sizeof(flags) + 1)
+			return -EINVAL;
+		memcpy(&flags, buf + pos, sizeof(flags));
+		pos += sizeof(flags);
+
+		len = strnlen(buf + pos, size - pos);
+		if (len == size - pos || !len)
+			return -EINVAL;
+		if (len >= KSU_UMOUNT_PATH_MAX)
+			return -ENAMETOOLONG;
+
+		entry = mount_entry_alloc(buf + pos, flags);
+		if (!entry)
+			return -ENOMEM;
+		list_add_tail(&entry->list, out);
+		pos += len + 1;
+		n++;
+	}
+
+	return n;
+}
+
+static void umount_bulk_free(struct list_head *entries)
+{
+	struct mount_entry *entry, *tmp;
+
+	list_for_each_entry_safe (entry, tmp, entries, list)
+		mount_entry_free(entry);
+}
+
+// Records in list order, returns the bytes the whole list needs
+static size_t umount_bulk_pack(char *buf, size_t size)
+{
+	struct mount_entry *entry;
+	size_t pos = 0, len;
+
+	list_for_each_entry (entry, &mount_list, list) {
+		len = strlen(entry->umountable) + 1;
+		if (pos + sizeof(entry->flags) + len <= size) {
+			memcpy(buf + pos, &entry->flags, sizeof(entry->flags));
+			memcpy(buf + pos + sizeof(entry->flags),
+			       entry->umountable, len);
+		}
+		pos += sizeof(entry->flags) + len;
+	}
+
+	return pos;
+}
+
+static int umount_bulk(u8 mode, void __user *arg)
+{
+	struct mount_entry *entry, *tmp;
+	struct ksu_umount_bulk_cmd cmd;
+	LIST_HEAD(entries);
+	char *buf = NULL;
+	u32 done = 0;
+	int ret;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd)))
+		return -EFAULT;
+
+	// an empty REPLACE wipes the list, an empty GET_BULK probes its size
+	if (cmd.size > KSU_UMOUNT_BULK_MAX ||
+	    (!cmd.size && mode != KSU_UMOUNT_REPLACE &&
+	     mode != KSU_UMOUNT_GET_BULK))
+		return -EINVAL;
+
+	if (cmd.size) {
+		buf = kvmalloc(cmd.size, GFP_KERNEL);
+		if (!buf)
+			return -ENOMEM;
+	}
+
+	if (mode == KSU_UMOUNT_GET_BULK) {
+		down_read(&mount_list_lock);
+		cmd.done = umount_bulk_pack(buf, cmd.size);
+		up_read(&mount_list_lock);
+
+		ret = cmd.done > cmd.size ? -ENOSPC : 0;
+		if (!ret && copy_to_user((void __user *)cmd.buf, buf, cmd.done))
+			ret = -EFAULT;
+		goto out;
+	}
+
+	if (copy_from_user(buf, (void __user *)cmd.buf, cmd.size)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	// everything is allocated up front, the list changes all or nothing
+	ret = umount_bulk_parse(buf, cmd.size, &entries);
+	if (ret < 0)
+		goto out;
+
+	down_write(&mount_list_lock);
+	if (mode == KSU_UMOUNT_REPLACE) {
+		list_for_each_entry_safe (entry, tmp, &mount_list, list)
+			mount_list_remove(entry);
+	}
+	list_for_each_entry_safe (entry, tmp, &entries, list) {
+		if (mode == KSU_UMOUNT_DEL_BULK) {
+			struct mount_entry *old =
+			    mount_list_find(entry->umountable);
+
+			if (old) {
+				mount_list_remove(old);
+				done++;
+			}
+			continue;
+		}
+
+		list_del(&entry->list);
+		if (mount_list_insert(entry))
+			done++;
+		else
+			mount_entry_free(entry);
+	}
+	ksu_umount_list_changed();
+	up_write(&mount_list_lock);
+
+	pr_info("umount_bulk: mode %u, %u of %d entries\n", mode, done, ret);
+	cmd.done = done;
+	ret = 0;
+
+out:
+	umount_bulk_free(&entries);
+	kvfree(buf);
+	if ((!ret || ret == -ENOSPC) && copy_to_user(arg, &cmd, sizeof(cmd)))
+		ret = -EFAULT;
+	return ret;
+}
 
 #ifndef CONFIG_KSU_LKM
 // List current try_umount entries
@@ -632,78 +1017,52 @@ static int add_try_umount(void __user *arg)
 {
 	struct mount_entry *new_entry, *entry, *tmp;
 	struct ksu_add_try_umount_cmd cmd;
-	char buf[256] = {0};
+	char buf[KSU_UMOUNT_PATH_MAX] = {0};
 
 	if (copy_from_user(&cmd, arg, sizeof cmd))
 		return -EFAULT;
 
 	switch (cmd.mode) {
 	case KSU_UMOUNT_WIPE: {
-		struct mount_entry *entry, *tmp;
 		down_write(&mount_list_lock);
 		list_for_each_entry_safe (entry, tmp, &mount_list, list) {
 			pr_info("wipe_umount_list: removing entry: %s\n",
 				entry->umountable);
-			list_del(&entry->list);
-			kfree(entry->umountable);
-			kfree(entry);
+			mount_list_remove(entry);
 		}
+		ksu_umount_list_changed();
 		up_write(&mount_list_lock);
 
 		return 0;
 	}
 
 	case KSU_UMOUNT_ADD: {
-		long len =
-		    strncpy_from_user(buf, (const char __user *)cmd.arg, 256);
+		long len = strncpy_from_user(buf, (const char __user *)cmd.arg,
+					     sizeof(buf));
 		if (len <= 0)
 			return -EFAULT;
 
 		buf[sizeof(buf) - 1] = '\0';
 
-		new_entry = kzalloc(sizeof(*new_entry), GFP_KERNEL);
+		new_entry = mount_entry_alloc(buf, cmd.flags);
 		if (!new_entry)
 			return -ENOMEM;
 
-		new_entry->umountable = kstrdup(buf, GFP_KERNEL);
-		if (!new_entry->umountable) {
-			kfree(new_entry);
-			return -1;
-		}
-
 		down_write(&mount_list_lock);
-
-		// disallow dupes
-		// if this gets too many, we can consider moving this whole task
-		// to a kthread
-		list_for_each_entry (entry, &mount_list, list) {
-			if (!strcmp(entry->umountable, buf)) {
-				pr_info(
-				    "cmd_add_try_umount: %s is already here!\n",
-				    buf);
-				up_write(&mount_list_lock);
-				kfree(new_entry->umountable);
-				kfree(new_entry);
-				return -1;
-			}
+		if (!mount_list_insert(new_entry)) {
+			up_write(&mount_list_lock);
+			pr_info("cmd_add_try_umount: %s is already here!\n",
+				buf);
+			mount_entry_free(new_entry);
+			return -1;
 		}
-
-		// now check flags and add
-		// this also serves as a null check
-		if (cmd.flags)
-			new_entry->flags = cmd.flags;
-		else
-			new_entry->flags = 0;
-
-		// debug
-		list_add(&new_entry->list, &mount_list);
+		ksu_umount_list_changed();
 		up_write(&mount_list_lock);
 		pr_info("cmd_add_try_umount: %s added!\n", buf);
 
 		return 0;
 	}
 
-	// this is just strcmp'd wipe anyway
 	case KSU_UMOUNT_DEL: {
 		long len = strncpy_from_user(buf, (const char __user *)cmd.arg,
 					     sizeof(buf) - 1);
@@ -713,21 +1072,24 @@ static int add_try_umount(void __user *arg)
 		buf[sizeof(buf) - 1] = '\0';
 
 		down_write(&mount_list_lock);
-		list_for_each_entry_safe (entry, tmp, &mount_list, list) {
-			if (!strcmp(entry->umountable, buf)) {
-				pr_info(
-				    "cmd_add_try_umount: entry removed: %s\n",
-				    entry->umountable);
-				list_del(&entry->list);
-				kfree(entry->umountable);
-				kfree(entry);
-			}
+		entry = mount_list_find(buf);
+		if (entry) {
+			pr_info("cmd_add_try_umount: entry removed: %s\n",
+				entry->umountable);
+			mount_list_remove(entry);
+			ksu_umount_list_changed();
 		}
 		up_write(&mount_list_lock);
 
 		return 0;
 	}
 
+	case KSU_UMOUNT_ADD_BULK:
+	case KSU_UMOUNT_DEL_BULK:
+	case KSU_UMOUNT_REPLACE:
+	case KSU_UMOUNT_GET_BULK:
+		return umount_bulk(cmd.mode, (void __user *)cmd.arg);
+
 	default: {
 		pr_err("cmd_add_try_umount: invalid operation %u\n", cmd.mode);
 		return -EINVAL;
@@ -811,17 +1173,22 @@ static int do_get_full_version(void __user *arg)
 	return 0;
 }
 
-// 101. HOOK_TYPE - Get hook type
-static int do_get_hook_type(void __user *arg)
+const char *ksu_hook_type(void)
 {
-	struct ksu_hook_type_cmd cmd = {0};
-	const char *type = "Tracepoint";
-
 #if defined(KSU_MANUAL_HOOK)
-	type = "Manual";
+	return "Manual";
 #elif defined(CONFIG_KSU_HYMOFS)
-	type = "Inline (HymoFS)";
+	return "Inline (HymoFS)";
+#else
+	return "Tracepoint";
 #endif // #if defined(KSU_MANUAL_HOOK)
+}
+
+// 101. HOOK_TYPE - Get hook type
+static int do_get_hook_type(void __user *arg)
+{
+	struct ksu_hook_type_cmd cmd = {0};
+	const char *type = ksu_hook_type();
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
 	strscpy(cmd.hook_type, type, sizeof(cmd.hook_type));
@@ -932,7 +1299,8 @@ static const struct ksu_ioctl_cmd_map ksu_ioctl_handlers[] = {
     {.cmd = KSU_IOCTL_GRANT_ROOT,
      .name = "GRANT_ROOT",
      .handler = do_grant_root,
-     .perm_check = allowed_for_su},
+     .perm_check = allowed_for_su,
+     .flags = KSU_IOCTL_F_AUDIT | KSU_IOCTL_F_NO_PERM_CACHE},
     {.cmd = KSU_IOCTL_GET_INFO,
      .name = "GET_INFO",
      .handler = do_get_info,
@@ -940,11 +1308,13 @@ static const struct ksu_ioctl_cmd_map ksu_ioctl_handlers[] = {
     {.cmd = KSU_IOCTL_REPORT_EVENT,
      .name = "REPORT_EVENT",
      .handler = do_report_event,
-     .perm_check = only_root},
+     .perm_check = only_root,
+     .flags = KSU_IOCTL_F_AUDIT},
     {.cmd = KSU_IOCTL_SET_SEPOLICY,
      .name = "SET_SEPOLICY",
      .handler = do_set_sepolicy,
-     .perm_check = only_root},
+     .perm_check = only_root,
+     .flags = KSU_IOCTL_F_AUDIT},
     {.cmd = KSU_IOCTL_CHECK_SAFEMODE,
      .name = "CHECK_SAFEMODE",
      .handler = do_check_safemode,
@@ -976,7 +1346,36 @@ static const struct ksu_ioctl_cmd_map ksu_ioctl_handlers[] = {
     {.cmd = KSU_IOCTL_SET_APP_PROFILE,
      .name = "SET_APP_PROFILE",
      .handler = do_set_app_profile,
+     .perm_check = only_manager,
+     .flags = KSU_IOCTL_F_AUDIT},
+    {.cmd = KSU_IOCTL_GET_APP_PROFILES,
+     .name = "GET_APP_PROFILES",
+     .handler = do_get_app_profiles,
      .perm_check = only_manager},
+    {.cmd = KSU_IOCTL_SET_APP_PROFILES,
+     .name = "SET_APP_PROFILES",
+     .handler = do_set_app_profiles,
+     .perm_check = only_manager,
+     .flags = KSU_IOCTL_F_AUDIT},
+    {.cmd = KSU_IOCTL_GET_STATS,
+     .name = "GET_STATS",
+     .handler = do_get_stats,
+     .perm_check = manager_or_root},
+    {.cmd = KSU_IOCTL_GET_EVENT_FD,
+     .name = "GET_EVENT_FD",
+     .handler = do_get_event_fd,
+     .perm_check = manager_or_root},
+#if __SULOG_GATE
+    {.cmd = KSU_IOCTL_GET_SULOG_FD,
+     .name = "GET_SULOG_FD",
+     .handler = do_get_sulog_fd,
+     .perm_check = manager_or_root},
+    {.cmd = KSU_IOCTL_SULOG_FILTER,
+     .name = "SULOG_FILTER",
+     .handler = do_sulog_filter,
+     .perm_check = manager_or_root,
+     .flags = KSU_IOCTL_F_AUDIT},
+#endif // #if __SULOG_GATE
     {.cmd = KSU_IOCTL_GET_FEATURE,
      .name = "GET_FEATURE",
      .handler = do_get_feature,
@@ -984,23 +1383,28 @@ static const struct ksu_ioctl_cmd_map ksu_ioctl_handlers[] = {
     {.cmd = KSU_IOCTL_SET_FEATURE,
      .name = "SET_FEATURE",
      .handler = do_set_feature,
-     .perm_check = manager_or_root},
+     .perm_check = manager_or_root,
+     .flags = KSU_IOCTL_F_AUDIT},
     {.cmd = KSU_IOCTL_GET_WRAPPER_FD,
      .name = "GET_WRAPPER_FD",
      .handler = do_get_wrapper_fd,
-     .perm_check = manager_or_root},
+     .perm_check = manager_or_root,
+     .flags = KSU_IOCTL_F_AUDIT},
     {.cmd = KSU_IOCTL_MANAGE_MARK,
      .name = "MANAGE_MARK",
      .handler = do_manage_mark,
-     .perm_check = manager_or_root},
+     .perm_check = manager_or_root,
+     .flags = KSU_IOCTL_F_AUDIT},
     {.cmd = KSU_IOCTL_NUKE_EXT4_SYSFS,
      .name = "NUKE_EXT4_SYSFS",
      .handler = do_nuke_ext4_sysfs,
-     .perm_check = manager_or_root},
+     .perm_check = manager_or_root,
+     .flags = KSU_IOCTL_F_AUDIT},
     {.cmd = KSU_IOCTL_ADD_TRY_UMOUNT,
      .name = "ADD_TRY_UMOUNT",
      .handler = add_try_umount,
-     .perm_check = manager_or_root},
+     .perm_check = manager_or_root,
+     .flags = KSU_IOCTL_F_AUDIT},
     {.cmd = KSU_IOCTL_GET_FULL_VERSION,
      .name = "GET_FULL_VERSION",
      .handler = do_get_full_version,
@@ -1013,13 +1417,15 @@ static const struct ksu_ioctl_cmd_map ksu_ioctl_handlers[] = {
     {.cmd = KSU_IOCTL_MANUAL_SU,
      .name = "MANUAL_SU",
      .handler = do_manual_su,
-     .perm_check = system_uid_check},
+     .perm_check = system_uid_check,
+     .flags = KSU_IOCTL_F_AUDIT},
 #endif // #ifdef CONFIG_KSU_MANUAL_SU
 #ifdef CONFIG_KSU_SUPERKEY
     {.cmd = KSU_IOCTL_SUPERKEY_AUTH,
      .name = "SUPERKEY_AUTH",
      .handler = do_superkey_auth,
-     .perm_check = always_allow},
+     .perm_check = always_allow,
+     .flags = KSU_IOCTL_F_AUDIT},
     {.cmd = KSU_IOCTL_SUPERKEY_STATUS,
      .name = "SUPERKEY_STATUS",
      .handler = do_superkey_status,
@@ -1032,6 +1438,22 @@ static const struct ksu_ioctl_cmd_map ksu_ioctl_handlers[] = {
     {.cmd = 0, .name = NULL, .handler = NULL, .perm_check = NULL} // Sentinel
 };
 
+// _IOC_NR(cmd) -> index into ksu_ioctl_handlers + 1, 0 if unused
+static u8 ksu_ioctl_index[1 << _IOC_NRBITS] __read_mostly;
+
+/*
+ * Permission checks cached per fd. The cache only serves the uid that
+ * installed the fd and is dropped whenever the manager changes. Bits are
+ * indexed like ksu_ioctl_handlers.
+ */
+struct ksu_fd_perm {
+	spinlock_t lock;
+	uid_t uid;
+	int generation;
+	u64 checked;
+	u64 allowed;
+};
+
 #ifndef CONFIG_KSU_HYMOFS
 struct ksu_install_fd_tw {
 	struct callback_head cb;
@@ -1476,11 +1898,26 @@ void ksu_supercalls_init(void)
 	int i;
 	int rc;
 
+	// one bit per handler in struct ksu_fd_perm
+	BUILD_BUG_ON(ARRAY_SIZE(ksu_ioctl_handlers) > 64);
+
 	pr_info("KernelSU IOCTL Commands:\n");
 	for (i = 0; ksu_ioctl_handlers[i].handler; i++) {
+		unsigned int nr = _IOC_NR(ksu_ioctl_handlers[i].cmd);
+
 		pr_info("  %-18s = 0x%08x\n", ksu_ioctl_handlers[i].name,
 			ksu_ioctl_handlers[i].cmd);
+		ksu_hook_stats_set_name(KSU_HOOK_STAT_IOCTL + i,
+					ksu_ioctl_handlers[i].name);
+
+		if (ksu_ioctl_index[nr]) {
+			pr_err("ioctl nr %u of %s is already taken\n", nr,
+			       ksu_ioctl_handlers[i].name);
+			continue;
+		}
+		ksu_ioctl_index[nr] = i + 1;
 	}
+	pr_info("  %-18s = 0x%08x\n", "BATCH", KSU_IOCTL_BATCH);
 
 #ifndef CONFIG_KSU_HYMOFS
 #ifdef KSU_KPROBES_HOOK
@@ -1532,10 +1969,146 @@ static inline void ksu_ioctl_audit(unsigned int cmd, const char *cmd_name,
 	const char *result = (ret == 0)	       ? "SUCCESS"
 			     : (ret == -EPERM) ? "DENIED"
 					       : "FAILED";
+
+	if (!ksu_sulog_wants_ioctl(cmd, uid))
+		return;
 	ksu_sulog_report_syscall(uid, NULL, cmd_name, result);
 #endif // #if __SULOG_GATE
 }
 
+static bool ksu_ioctl_permitted(struct ksu_fd_perm *perm, int i)
+{
+	const struct ksu_ioctl_cmd_map *h = &ksu_ioctl_handlers[i];
+	int generation = atomic_read_acquire(&ksu_manager_generation);
+	u64 bit = 1ULL << i;
+	bool allowed;
+
+	if (!h->perm_check || h->perm_check == always_allow)
+		return true;
+
+	// a passed on fd is checked against whoever uses it
+	if (!perm || (h->flags & KSU_IOCTL_F_NO_PERM_CACHE) ||
+	    perm->uid != current_uid().val)
+		return h->perm_check();
+
+	spin_lock(&perm->lock);
+	if (perm->generation != generation) {
+		perm->generation = generation;
+		perm->checked = 0;
+		perm->allowed = 0;
+	}
+	if (perm->checked & bit) {
+		allowed = perm->allowed & bit;
+		spin_unlock(&perm->lock);
+		return allowed;
+	}
+	spin_unlock(&perm->lock);
+
+	allowed = h->perm_check();
+
+	spin_lock(&perm->lock);
+	// the manager may have changed while we were checking
+	if (perm->generation == generation) {
+		perm->checked |= bit;
+		if (allowed)
+			perm->allowed |= bit;
+	}
+	spin_unlock(&perm->lock);
+
+	return allowed;
+}
+
+// Runs handler i for cmd with the permission check, stats and audit
+static int ksu_ioctl_call(struct ksu_fd_perm *perm, int i, unsigned int cmd,
+			  void __user *argp)
+{
+	const struct ksu_ioctl_cmd_map *h = &ksu_ioctl_handlers[i];
+	u64 start;
+	int ret;
+
+	// Check permission first
+	if (!ksu_ioctl_permitted(perm, i)) {
+		pr_warn("ksu ioctl: permission denied for cmd=0x%x uid=%d\n",
+			cmd, current_uid().val);
+		ksu_ioctl_audit(cmd, h->name, current_uid().val, -EPERM);
+		return -EPERM;
+	}
+
+	// Execute handler
+	start = ksu_hook_stats_start();
+	ret = h->handler(argp);
+	ksu_hook_stats_end(KSU_HOOK_STAT_IOCTL + i, start);
+	if (h->flags & KSU_IOCTL_F_AUDIT)
+		ksu_ioctl_audit(cmd, h->name, current_uid().val, ret);
+	return ret;
+}
+
+// Index of the handler for cmd, or -1
+static int ksu_ioctl_lookup(unsigned int cmd)
+{
+	int i = ksu_ioctl_index[_IOC_NR(cmd)] - 1;
+
+	// direction and size bits have to match too
+	if (_IOC_TYPE(cmd) != 'K' || i < 0 || ksu_ioctl_handlers[i].cmd != cmd)
+		return -1;
+	return i;
+}
+
+/*
+ * Every entry goes through the same checks as a separate ioctl would. The
+ * per-fd permission cache turns that into one check per kind of command.
+ */
+static int ksu_ioctl_batch(struct ksu_fd_perm *perm, void __user *argp)
+{
+	struct ksu_batch_entry *entries;
+	struct ksu_batch_cmd cmd;
+	size_t size;
+	int ret = 0;
+	u32 n;
+
+	if (copy_from_user(&cmd, argp, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.count > KSU_BATCH_MAX ||
+	    (cmd.flags & ~KSU_BATCH_STOP_ON_ERROR))
+		return -EINVAL;
+
+	size = sizeof(*entries) * cmd.count;
+	entries = kmalloc(size ? size : 1, GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	if (copy_from_user(entries, (void __user *)cmd.entries, size)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (n = 0; n < cmd.count; n++) {
+		struct ksu_batch_entry *e = &entries[n];
+		int i = ksu_ioctl_lookup(e->cmd);
+
+		e->result = i < 0 ? -ENOTTY
+				  : ksu_ioctl_call(perm, i, e->cmd,
+						   (void __user *)e->arg);
+		if (e->result < 0 && (cmd.flags & KSU_BATCH_STOP_ON_ERROR)) {
+			n++;
+			break;
+		}
+	}
+
+	cmd.done = n;
+	if (copy_to_user((void __user *)cmd.entries, entries,
+			 sizeof(*entries) * n) ||
+	    copy_to_user(argp, &cmd, sizeof(cmd))) {
+		pr_err("batch: copy_to_user failed\n");
+		ret = -EFAULT;
+	}
+
+out:
+	kfree(entries);
+	return ret;
+}
+
 // IOCTL dispatcher
 static long anon_ksu_ioctl(struct file *filp, unsigned int cmd,
 			   unsigned long arg)
@@ -1547,33 +2120,22 @@ static long anon_ksu_ioctl(struct file *filp, unsigned int cmd,
 	pr_info("ksu ioctl: cmd=0x%x from uid=%d\n", cmd, current_uid().val);
 #endif // #ifdef CONFIG_KSU_DEBUG
 
-	for (i = 0; ksu_ioctl_handlers[i].handler; i++) {
-		if (cmd == ksu_ioctl_handlers[i].cmd) {
-			// Check permission first
-			if (ksu_ioctl_handlers[i].perm_check &&
-			    !ksu_ioctl_handlers[i].perm_check()) {
-				pr_warn("ksu ioctl: permission denied for "
-					"cmd=0x%x uid=%d\n",
-					cmd, current_uid().val);
-				ksu_ioctl_audit(cmd, ksu_ioctl_handlers[i].name,
-						current_uid().val, -EPERM);
-				return -EPERM;
-			}
-			// Execute handler
-			int ret = ksu_ioctl_handlers[i].handler(argp);
-			ksu_ioctl_audit(cmd, ksu_ioctl_handlers[i].name,
-					current_uid().val, ret);
-			return ret;
-		}
+	if (cmd == KSU_IOCTL_BATCH)
+		return ksu_ioctl_batch(filp->private_data, argp);
+
+	i = ksu_ioctl_lookup(cmd);
+	if (i < 0) {
+		pr_warn("ksu ioctl: unsupported command 0x%x\n", cmd);
+		return -ENOTTY;
 	}
 
-	pr_warn("ksu ioctl: unsupported command 0x%x\n", cmd);
-	return -ENOTTY;
+	return ksu_ioctl_call(filp->private_data, i, cmd, argp);
 }
 
 // File release handler
 static int anon_ksu_release(struct inode *inode, struct file *filp)
 {
+	kfree(filp->private_data);
 	pr_info("ksu fd released\n");
 	return 0;
 }
@@ -1583,28 +2145,39 @@ static const struct file_operations anon_ksu_fops = {
     .owner = THIS_MODULE,
     .unlocked_ioctl = anon_ksu_ioctl,
     .compat_ioctl = anon_ksu_ioctl,
+    .mmap = ksu_status_page_mmap,
     .release = anon_ksu_release,
 };
 
 // Install KSU fd to current process
 int ksu_install_fd(void)
 {
+	struct ksu_fd_perm *perm;
 	struct file *filp;
 	int fd;
 
+	perm = kzalloc(sizeof(*perm), GFP_KERNEL);
+	if (!perm)
+		return -ENOMEM;
+	spin_lock_init(&perm->lock);
+	perm->uid = current_uid().val;
+	perm->generation = atomic_read(&ksu_manager_generation);
+
 	// Get unused fd
 	fd = get_unused_fd_flags(O_CLOEXEC);
 	if (fd < 0) {
 		pr_err("ksu_install_fd: failed to get unused fd\n");
+		kfree(perm);
 		return fd;
 	}
 
 	// Create anonymous inode file
-	filp = anon_inode_getfile("[ksu_driver]", &anon_ksu_fops, NULL,
+	filp = anon_inode_getfile("[ksu_driver]", &anon_ksu_fops, perm,
 				  O_RDWR | O_CLOEXEC);
 	if (IS_ERR(filp)) {
 		pr_err("ksu_install_fd: failed to create anon inode file\n");
 		put_unused_fd(fd);
+		kfree(perm);
 		return PTR_ERR(filp);
 	}
 
@@ -85,6 +85,93 @@ struct ksu_set_app_profile_cmd {
 	struct app_profile profile;
 };
 
+// Profiles are exchanged in the block encoding from profile_codec.h
+struct ksu_get_app_profiles_cmd {
+	__aligned_u64 arg; // Input: user buffer for the encoded profiles
+	__u32 buf_size; // Input: size of the buffer
+	__u32 uid_min; // Input: first uid to return
+	__u32 uid_max; // Input: last uid to return
+	__u32 count; // Output: number of profiles returned
+	__u32 size; // Output: bytes used, or needed if -ENOSPC
+};
+
+// Applied all or nothing, a bad block or profile fails with -EINVAL
+struct ksu_set_app_profiles_cmd {
+	__aligned_u64 arg; // Input: user buffer with the encoded profiles
+	__u32 buf_size; // Input: size of the encoded data
+	__u32 count; // Output: number of profiles applied
+};
+
+// upper bound of a bulk profile buffer
+#define KSU_APP_PROFILES_MAX_SIZE (4 << 20)
+
+struct ksu_hook_stat_entry {
+	char name[32];
+	__u64 count; // calls since the last reset
+	__u64 total_ns;
+	__u64 hist[32]; // log2 latency buckets, see hook_stats.h
+};
+
+#define KSU_GET_STATS_FLAG_RESET (1 << 0)
+
+struct ksu_get_stats_cmd {
+	__aligned_u64 arg; // Input: user array of ksu_hook_stat_entry
+	__u32 max_entries; // Input: length of the array
+	__u32 flags; // Input: KSU_GET_STATS_FLAG_*
+	__u32 count; // Output: number of entries returned
+	__u32 enabled; // Output: whether hook stats are being collected
+	__u64 prefilter_checked; // Output: su path prefilter, since boot
+	__u64 prefilter_skipped; // Output: paths rejected by the prefilter
+	__u32 umount_plans; // Output: per-zygote umount plans built
+	__u32 umount_plan_size; // Output: mounts in the last plan built
+	__u64 umount_plan_build_ns; // Output: time the last plan took
+	__u64 umount_plan_hits; // Output: app launches that replayed a plan
+	__u64 umount_plan_skipped; // Output: entries those launches skipped
+};
+
+#define KSU_SULOG_STREAM_BACKLOG (1 << 0)
+
+// read() on the returned fd yields whole struct sulog_record, see sulog.h
+struct ksu_get_sulog_fd_cmd {
+	__u32 flags; // Input: KSU_SULOG_STREAM_*
+};
+
+// read() on the returned fd yields whole struct ksu_event, see events.h
+struct ksu_get_event_fd_cmd {
+	__u32 mask; // Input: bit n set: enum ksu_event_type n, 0 for all
+};
+
+#define KSU_SULOG_FILTER_GET 0
+#define KSU_SULOG_FILTER_SET 1
+
+#define KSU_SULOG_FILTER_AGGREGATE (1 << 0)
+#define KSU_SULOG_FILTER_MAX_UIDS 16
+
+struct ksu_sulog_filter_cmd {
+	__u32 op; // Input: KSU_SULOG_FILTER_GET or KSU_SULOG_FILTER_SET
+	__u32 flags; // KSU_SULOG_FILTER_*
+	__u32 type_mask; // bit n set: log enum sulog_event_type n
+	__u32 uid_count;
+	__u32 uids[KSU_SULOG_FILTER_MAX_UIDS]; // never logged
+	__u64 ioctl_mask[4]; // bit n set: don't audit supercall _IOC_NR n
+};
+
+#define KSU_BATCH_STOP_ON_ERROR (1 << 0)
+#define KSU_BATCH_MAX 256
+
+struct ksu_batch_entry {
+	__u32 cmd; // Input: any KSU_IOCTL_* but KSU_IOCTL_BATCH
+	__s32 result; // Output: what the ioctl would have returned
+	__aligned_u64 arg; // Input: the ioctl's argument
+};
+
+struct ksu_batch_cmd {
+	__aligned_u64 entries; // Input: user array of ksu_batch_entry
+	__u32 count; // Input: length of the array, at most KSU_BATCH_MAX
+	__u32 flags; // Input: KSU_BATCH_*
+	__u32 done; // Output: number of entries executed
+};
+
 struct ksu_get_feature_cmd {
 	__u32 feature_id;
 	__u64 value;
@@ -130,6 +217,28 @@ struct ksu_list_try_umount_cmd {
 #define KSU_UMOUNT_WIPE 0
 #define KSU_UMOUNT_ADD 1
 #define KSU_UMOUNT_DEL 2
+// arg points to a struct ksu_umount_bulk_cmd for these
+#define KSU_UMOUNT_ADD_BULK 3
+#define KSU_UMOUNT_DEL_BULK 4
+#define KSU_UMOUNT_REPLACE 5
+#define KSU_UMOUNT_GET_BULK 6
+
+#define KSU_UMOUNT_PATH_MAX 256
+#define KSU_UMOUNT_BULK_MAX (64 * 1024)
+
+/*
+ * The buffer holds back to back records of a native endian __u32 flags
+ * followed by a NUL terminated path, unaligned. ADD_BULK skips paths already
+ * listed, DEL_BULK ignores the flags and REPLACE swaps the whole list at
+ * once. GET_BULK fills the buffer from the list and fails with -ENOSPC if it
+ * doesn't fit, done holding the size needed either way, so a GET_BULK with
+ * size 0 probes the size.
+ */
+struct ksu_umount_bulk_cmd {
+	__aligned_u64 buf;
+	__u32 size; // Input: bytes in buf
+	__u32 done; // Output: entries added or removed, bytes for GET_BULK
+};
 
 struct ksu_get_full_version_cmd {
 	char version_full[KSU_FULL_VERSION_STRING];
@@ -180,6 +289,13 @@ struct ksu_superkey_status_cmd {
 #define KSU_IOCTL_MANAGE_MARK _IOC(_IOC_READ | _IOC_WRITE, 'K', 16, 0)
 #define KSU_IOCTL_NUKE_EXT4_SYSFS _IOC(_IOC_WRITE, 'K', 17, 0)
 #define KSU_IOCTL_ADD_TRY_UMOUNT _IOC(_IOC_WRITE, 'K', 18, 0)
+#define KSU_IOCTL_GET_APP_PROFILES _IOC(_IOC_READ | _IOC_WRITE, 'K', 19, 0)
+#define KSU_IOCTL_SET_APP_PROFILES _IOC(_IOC_READ | _IOC_WRITE, 'K', 20, 0)
+#define KSU_IOCTL_GET_STATS _IOC(_IOC_READ | _IOC_WRITE, 'K', 21, 0)
+#define KSU_IOCTL_GET_SULOG_FD _IOC(_IOC_WRITE, 'K', 22, 0)
+#define KSU_IOCTL_SULOG_FILTER _IOC(_IOC_READ | _IOC_WRITE, 'K', 23, 0)
+#define KSU_IOCTL_BATCH _IOC(_IOC_READ | _IOC_WRITE, 'K', 24, 0)
+#define KSU_IOCTL_GET_EVENT_FD _IOC(_IOC_WRITE, 'K', 25, 0)
 #define KSU_IOCTL_GET_FULL_VERSION _IOC(_IOC_READ, 'K', 100, 0)
 #define KSU_IOCTL_HOOK_TYPE _IOC(_IOC_READ, 'K', 101, 0)
 #define KSU_IOCTL_LIST_TRY_UMOUNT _IOC(_IOC_READ | _IOC_WRITE, 'K', 200, 0)
@@ -197,14 +313,21 @@ struct ksu_superkey_status_cmd {
 typedef int (*ksu_ioctl_handler_t)(void __user *arg);
 typedef bool (*ksu_perm_check_t)(void);
 
+// Changes state, so calls are reported to sulog. Denials always are.
+#define KSU_IOCTL_F_AUDIT (1U << 0)
+// perm_check depends on more than the caller's uid and the manager
+#define KSU_IOCTL_F_NO_PERM_CACHE (1U << 1)
+
 struct ksu_ioctl_cmd_map {
 	unsigned int cmd;
 	const char *name;
 	ksu_ioctl_handler_t handler;
 	ksu_perm_check_t perm_check;
+	unsigned int flags;
 };
 
 int ksu_install_fd(void);
+const char *ksu_hook_type(void);
 void ksu_supercalls_init(void);
 void ksu_supercalls_exit(void);
 
@@ -98,6 +98,7 @@ void superkey_set_manager_uid(uid_t uid)
 	spin_lock(&superkey_lock);
 	authenticated_manager_uid = uid;
 	spin_unlock(&superkey_lock);
+	ksu_manager_changed();
 }
 
 bool superkey_is_manager(void)
@@ -125,6 +126,7 @@ void superkey_invalidate(void)
 	spin_lock(&superkey_lock);
 	authenticated_manager_uid = -1;
 	spin_unlock(&superkey_lock);
+	ksu_manager_changed();
 }
 
 uid_t superkey_get_manager_uid(void)
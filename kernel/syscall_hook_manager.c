@@ -3,6 +3,8 @@
 #include "linux/printk.h"
 #include "selinux/selinux.h"
 #include <asm/syscall.h>
+#include <linux/compat.h>
+#include <linux/jump_label.h>
 #include <linux/kprobes.h>
 #include <linux/namei.h>
 #include <linux/ptrace.h>
@@ -13,6 +15,7 @@
 
 #include "allowlist.h"
 #include "arch.h"
+#include "hook_stats.h"
 #include "klog.h" // IWYU pragma: keep
 #include "ksud.h"
 #include "selinux/selinux.h"
@@ -23,9 +26,12 @@
 
 #ifdef CONFIG_KSU_MANUAL_SU
 #include "manual_su.h"
-static inline void ksu_handle_task_alloc(struct pt_regs *regs)
+static void ksu_handle_task_alloc(struct pt_regs *regs)
 {
+	u64 start = ksu_hook_stats_start();
+
 	ksu_try_escalate_for_uid(current_uid().val);
+	ksu_hook_stats_end(KSU_HOOK_STAT_SYS_CLONE, start);
 }
 #endif // #ifdef CONFIG_KSU_MANUAL_SU
 
@@ -247,23 +253,6 @@ static struct kretprobe *syscall_regfunc_rp = NULL;
 static struct kretprobe *syscall_unregfunc_rp = NULL;
 #endif // #ifdef CONFIG_KRETPROBES
 
-static inline bool check_syscall_fastpath(int nr)
-{
-	switch (nr) {
-	case __NR_newfstatat:
-	case __NR_faccessat:
-	case __NR_execve:
-	case __NR_setresuid:
-	case __NR_clone:
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0)
-	case __NR_clone3:
-#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
-		return true;
-	default:
-		return false;
-	}
-}
-
 // Unmark init's child that are not zygote, adbd or ksud
 // For LKM mode: also detect app_process to trigger on_post_fs_data
 int ksu_handle_init_mark_tracker(const char __user **filename_user)
@@ -311,69 +300,141 @@ int ksu_handle_init_mark_tracker(const char __user **filename_user)
 }
 
 #ifdef CONFIG_HAVE_SYSCALL_TRACEPOINTS
+#ifdef KSU_TP_HOOK
+typedef void (*ksu_syscall_handler_t)(struct pt_regs *regs);
+
+// Indexed by syscall number, filled once before the tracepoint is registered
+static ksu_syscall_handler_t ksu_syscall_handlers[NR_syscalls] __read_mostly;
+#ifdef KSU_HAS_COMPAT_SYSCALLS
+static ksu_syscall_handler_t
+    ksu_compat_syscall_handlers[__NR_compat_syscalls] __read_mostly;
+#endif // #ifdef KSU_HAS_COMPAT_SYSCALLS
+
+static void ksu_sys_newfstatat(struct pt_regs *regs)
+{
+	int *dfd = (int *)&PT_REGS_PARM1(regs);
+	const char __user **filename_user =
+	    (const char __user **)&PT_REGS_PARM2(regs);
+	int *flags = (int *)&PT_REGS_SYSCALL_PARM4(regs);
+	u64 start;
+
+	if (!static_branch_likely(&ksu_su_compat_key))
+		return;
+
+	start = ksu_hook_stats_start();
+	ksu_handle_stat(dfd, filename_user, flags);
+	ksu_hook_stats_end(KSU_HOOK_STAT_SYS_NEWFSTATAT, start);
+}
+
+static void ksu_sys_faccessat(struct pt_regs *regs)
+{
+	int *dfd = (int *)&PT_REGS_PARM1(regs);
+	const char __user **filename_user =
+	    (const char __user **)&PT_REGS_PARM2(regs);
+	int *mode = (int *)&PT_REGS_PARM3(regs);
+	u64 start;
+
+	if (!static_branch_likely(&ksu_su_compat_key))
+		return;
+
+	start = ksu_hook_stats_start();
+	ksu_handle_faccessat(dfd, filename_user, mode, NULL);
+	ksu_hook_stats_end(KSU_HOOK_STAT_SYS_FACCESSAT, start);
+}
+
+static void ksu_sys_execve(struct pt_regs *regs)
+{
+	const char __user **filename_user =
+	    (const char __user **)&PT_REGS_PARM1(regs);
+	u64 start;
+
+	if (!static_branch_likely(&ksu_su_compat_key))
+		return;
+
+	start = ksu_hook_stats_start();
+	// For LKM mode, use tracepoint hook to detect init events because
+	// kprobe hook cannot reliably read user addresses on kernels with
+	// MTE/PAC enabled
+	if (current->pid != 1 && is_init(get_current_cred()))
+		ksu_handle_init_mark_tracker(filename_user);
+	else
+		ksu_handle_execve_sucompat(filename_user, NULL, NULL, NULL);
+	ksu_hook_stats_end(KSU_HOOK_STAT_SYS_EXECVE, start);
+}
+
+static void ksu_sys_setresuid(struct pt_regs *regs)
+{
+	uid_t ruid = (uid_t)PT_REGS_PARM1(regs);
+	uid_t euid = (uid_t)PT_REGS_PARM2(regs);
+	uid_t suid = (uid_t)PT_REGS_PARM3(regs);
+	u64 start = ksu_hook_stats_start();
+
+	ksu_handle_setresuid(ruid, euid, suid);
+	ksu_hook_stats_end(KSU_HOOK_STAT_SYS_SETRESUID, start);
+}
+
+static void ksu_syscall_handlers_init(void)
+{
+	ksu_syscall_handlers[__NR_newfstatat] = ksu_sys_newfstatat;
+	ksu_syscall_handlers[__NR_faccessat] = ksu_sys_faccessat;
+	ksu_syscall_handlers[__NR_execve] = ksu_sys_execve;
+	ksu_syscall_handlers[__NR_setresuid] = ksu_sys_setresuid;
+#ifdef CONFIG_KSU_MANUAL_SU
+	// Handle task_alloc via clone/fork
+	ksu_syscall_handlers[__NR_clone] = ksu_handle_task_alloc;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0)
+	ksu_syscall_handlers[__NR_clone3] = ksu_handle_task_alloc;
+#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
+#endif // #ifdef CONFIG_KSU_MANUAL_SU
+
+#ifdef KSU_HAS_COMPAT_SYSCALLS
+	// compat syscalls pass their arguments in the same registers
+	ksu_compat_syscall_handlers[__KSU_NR_compat_fstatat64] =
+	    ksu_sys_newfstatat;
+	ksu_compat_syscall_handlers[__KSU_NR_compat_faccessat] =
+	    ksu_sys_faccessat;
+	ksu_compat_syscall_handlers[__KSU_NR_compat_execve] = ksu_sys_execve;
+	ksu_compat_syscall_handlers[__KSU_NR_compat_setresuid32] =
+	    ksu_sys_setresuid;
+#ifdef CONFIG_KSU_MANUAL_SU
+	ksu_compat_syscall_handlers[__KSU_NR_compat_clone] =
+	    ksu_handle_task_alloc;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0)
+	ksu_compat_syscall_handlers[__KSU_NR_compat_clone3] =
+	    ksu_handle_task_alloc;
+#endif // #if LINUX_VERSION_CODE >= KERNEL_VERSIO...
+#endif // #ifdef CONFIG_KSU_MANUAL_SU
+#endif // #ifdef KSU_HAS_COMPAT_SYSCALLS
+}
+
+static __always_inline ksu_syscall_handler_t ksu_syscall_handler(long id)
+{
+#ifdef CONFIG_COMPAT
+	if (unlikely(in_compat_syscall())) {
+#ifdef KSU_HAS_COMPAT_SYSCALLS
+		if ((unsigned long)id < __NR_compat_syscalls)
+			return ksu_compat_syscall_handlers[id];
+#endif // #ifdef KSU_HAS_COMPAT_SYSCALLS
+		return NULL;
+	}
+#endif // #ifdef CONFIG_COMPAT
+
+	if ((unsigned long)id < NR_syscalls)
+		return ksu_syscall_handlers[id];
+
+	return NULL;
+}
+#endif // #ifdef KSU_TP_HOOK
+
 // Generic sys_enter handler that dispatches to specific handlers
 static void ksu_sys_enter_handler(void *data, struct pt_regs *regs, long id)
 {
-	if (unlikely(check_syscall_fastpath(id))) {
 #ifdef KSU_TP_HOOK
-		if (ksu_su_compat_enabled) {
-			// Handle newfstatat
-			if (id == __NR_newfstatat) {
-				int *dfd = (int *)&PT_REGS_PARM1(regs);
-				const char __user **filename_user =
-				    (const char __user **)&PT_REGS_PARM2(regs);
-				int *flags =
-				    (int *)&PT_REGS_SYSCALL_PARM4(regs);
-				ksu_handle_stat(dfd, filename_user, flags);
-				return;
-			}
-
-			// Handle faccessat
-			if (id == __NR_faccessat) {
-				int *dfd = (int *)&PT_REGS_PARM1(regs);
-				const char __user **filename_user =
-				    (const char __user **)&PT_REGS_PARM2(regs);
-				int *mode = (int *)&PT_REGS_PARM3(regs);
-				ksu_handle_faccessat(dfd, filename_user, mode,
-						     NULL);
-				return;
-			}
-
-			// Handle execve
-			if (id == __NR_execve) {
-				const char __user **filename_user =
-				    (const char __user **)&PT_REGS_PARM1(regs);
-				// For LKM mode, use tracepoint hook to detect
-				// init events because kprobe hook cannot
-				// reliably read user addresses on kernels with
-				// MTE/PAC enabled
-				if (current->pid != 1 &&
-				    is_init(get_current_cred())) {
-					ksu_handle_init_mark_tracker(
-					    filename_user);
-				} else {
-					ksu_handle_execve_sucompat(
-					    filename_user, NULL, NULL, NULL);
-				}
-				return;
-			}
-		}
+	ksu_syscall_handler_t handler = ksu_syscall_handler(id);
 
-		// Handle setresuid
-		if (id == __NR_setresuid) {
-			uid_t ruid = (uid_t)PT_REGS_PARM1(regs);
-			uid_t euid = (uid_t)PT_REGS_PARM2(regs);
-			uid_t suid = (uid_t)PT_REGS_PARM3(regs);
-			ksu_handle_setresuid(ruid, euid, suid);
-			return;
-		}
-#ifdef CONFIG_KSU_MANUAL_SU
-		// Handle task_alloc via clone/fork
-		if (id == __NR_clone || id == __NR_clone3)
-			return ksu_handle_task_alloc(regs);
-#endif // #ifdef CONFIG_KSU_MANUAL_SU
+	if (unlikely(handler))
+		handler(regs);
 #endif // #ifdef KSU_TP_HOOK
-	}
 }
 #endif // #ifdef CONFIG_HAVE_SYSCALL_TRACEPOINTS
 
@@ -392,6 +453,9 @@ void ksu_syscall_hook_manager_init(void)
 #endif // #ifdef CONFIG_KRETPROBES
 
 #ifdef CONFIG_HAVE_SYSCALL_TRACEPOINTS
+#ifdef KSU_TP_HOOK
+	ksu_syscall_handlers_init();
+#endif // #ifdef KSU_TP_HOOK
 	ret = register_trace_sys_enter(ksu_sys_enter_handler, NULL);
 #ifndef CONFIG_KRETPROBES
 	ksu_mark_running_process_locked();
@@ -422,6 +486,10 @@ void ksu_syscall_hook_manager_exit(void)
 	destroy_kretprobe(&syscall_regfunc_rp);
 	destroy_kretprobe(&syscall_unregfunc_rp);
 #endif // #ifdef CONFIG_KRETPROBES
+#ifdef CONFIG_KSU_MANUAL_SU
+	// the tracepoint was the last thing able to queue it
+	ksu_manual_su_exit();
+#endif // #ifdef CONFIG_KSU_MANUAL_SU
 	ksu_sucompat_exit();
 	ksu_setuid_hook_exit();
 }
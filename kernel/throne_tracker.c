@@ -1,78 +1,144 @@
 #include <linux/err.h>
 #include <linux/fs.h>
+#include <linux/hashtable.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
 #include <linux/namei.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/stat.h>
 #include <linux/string.h>
 #include <linux/types.h>
 #include <linux/version.h>
+#include <linux/vmalloc.h>
 #include <linux/workqueue.h>
 
 #include "allowlist.h"
 #include "apk_sign.h"
+#include "events.h"
+#include "feature.h"
+#include "hook_stats.h"
 #include "kernel_compat.h"
 #include "klog.h" // IWYU pragma: keep
+#include "ksud.h"
 #include "manager.h"
 #include "throne_tracker.h"
 
 uid_t ksu_manager_uid = KSU_INVALID_UID;
 uid_t ksu_manager_appid = KSU_INVALID_UID;
+atomic_t ksu_manager_generation = ATOMIC_INIT(0);
 
 static uid_t locked_manager_appid = KSU_INVALID_UID;
 
 #define KSU_UID_LIST_PATH "/data/misc/user_uid/uid_list"
 #define SYSTEM_PACKAGES_LIST_PATH "/data/system/packages.list"
 
+// packages.list is ~100 bytes per package
+#define UID_LIST_MAX_SIZE (4 * 1024 * 1024)
+#define UID_LIST_HASH_BITS 10
+
 struct uid_data {
-	struct list_head list;
+	struct hlist_node node;
 	u32 appid;
-	char package[KSU_MAX_PACKAGE_NAME];
+	const char *package; // points into uid_list.buf
 };
 
-// Try read /data/misc/user_uid/uid_list
-static int uid_from_um_list(struct list_head *uid_list)
+struct uid_list {
+	char *buf; // the file the entries were parsed from, in place
+	struct uid_data *entries;
+	size_t count;
+	DECLARE_HASHTABLE(packages, UID_LIST_HASH_BITS);
+};
+
+static unsigned int package_hash(const char *name)
 {
-	struct file *fp;
-	char *buf = NULL;
-	loff_t size, pos = 0;
-	ssize_t nr;
-	char *line = NULL;
-	char *next = NULL;
-	int cnt = 0;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 8, 0)
+	return full_name_hash(name, strlen(name));
+#else
+	return full_name_hash(NULL, name, strlen(name));
+#endif // #if LINUX_VERSION_CODE < KERNEL_VERSION...
+}
 
-	fp = ksu_filp_open_compat(KSU_UID_LIST_PATH, O_RDONLY, 0);
-	if (IS_ERR(fp)) {
-		return -ENOENT;
-	}
+// Reads path whole and makes room for an entry per line
+static struct uid_list *uid_list_load(const char *path)
+{
+	struct uid_list *list;
+	size_t size, lines = 1;
+	const char *p;
+
+	list = kzalloc(sizeof(*list), GFP_KERNEL);
+	if (!list)
+		return ERR_PTR(-ENOMEM);
+	hash_init(list->packages);
+
+	list->buf = ksu_read_file_compat(path, UID_LIST_MAX_SIZE, &size);
+	if (IS_ERR(list->buf)) {
+		int err = PTR_ERR(list->buf);
 
-	size = fp->f_inode->i_size;
-	if (size <= 0) {
-		filp_close(fp, NULL);
-		return -ENODATA;
+		kfree(list);
+		return ERR_PTR(err);
 	}
 
-	buf = kzalloc(size + 1, GFP_ATOMIC);
-	if (!buf) {
-		pr_err("uid_list: OOM %lld B\n", size);
-		filp_close(fp, NULL);
-		return -ENOMEM;
+	for (p = list->buf; (p = strchr(p, '\n')); p++)
+		lines++;
+
+	list->entries = vmalloc(lines * sizeof(*list->entries));
+	if (!list->entries) {
+		pr_err("uid_list: OOM %zu entries\n", lines);
+		vfree(list->buf);
+		kfree(list);
+		return ERR_PTR(-ENOMEM);
 	}
+	return list;
+}
+
+static void uid_list_add(struct uid_list *list, u32 appid,
+			 const char *package)
+{
+	struct uid_data *d = &list->entries[list->count++];
+
+	d->appid = appid;
+	d->package = package;
+	hash_add(list->packages, &d->node, package_hash(package));
+}
 
-	nr = ksu_kernel_read_compat(fp, buf, size, &pos);
-	filp_close(fp, NULL);
-	if (nr != size) {
-		pr_err("uid_list: short read %zd/%lld\n", nr, size);
-		kfree(buf);
-		return -EIO;
+static struct uid_data *uid_list_find(struct uid_list *list,
+				      const char *package)
+{
+	struct uid_data *d;
+
+	hash_for_each_possible (list->packages, d, node,
+				package_hash(package)) {
+		if (!strncmp(d->package, package, KSU_MAX_PACKAGE_NAME))
+			return d;
 	}
-	buf[size] = '\0';
+	return NULL;
+}
 
-	for (line = buf; line; line = next) {
+static void uid_list_free(struct uid_list *list)
+{
+	if (!list)
+		return;
+	vfree(list->entries);
+	vfree(list->buf);
+	kfree(list);
+}
+
+// Try read /data/misc/user_uid/uid_list
+static struct uid_list *uid_from_um_list(void)
+{
+	struct uid_list *list;
+	char *line = NULL;
+	char *next = NULL;
+
+	list = uid_list_load(KSU_UID_LIST_PATH);
+	if (IS_ERR(list))
+		return list;
+
+	for (line = list->buf; line; line = next) {
 		char *uid_str = NULL;
 		char *pkg = NULL;
 		u32 uid;
-		struct uid_data *d = NULL;
 
 		next = strchr(line, '\n');
 		if (next)
@@ -97,24 +163,46 @@ static int uid_from_um_list(struct list_head *uid_list)
 			continue;
 		}
 
-		d = kzalloc(sizeof(*d), GFP_ATOMIC);
-		if (unlikely(!d)) {
-			pr_err("uid_list: OOM appid=%u\n", uid);
+		uid_list_add(list, uid, pkg);
+	}
+
+	pr_info("uid_list: loaded %zu entries\n", list->count);
+	if (!list->count) {
+		uid_list_free(list);
+		return ERR_PTR(-ENODATA);
+	}
+	return list;
+}
+
+// Lines are "<package> <uid> <debuggable> <data dir> <seinfo> <gids>"
+static struct uid_list *uid_from_packages_list(void)
+{
+	struct uid_list *list;
+	char *line, *next, *package, *uid;
+	u32 appid;
+
+	list = uid_list_load(SYSTEM_PACKAGES_LIST_PATH);
+	if (IS_ERR(list))
+		return list;
+
+	for (line = list->buf; line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+
+		package = strsep(&line, " ");
+		uid = strsep(&line, " ");
+		if (!*package)
+			continue;
+		if (!uid || kstrtou32(uid, 10, &appid)) {
+			pr_err("track_throne: appid parse err: %s\n", package);
 			continue;
 		}
 
-		d->appid = uid;
-		strscpy(d->package, pkg, KSU_MAX_PACKAGE_NAME);
-		list_add_tail(&d->list, uid_list);
-		++cnt;
-		// Log first few entries for debug
-		if (cnt <= 5) {
-		}
+		uid_list_add(list, appid, package);
 	}
 
-	kfree(buf);
-	pr_info("uid_list: loaded %d entries\n", cnt);
-	return cnt > 0 ? 0 : -ENODATA;
+	return list;
 }
 
 static int get_pkg_from_apk_path(char *pkg, const char *path)
@@ -159,7 +247,7 @@ static int get_pkg_from_apk_path(char *pkg, const char *path)
 	return 0;
 }
 
-static void crown_manager(const char *apk, struct list_head *uid_data,
+static void crown_manager(const char *apk, struct uid_list *uid_list,
 			  int signature_index)
 {
 	char pkg[KSU_MAX_PACKAGE_NAME];
@@ -182,29 +270,52 @@ static void crown_manager(const char *apk, struct list_head *uid_data,
 	}
 #endif // #ifdef KSU_MANAGER_PACKAGE
 
-	list_for_each_entry (np, uid_data, list) {
-		if (strncmp(np->package, pkg, KSU_MAX_PACKAGE_NAME) == 0) {
-			if (locked_manager_appid != KSU_INVALID_UID &&
-			    locked_manager_appid != np->appid) {
-				pr_info(
-				    "Unlocking previous manager appid: %d\n",
-				    locked_manager_appid);
-				ksu_invalidate_manager_uid();
-				locked_manager_appid = KSU_INVALID_UID;
-			}
-
-			pr_info("Crowning manager: %s (appid=%d)\n", pkg,
-				np->appid);
+	np = uid_list_find(uid_list, pkg);
+	if (!np)
+		return;
 
-			ksu_set_manager_uid(np->appid);
-			locked_manager_appid = np->appid;
-			break;
-		}
+	if (locked_manager_appid != KSU_INVALID_UID &&
+	    locked_manager_appid != np->appid) {
+		pr_info("Unlocking previous manager appid: %d\n",
+			locked_manager_appid);
+		ksu_invalidate_manager_uid();
+		locked_manager_appid = KSU_INVALID_UID;
 	}
+
+	pr_info("Crowning manager: %s (appid=%d)\n", pkg, np->appid);
+
+	ksu_set_manager_uid(np->appid);
+	locked_manager_appid = np->appid;
 }
 
 #define DATA_PATH_LEN 384 // 384 is enough for /data/app/<package>/base.apk
 
+static void manager_hint_update(const char *apk);
+
+static bool try_crown_manager(char *apk, struct uid_list *uid_list)
+{
+	if (!is_manager_apk(apk))
+		return false;
+
+	pr_info("Found manager base.apk at path: %s\n", apk);
+	crown_manager(apk, uid_list, 0);
+	manager_hint_update(apk);
+	return true;
+}
+
+// "~~<random>" holds one package per directory since Android 11, and package
+// directories are named "<package>-<random>"
+static bool is_candidate_dir(const char *name, int namelen,
+			     const char *package)
+{
+	int len = strlen(package);
+
+	if (namelen >= 2 && name[0] == '~' && name[1] == '~')
+		return true;
+	return namelen > len && !strncmp(name, package, len) &&
+	       name[len] == '-';
+}
+
 struct data_path {
 	char dirpath[DATA_PATH_LEN];
 	int depth;
@@ -214,16 +325,35 @@ struct data_path {
 struct apk_path_hash {
 	unsigned int hash;
 	bool exists;
-	struct list_head list;
+	struct hlist_node node;
+};
+
+// base.apk paths already checked and found not to be the manager
+static DEFINE_HASHTABLE(apk_path_hash_table, 8);
+
+#define MANAGER_HINT_PATH "/data/adb/ksu/.manager_hint"
+
+/*
+ * Where the manager was crowned last, persisted as "<package> <apk> <ino>".
+ * Updates move the apk to a new random directory, so the package name is
+ * what narrows the search down when the apk itself is gone.
+ */
+struct manager_hint {
+	char package[KSU_MAX_PACKAGE_NAME];
+	char apk[DATA_PATH_LEN];
+	u64 ino;
+	bool loaded;
+	bool dirty; // changed since it was last saved
 };
 
-static struct list_head apk_path_hash_list = LIST_HEAD_INIT(apk_path_hash_list);
+static struct manager_hint manager_hint; // under throne_mutex
 
 struct my_dir_context {
 	struct dir_context ctx;
 	struct list_head *data_path_list;
 	char *parent_dir;
 	void *private_data;
+	const char *package; // only descend into this package's directories
 	int depth;
 	int *stop;
 };
@@ -279,8 +409,13 @@ FILLDIR_RETURN_TYPE my_actor(struct dir_context *ctx, const char *name,
 
 	if (d_type == DT_DIR && my_ctx->depth > 0 &&
 	    (my_ctx->stop && !*my_ctx->stop)) {
-		struct data_path *data =
-		    kzalloc(sizeof(struct data_path), GFP_ATOMIC);
+		struct data_path *data;
+
+		if (my_ctx->package &&
+		    !is_candidate_dir(name, namelen, my_ctx->package))
+			return FILLDIR_ACTOR_CONTINUE;
+
+		data = kzalloc(sizeof(struct data_path), GFP_ATOMIC);
 
 		if (!data) {
 			pr_err("Failed to allocate memory for %s\n", dirpath);
@@ -293,47 +428,37 @@ FILLDIR_RETURN_TYPE my_actor(struct dir_context *ctx, const char *name,
 	} else {
 		if ((namelen == 8) &&
 		    (strncmp(name, "base.apk", namelen) == 0)) {
-			struct apk_path_hash *pos, *n;
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 8, 0)
-			unsigned int hash =
-			    full_name_hash(dirpath, strlen(dirpath));
-#else
-			unsigned int hash =
-			    full_name_hash(NULL, dirpath, strlen(dirpath));
-#endif // #if LINUX_VERSION_CODE < KERNEL_VERSION...
-			int signature_index = -1;
-			bool is_multi_manager = false;
+			struct apk_path_hash *pos;
+			struct hlist_node *n;
+			unsigned int hash = package_hash(dirpath);
 			struct apk_path_hash *apk_data = NULL;
+			int bkt;
 
-			list_for_each_entry (pos, &apk_path_hash_list, list) {
+			hash_for_each_possible (apk_path_hash_table, pos, node,
+						hash) {
 				if (hash == pos->hash) {
 					pos->exists = true;
 					return FILLDIR_ACTOR_CONTINUE;
 				}
 			}
 
-			if (is_manager_apk(dirpath)) {
-				pr_info("Found manager base.apk at path: %s\n",
-					dirpath);
-				crown_manager(dirpath, my_ctx->private_data, 0);
+			if (try_crown_manager(dirpath, my_ctx->private_data)) {
 				*my_ctx->stop = 1;
+				// Manager found, clear APK cache
+				hash_for_each_safe (apk_path_hash_table, bkt, n,
+						    pos, node) {
+					hash_del(&pos->node);
+					kfree(pos);
+				}
+				return FILLDIR_ACTOR_CONTINUE;
 			}
 
 			apk_data = kzalloc(sizeof(*apk_data), GFP_ATOMIC);
 			if (apk_data) {
 				apk_data->hash = hash;
 				apk_data->exists = true;
-				list_add_tail(&apk_data->list,
-					      &apk_path_hash_list);
-			}
-
-			if (is_manager_apk(dirpath)) {
-				// Manager found, clear APK cache list
-				list_for_each_entry_safe (
-				    pos, n, &apk_path_hash_list, list) {
-					list_del(&pos->list);
-					kfree(pos);
-				}
+				hash_add(apk_path_hash_table, &apk_data->node,
+					 hash);
 			}
 		}
 	}
@@ -341,19 +466,24 @@ FILLDIR_RETURN_TYPE my_actor(struct dir_context *ctx, const char *name,
 	return FILLDIR_ACTOR_CONTINUE;
 }
 
-void search_manager(const char *path, int depth, struct list_head *uid_data)
+// Walks path for the manager, only through package's directories if set
+static bool search_manager(const char *path, int depth,
+			   struct uid_list *uid_list, const char *package)
 {
 	int i, stop = 0;
 	unsigned long data_app_magic = 0;
-	struct apk_path_hash *pos, *n;
+	struct apk_path_hash *pos;
+	struct hlist_node *n;
 	struct list_head data_path_list;
 	struct data_path data;
+	int bkt;
 
 	INIT_LIST_HEAD(&data_path_list);
 
-	// Initialize APK cache list
-	list_for_each_entry (pos, &apk_path_hash_list, list) {
-		pos->exists = false;
+	// Initialize APK cache, a partial walk can't tell what is stale
+	if (!package) {
+		hash_for_each (apk_path_hash_table, bkt, pos, node)
+			pos->exists = false;
 	}
 
 	// First depth
@@ -369,7 +499,8 @@ void search_manager(const char *path, int depth, struct list_head *uid_data)
 						     .data_path_list =
 							 &data_path_list,
 						     .parent_dir = pos->dirpath,
-						     .private_data = uid_data,
+						     .private_data = uid_list,
+						     .package = package,
 						     .depth = pos->depth,
 						     .stop = &stop};
 			struct file *file;
@@ -423,109 +554,226 @@ void search_manager(const char *path, int depth, struct list_head *uid_data)
 	}
 
 	// Remove stale cached APK entries
-	list_for_each_entry_safe (pos, n, &apk_path_hash_list, list) {
-		if (!pos->exists) {
-			list_del(&pos->list);
-			kfree(pos);
+	if (!package) {
+		hash_for_each_safe (apk_path_hash_table, bkt, n, pos, node) {
+			if (!pos->exists) {
+				hash_del(&pos->node);
+				kfree(pos);
+			}
 		}
 	}
+
+	return stop;
 }
 
-static bool is_uid_exist(uid_t uid, char *package, void *data)
+static void manager_hint_load(void)
 {
-	struct list_head *list = (struct list_head *)data;
-	struct uid_data *np;
-	u32 appid = uid % 100000;
-	bool exist = false;
+	char *buf;
+	size_t size;
 
-	list_for_each_entry (np, list, list) {
-		if (np->appid == appid &&
-		    strncmp(np->package, package, KSU_MAX_PACKAGE_NAME) == 0) {
-			exist = true;
-			break;
-		}
+	manager_hint.loaded = true;
+
+	buf = ksu_read_file_compat(MANAGER_HINT_PATH, PAGE_SIZE, &size);
+	if (IS_ERR(buf))
+		return;
+
+	// widths are KSU_MAX_PACKAGE_NAME and DATA_PATH_LEN minus one
+	if (sscanf(buf, "%255s %383s %llu", manager_hint.package,
+		   manager_hint.apk, &manager_hint.ino) != 3) {
+		pr_warn("throne_tracker: ignoring malformed manager hint\n");
+		memset(&manager_hint, 0, sizeof(manager_hint));
+		manager_hint.loaded = true;
 	}
-	return exist;
+	vfree(buf);
 }
 
-void track_throne(bool prune_only)
+static void manager_hint_save(void)
 {
-	struct list_head uid_list;
-	struct uid_data *np, *n;
 	struct file *fp;
-	char chr = 0;
-	loff_t pos = 0;
-	loff_t line_start = 0;
-	char buf[KSU_MAX_PACKAGE_NAME];
-	static bool manager_exist = false;
-	u32 current_manager_appid = ksu_get_manager_uid() % 100000;
-	bool need_search = false;
+	loff_t off = 0;
+	char *buf;
+	int len;
 
-	// init uid list head
-	INIT_LIST_HEAD(&uid_list);
-
-	{
-		fp = ksu_filp_open_compat(SYSTEM_PACKAGES_LIST_PATH, O_RDONLY,
-					  0);
-		if (IS_ERR(fp)) {
-			pr_err("%s: open " SYSTEM_PACKAGES_LIST_PATH
-			       " failed: %ld\n",
-			       __func__, PTR_ERR(fp));
-			return;
-		}
+	if (!manager_hint.dirty)
+		return;
 
-		for (;;) {
-			struct uid_data *data = NULL;
-			ssize_t count =
-			    ksu_kernel_read_compat(fp, &chr, sizeof(chr), &pos);
-			const char *delim = " ";
-			char *package = NULL;
-			char *tmp = NULL;
-			char *uid = NULL;
-			u32 res;
-
-			if (count != sizeof(chr))
-				break;
-			if (chr != '\n')
-				continue;
-
-			count = ksu_kernel_read_compat(fp, buf, sizeof(buf),
-						       &line_start);
-			data = kzalloc(sizeof(struct uid_data), GFP_ATOMIC);
-			if (!data) {
-				filp_close(fp, 0);
-				goto out;
-			}
+	buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!buf)
+		return;
+	len = snprintf(buf, PAGE_SIZE, "%s %s %llu\n", manager_hint.package,
+		       manager_hint.apk, manager_hint.ino);
 
-			tmp = buf;
+	fp = ksu_filp_open_compat(MANAGER_HINT_PATH,
+				  O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (IS_ERR(fp)) {
+		pr_err("throne_tracker: save manager hint failed: %ld\n",
+		       PTR_ERR(fp));
+	} else {
+		if (ksu_kernel_write_compat(fp, buf, len, &off) == len)
+			manager_hint.dirty = false;
+		filp_close(fp, 0);
+	}
+	kfree(buf);
+}
 
-			package = strsep(&tmp, delim);
-			uid = strsep(&tmp, delim);
-			if (!uid || !package) {
-				pr_err("update_uid: package or uid is NULL!\n");
-				break;
-			}
+static void manager_hint_update(const char *apk)
+{
+	char pkg[KSU_MAX_PACKAGE_NAME];
+	struct path path;
+	u64 ino = 0;
 
-			if (kstrtou32(uid, 10, &res)) {
-				pr_err("track_throne: appid parse err\n");
-				break;
-			}
-			data->appid = res;
-			strncpy(data->package, package, KSU_MAX_PACKAGE_NAME);
-			list_add_tail(&data->list, &uid_list);
-			// reset line start
-			line_start = pos;
+	if (get_pkg_from_apk_path(pkg, apk) < 0)
+		return;
+
+	if (!kern_path(apk, 0, &path)) {
+		ino = d_inode(path.dentry)->i_ino;
+		path_put(&path);
+	}
+
+	if (!strcmp(manager_hint.package, pkg) &&
+	    !strcmp(manager_hint.apk, apk) && manager_hint.ino == ino)
+		return;
+
+	strscpy(manager_hint.package, pkg, sizeof(manager_hint.package));
+	strscpy(manager_hint.apk, apk, sizeof(manager_hint.apk));
+	manager_hint.ino = ino;
+	manager_hint.dirty = true;
+}
+
+/*
+ * Tries the apk the manager was last crowned from, then only the directories
+ * of its package. Costs a single signature check after a manager update
+ * instead of one per installed app.
+ */
+static bool search_manager_hinted(struct uid_list *uid_list)
+{
+	const char *package = manager_hint.package;
+	struct path path;
+
+	if (!manager_hint.loaded)
+		manager_hint_load();
+
+#ifdef KSU_MANAGER_PACKAGE
+	if (!*package)
+		package = KSU_MANAGER_PACKAGE;
+#endif // #ifdef KSU_MANAGER_PACKAGE
+
+	if (!*package || !uid_list_find(uid_list, package))
+		return false;
+
+	if (*manager_hint.apk && !kern_path(manager_hint.apk, 0, &path)) {
+		bool same = d_inode(path.dentry)->i_ino == manager_hint.ino;
+
+		path_put(&path);
+		pr_info("throne_tracker: trying hinted apk %s%s\n",
+			manager_hint.apk, same ? "" : " (replaced)");
+		if (try_crown_manager(manager_hint.apk, uid_list))
+			return true;
+	}
+
+	pr_info("throne_tracker: searching directories of %s\n", package);
+	return search_manager("/data/app", 2, uid_list, package);
+}
+
+static bool is_uid_exist(uid_t uid, char *package, void *data)
+{
+	struct uid_data *np = uid_list_find(data, package);
+
+	return np && np->appid == uid % 100000;
+}
+
+static DEFINE_MUTEX(throne_mutex);
+// packages.list as of the last run, under throne_mutex
+static struct uid_list *uid_snapshot;
+// whether the allowlist was fully pruned against uid_snapshot
+static bool uid_snapshot_pruned;
+
+// Package names are unique in packages.list
+static void uid_list_diff(struct uid_list *old, struct uid_list *new,
+			  size_t *added, size_t *removed, size_t *changed)
+{
+	struct uid_data *o;
+	size_t i, matched;
+
+	*added = *changed = 0;
+	for (i = 0; i < new->count; i++) {
+		o = uid_list_find(old, new->entries[i].package);
+		if (!o)
+			(*added)++;
+		else if (o->appid != new->entries[i].appid)
+			(*changed)++;
+	}
+
+	matched = new->count - *added;
+	*removed = old->count > matched ? old->count - matched : 0;
+}
+
+// Only profiles of packages removed or moved since the snapshot can be stale
+static bool is_uid_unchanged(uid_t uid, char *package, void *data)
+{
+	return !uid_list_find(uid_snapshot, package) ||
+	       is_uid_exist(uid, package, data);
+}
+
+/*
+ * Profiles that passed the last prune only go stale when their package is
+ * removed or moves to another appid, so those are the only ones checked.
+ * A profile added since then may name a package that was never installed,
+ * which installs alone wouldn't reveal, so that forces a full prune.
+ */
+static void prune_allowlist(struct uid_list *list)
+{
+	bool (*is_valid)(uid_t, char *, void *) = is_uid_exist;
+	size_t added, removed, changed;
+	bool boot_completed;
+	bool new_profiles = ksu_allowlist_test_and_clear_added();
+
+	if (uid_snapshot && uid_snapshot_pruned) {
+		uid_list_diff(uid_snapshot, list, &added, &removed, &changed);
+		pr_info("packages: %zu added, %zu removed, %zu changed\n",
+			added, removed, changed);
+		if (added || removed || changed)
+			ksu_event_notify(KSU_EVENT_PACKAGES,
+					 added + removed + changed, 0);
+		if (!new_profiles) {
+			if (!removed && !changed)
+				return;
+			is_valid = is_uid_unchanged;
 		}
+	} else {
+		ksu_event_notify(KSU_EVENT_PACKAGES, 0, 0);
+	}
 
-		filp_close(fp, 0);
+	// the allowlist skips pruning until boot completed
+	boot_completed = READ_ONCE(ksu_boot_completed);
+	ksu_prune_allowlist(is_valid, list);
+	uid_snapshot_pruned = boot_completed;
+}
+
+void track_throne(bool prune_only)
+{
+	struct uid_list *uid_list;
+	static bool manager_exist = false;
+	u32 current_manager_appid = ksu_get_manager_uid() % 100000;
+	bool need_search = false;
+	u64 start = ksu_hook_stats_start();
+	size_t i;
+
+	mutex_lock(&throne_mutex);
+
+	uid_list = uid_from_packages_list();
+	if (IS_ERR(uid_list)) {
+		pr_err("%s: read " SYSTEM_PACKAGES_LIST_PATH " failed: %ld\n",
+		       __func__, PTR_ERR(uid_list));
+		goto out;
 	}
 
 	if (prune_only)
 		goto prune;
 
 	// check if current manager appid still exists
-	list_for_each_entry (np, &uid_list, list) {
-		if (np->appid == current_manager_appid) {
+	for (i = 0; i < uid_list->count; i++) {
+		if (uid_list->entries[i].appid == current_manager_appid) {
 			manager_exist = true;
 			break;
 		}
@@ -546,51 +794,176 @@ void track_throne(bool prune_only)
 
 	need_search = !manager_exist;
 
-	if (need_search) {
+	if (need_search && !search_manager_hinted(uid_list)) {
 		pr_info("Searching for manager(s)...\n");
-		search_manager("/data/app", 2, &uid_list);
+		search_manager("/data/app", 2, uid_list, NULL);
 		pr_info("Manager search finished\n");
 	}
+	manager_hint_save();
 
 prune:
 	// then prune the allowlist
-	ksu_prune_allowlist(is_uid_exist, &uid_list);
+	prune_allowlist(uid_list);
+	uid_list_free(uid_snapshot);
+	uid_snapshot = uid_list;
 out:
-	// free uid_list
-	list_for_each_entry_safe (np, n, &uid_list, list) {
-		list_del(&np->list);
-		kfree(np);
-	}
+	mutex_unlock(&throne_mutex);
+	ksu_hook_stats_end(KSU_HOOK_STAT_THRONE, start);
 }
 
 /*
- * LKM mode: Delayed manager search
- * When loaded after boot, packages.list may already exist and won't
- * trigger fsnotify. Schedule a delayed search for manager.
+ * PackageManager rewrites packages.list several times per install, and
+ * update storms install dozens of packages back to back. Events only push
+ * the rescan out until throne_debounce_ms have passed without one, but never
+ * further than throne_max_delay_ms after the first event of the burst.
  */
-#ifdef CONFIG_KSU_LKM
-static struct delayed_work throne_search_work;
-
-static void do_throne_search(struct work_struct *work)
+#define THRONE_DEBOUNCE_MS 500
+#define THRONE_MAX_DELAY_MS 5000
+#define THRONE_DELAY_MS_MAX 60000
+
+static u32 throne_debounce_ms __read_mostly = THRONE_DEBOUNCE_MS;
+static u32 throne_max_delay_ms __read_mostly = THRONE_MAX_DELAY_MS;
+
+static struct delayed_work throne_work;
+static DEFINE_SPINLOCK(throne_lock);
+static unsigned int throne_events; // since the last rescan, under throne_lock
+static unsigned long throne_first_event; // jiffies, under throne_lock
+static bool throne_stopped; // under throne_lock
+static u64 throne_total_events;
+static u64 throne_total_scans;
+
+static void throne_work_fn(struct work_struct *work)
 {
-	pr_info("throne_tracker: delayed search for manager...\n");
+	unsigned int events;
+
+	spin_lock(&throne_lock);
+	events = throne_events;
+	throne_events = 0;
+	spin_unlock(&throne_lock);
+
+	// the LKM boot search is queued without an event
+	if (events) {
+		throne_total_events += events;
+		throne_total_scans++;
+		pr_info("throne_tracker: %u events coalesced into one rescan "
+			"(%llu events, %llu rescans total)\n",
+			events, throne_total_events, throne_total_scans);
+	} else {
+		pr_info("throne_tracker: delayed search for manager...\n");
+	}
+
 	track_throne(false);
 }
-#endif // #ifdef CONFIG_KSU_LKM
+
+void ksu_throne_tracker_schedule(void)
+{
+	unsigned long now = jiffies;
+	unsigned long delay = msecs_to_jiffies(READ_ONCE(throne_debounce_ms));
+	unsigned long deadline;
+
+	spin_lock(&throne_lock);
+	if (throne_stopped)
+		goto out;
+
+	if (!throne_events++)
+		throne_first_event = now;
+
+	deadline = throne_first_event +
+		   msecs_to_jiffies(READ_ONCE(throne_max_delay_ms));
+	if (time_after(now + delay, deadline))
+		delay = time_after(deadline, now) ? deadline - now : 0;
+
+	// a rescan walks /data/app and verifies apk signatures, keep it off
+	// the per-cpu system_wq
+	mod_delayed_work(system_unbound_wq, &throne_work, delay);
+out:
+	spin_unlock(&throne_lock);
+}
+
+static int throne_debounce_get(u64 *value)
+{
+	*value = throne_debounce_ms;
+	return 0;
+}
+
+static int throne_debounce_set(u64 value)
+{
+	if (value > THRONE_DELAY_MS_MAX)
+		return -EINVAL;
+	WRITE_ONCE(throne_debounce_ms, value);
+	pr_info("throne_tracker: debounce set to %llums\n", value);
+	return 0;
+}
+
+static const struct ksu_feature_handler throne_debounce_handler = {
+    .feature_id = KSU_FEATURE_THRONE_DEBOUNCE,
+    .name = "throne_debounce",
+    .get_handler = throne_debounce_get,
+    .set_handler = throne_debounce_set,
+};
+
+static int throne_max_delay_get(u64 *value)
+{
+	*value = throne_max_delay_ms;
+	return 0;
+}
+
+static int throne_max_delay_set(u64 value)
+{
+	if (value > THRONE_DELAY_MS_MAX)
+		return -EINVAL;
+	WRITE_ONCE(throne_max_delay_ms, value);
+	pr_info("throne_tracker: max delay set to %llums\n", value);
+	return 0;
+}
+
+static const struct ksu_feature_handler throne_max_delay_handler = {
+    .feature_id = KSU_FEATURE_THRONE_MAX_DELAY,
+    .name = "throne_max_delay",
+    .get_handler = throne_max_delay_get,
+    .set_handler = throne_max_delay_set,
+};
 
 void ksu_throne_tracker_init(void)
 {
+	INIT_DELAYED_WORK(&throne_work, throne_work_fn);
+	throne_stopped = false;
+
+	if (ksu_register_feature_handler(&throne_debounce_handler)) {
+		pr_err("Failed to register throne_debounce handler\n");
+	}
+	if (ksu_register_feature_handler(&throne_max_delay_handler)) {
+		pr_err("Failed to register throne_max_delay handler\n");
+	}
+
 #ifdef CONFIG_KSU_LKM
-	INIT_DELAYED_WORK(&throne_search_work, do_throne_search);
-	schedule_delayed_work(&throne_search_work, msecs_to_jiffies(3000));
+	/*
+	 * When loaded after boot, packages.list may already exist and won't
+	 * trigger fsnotify. Schedule a delayed search for manager.
+	 */
+	queue_delayed_work(system_unbound_wq, &throne_work,
+			   msecs_to_jiffies(3000));
 	pr_info("throne_tracker: init, scheduled manager search in 3s\n");
 #endif // #ifdef CONFIG_KSU_LKM
 }
 
 void ksu_throne_tracker_exit(void)
 {
-#ifdef CONFIG_KSU_LKM
-	cancel_delayed_work_sync(&throne_search_work);
-#endif // #ifdef CONFIG_KSU_LKM
+	ksu_unregister_feature_handler(KSU_FEATURE_THRONE_DEBOUNCE);
+	ksu_unregister_feature_handler(KSU_FEATURE_THRONE_MAX_DELAY);
+
+	// the observer may still be live and must not requeue the work
+	spin_lock(&throne_lock);
+	throne_stopped = true;
+	spin_unlock(&throne_lock);
+
+	cancel_delayed_work_sync(&throne_work);
+
+	mutex_lock(&throne_mutex);
+	uid_list_free(uid_snapshot);
+	uid_snapshot = NULL;
+	uid_snapshot_pruned = false;
+	mutex_unlock(&throne_mutex);
+
 	pr_info("throne_tracker: exit\n");
-}
\ No newline at end of file
+}
@@ -7,4 +7,7 @@ void ksu_throne_tracker_exit(void);
 
 void track_throne(bool prune_only);
 
+// Queues a debounced track_throne(false), safe from fsnotify callbacks
+void ksu_throne_tracker_schedule(void);
+
 #endif // #ifndef __KSU_H_THRONE_TRACKER
@@ -347,6 +347,31 @@ NativeBridge(setAppProfile, jboolean, jobject profile) {
   return set_app_profile(&p);
 }
 
+// The buffers are direct ByteBuffers filled/decoded on the Kotlin side, so
+// no per-field reflection is needed for bulk profiles.
+NativeBridge(getAppProfilesRaw, jint, jobject buf, jint uidMin, jint uidMax) {
+  void *addr = GetEnvironment()->GetDirectBufferAddress(env, buf);
+  jlong capacity = GetEnvironment()->GetDirectBufferCapacity(env, buf);
+  if (!addr || capacity < 0) {
+    return -1;
+  }
+  return get_app_profiles(addr, (uint32_t)capacity, (uint32_t)uidMin,
+                          (uint32_t)uidMax);
+}
+
+NativeBridge(setAppProfilesRaw, jint, jobject buf, jint size) {
+  void *addr = GetEnvironment()->GetDirectBufferAddress(env, buf);
+  jlong capacity = GetEnvironment()->GetDirectBufferCapacity(env, buf);
+  if (!addr || size < 0 || size > capacity) {
+    return -1;
+  }
+  return set_app_profiles(addr, (uint32_t)size);
+}
+
+NativeBridge(getEventFd, jint, jint mask) {
+  return get_event_fd((uint32_t)mask);
+}
+
 NativeBridge(uidShouldUmount, jboolean, jint uid) {
   return uid_should_umount(uid);
 }
@@ -4,11 +4,13 @@
 
 #include <android/log.h>
 #include <dirent.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include "ksu.h"
@@ -66,6 +68,62 @@ static int ksuctl(unsigned long op, void *arg) {
   return ioctl(fd, op, arg);
 }
 
+static const struct ksu_status_page *g_status = NULL;
+static bool g_status_unsupported = false;
+
+static const struct ksu_status_page *map_status_page() {
+  if (g_status || g_status_unsupported) {
+    return g_status;
+  }
+  if (fd < 0) {
+    fd = scan_driver_fd();
+  }
+  if (fd < 0) {
+    // may still show up after SuperKey authentication
+    return NULL;
+  }
+
+  void *page =
+      mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+  if (page == MAP_FAILED) {
+    LogDebug("map_status_page: mmap failed, errno=%d", errno);
+    // EPERM until we are the manager, try again later
+    g_status_unsupported = errno != EPERM;
+    return NULL;
+  }
+  if (((const struct ksu_status_page *)page)->magic != KSU_STATUS_MAGIC) {
+    munmap(page, sysconf(_SC_PAGESIZE));
+    g_status_unsupported = true;
+    return NULL;
+  }
+  g_status = page;
+  return g_status;
+}
+
+bool get_status(struct ksu_status_page *status) {
+  const struct ksu_status_page *page = map_status_page();
+  if (!page) {
+    return false;
+  }
+
+  for (;;) {
+    uint32_t seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      continue;
+    }
+    memcpy(status, page, sizeof(*status));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq) {
+      return true;
+    }
+  }
+}
+
+int get_event_fd(uint32_t mask) {
+  struct ksu_get_event_fd_cmd cmd = {.mask = mask};
+  return ksuctl(KSU_IOCTL_GET_EVENT_FD, &cmd);
+}
+
 static struct ksu_get_info_cmd g_version = {0};
 
 // Reset cached info (call after SuperKey authentication)
@@ -79,12 +137,35 @@ struct ksu_get_info_cmd get_info() {
 }
 
 uint32_t get_version() {
+  struct ksu_status_page status;
+  if (get_status(&status)) {
+    return status.version;
+  }
   auto info = get_info();
   return info.version;
 }
 
 bool get_allow_list(struct ksu_get_allow_list_cmd *cmd) {
+  // indexed by cmd->allow, refetched only when the allowlist changes
+  static struct ksu_get_allow_list_cmd cached[2];
+  static uint32_t cached_gen[2];
+  static bool cached_valid[2];
+  struct ksu_status_page status;
+  bool have_status = get_status(&status);
+  int slot = cmd->allow ? 1 : 0;
+
+  if (have_status && cached_valid[slot] &&
+      cached_gen[slot] == status.allowlist_gen) {
+    *cmd = cached[slot];
+    return true;
+  }
+
   if (ksuctl(KSU_IOCTL_GET_ALLOW_LIST, cmd) == 0) {
+    if (have_status) {
+      cached[slot] = *cmd;
+      cached_gen[slot] = status.allowlist_gen;
+      cached_valid[slot] = true;
+    }
     return true;
   }
 
@@ -101,6 +182,12 @@ bool get_allow_list(struct ksu_get_allow_list_cmd *cmd) {
 }
 
 bool is_safe_mode() {
+  struct ksu_status_page status;
+  // ksud has asked the kernel by then, the flag is final
+  if (get_status(&status) && (status.flags & KSU_STATUS_F_BOOT_COMPLETED)) {
+    return (status.flags & KSU_STATUS_F_SAFE_MODE) != 0;
+  }
+
   struct ksu_check_safemode_cmd cmd = {};
   if (ksuctl(KSU_IOCTL_CHECK_SAFEMODE, &cmd) == 0) {
     return cmd.in_safe_mode;
@@ -110,6 +197,10 @@ bool is_safe_mode() {
 }
 
 bool is_lkm_mode() {
+  struct ksu_status_page status;
+  if (get_status(&status)) {
+    return (status.flags & KSU_STATUS_F_LKM) != 0;
+  }
   auto info = get_info();
   if (info.version > 0) {
     return (info.flags & 0x1) != 0;
@@ -155,6 +246,29 @@ int get_app_profile(struct app_profile *profile) {
   return legacy_get_app_profile(profile->key, profile) ? 0 : -1;
 }
 
+int get_app_profiles(void *buf, uint32_t size, uint32_t uid_min,
+                     uint32_t uid_max) {
+  struct ksu_get_app_profiles_cmd cmd = {};
+  cmd.arg = (uint64_t)(uintptr_t)buf;
+  cmd.buf_size = size;
+  cmd.uid_min = uid_min;
+  cmd.uid_max = uid_max;
+  if (ksuctl(KSU_IOCTL_GET_APP_PROFILES, &cmd) == 0 || errno == ENOSPC) {
+    return (int)cmd.size;
+  }
+  return -1;
+}
+
+int set_app_profiles(const void *buf, uint32_t size) {
+  struct ksu_set_app_profiles_cmd cmd = {};
+  cmd.arg = (uint64_t)(uintptr_t)buf;
+  cmd.buf_size = size;
+  if (ksuctl(KSU_IOCTL_SET_APP_PROFILES, &cmd) == 0) {
+    return (int)cmd.count;
+  }
+  return -errno;
+}
+
 bool set_su_enabled(bool enabled) {
   struct ksu_set_feature_cmd cmd = {};
   cmd.feature_id = KSU_FEATURE_SU_COMPAT;
@@ -165,7 +279,16 @@ bool set_su_enabled(bool enabled) {
   return legacy_set_su_enabled(enabled);
 }
 
+static bool get_feature(uint32_t feature_id, uint64_t *out_value,
+                        bool *out_supported);
+
 bool is_su_enabled() {
+  uint64_t value = 0;
+  bool supported = false;
+  if (get_feature(KSU_FEATURE_SU_COMPAT, &value, &supported) && supported) {
+    return value != 0;
+  }
+
   struct ksu_get_feature_cmd cmd = {};
   cmd.feature_id = KSU_FEATURE_SU_COMPAT;
   if (ksuctl(KSU_IOCTL_GET_FEATURE, &cmd) == 0 && cmd.supported) {
@@ -174,8 +297,18 @@ bool is_su_enabled() {
   return legacy_is_su_enabled();
 }
 
-static inline bool get_feature(uint32_t feature_id, uint64_t *out_value,
-                               bool *out_supported) {
+static bool get_feature(uint32_t feature_id, uint64_t *out_value,
+                        bool *out_supported) {
+  struct ksu_status_page status;
+  if (feature_id < KSU_STATUS_MAX_FEATURES && get_status(&status)) {
+    if (out_value)
+      *out_value = status.features[feature_id];
+    if (out_supported)
+      *out_supported =
+          (status.feature_supported[feature_id / 64] >> (feature_id % 64)) & 1;
+    return true;
+  }
+
   struct ksu_get_feature_cmd cmd = {};
   cmd.feature_id = feature_id;
   if (ksuctl(KSU_IOCTL_GET_FEATURE, &cmd) != 0) {
@@ -254,6 +387,13 @@ void get_full_version(char *buff) {
 }
 
 void get_hook_type(char *buff) {
+  struct ksu_status_page status;
+  if (get_status(&status)) {
+    strncpy(buff, status.hook_type, 32 - 1);
+    buff[32 - 1] = '\0';
+    return;
+  }
+
   struct ksu_hook_type_cmd cmd = {0};
   if (ksuctl(KSU_IOCTL_HOOK_TYPE, &cmd) == 0) {
     strncpy(buff, cmd.hook_type, 32 - 1);
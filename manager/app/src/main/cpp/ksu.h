@@ -159,6 +159,29 @@ struct ksu_set_app_profile_cmd {
   struct app_profile profile; // Input: app profile structure
 };
 
+// Bulk profiles use the kernel's compact block encoding (profile_codec.h)
+struct ksu_get_app_profiles_cmd {
+  uint64_t arg;      // Input: buffer for the encoded profiles
+  uint32_t buf_size; // Input: size of the buffer
+  uint32_t uid_min;  // Input: first uid to return
+  uint32_t uid_max;  // Input: last uid to return
+  uint32_t count;    // Output: number of profiles returned
+  uint32_t size;     // Output: bytes used, or needed if ENOSPC
+};
+
+struct ksu_set_app_profiles_cmd {
+  uint64_t arg;      // Input: buffer with the encoded profiles
+  uint32_t buf_size; // Input: size of the encoded data
+  uint32_t count;    // Output: number of profiles applied
+};
+
+// Returns the encoded size (larger than size if buf is too small), or -1
+int get_app_profiles(void *buf, uint32_t size, uint32_t uid_min,
+                     uint32_t uid_max);
+
+// Returns the number of profiles applied, or -errno
+int set_app_profiles(const void *buf, uint32_t size);
+
 // Su compat
 bool set_su_enabled(bool enabled);
 bool is_su_enabled();
@@ -175,6 +198,57 @@ bool is_enhanced_security_enabled();
 bool set_sulog_enabled(bool enabled);
 bool is_sulog_enabled();
 
+// Read-only page mmap()ed from the driver fd, see kernel/status_page.h
+#define KSU_STATUS_MAGIC 0x5355534b // "KSUS"
+#define KSU_STATUS_MAX_FEATURES 128
+
+#define KSU_STATUS_F_LKM (1 << 0)
+#define KSU_STATUS_F_SAFE_MODE (1 << 1)
+#define KSU_STATUS_F_BOOT_COMPLETED (1 << 2)
+
+struct ksu_status_page {
+  uint32_t magic;
+  uint32_t seq; // odd while the kernel updates the page
+  uint32_t version;
+  uint32_t flags; // KSU_STATUS_F_*
+  uint32_t manager_uid;
+  uint32_t manager_gen;   // changes whenever the manager does
+  uint32_t allowlist_gen; // changes whenever an app profile does
+  uint32_t _reserved;
+  uint64_t su_grants;
+  char hook_type[32];
+  uint64_t feature_supported[KSU_STATUS_MAX_FEATURES / 64];
+  uint64_t features[KSU_STATUS_MAX_FEATURES];
+};
+
+// Copies a consistent snapshot of the status page without a syscall once it
+// is mapped. Returns false on kernels without one.
+bool get_status(struct ksu_status_page *status);
+
+// Change notifications, see kernel/events.h
+enum ksu_event_type {
+  KSU_EVENT_ALLOWLIST = 1, // value: allowlist generation
+  KSU_EVENT_MANAGER,       // arg: manager uid, value: manager generation
+  KSU_EVENT_FEATURE,       // arg: feature id, value: its current value
+  KSU_EVENT_PACKAGES,      // arg: packages changed, 0 if unknown
+  KSU_EVENT_MODULE_MOUNTED,
+  KSU_EVENT_BOOT_COMPLETED,
+};
+
+struct ksu_event {
+  uint32_t type;
+  uint32_t arg;
+  uint64_t value;
+};
+
+struct ksu_get_event_fd_cmd {
+  uint32_t mask; // Input: bit n set: enum ksu_event_type n, 0 for all
+};
+
+// Returns a pollable fd yielding struct ksu_event on read(), or -1. Pending
+// events of one type coalesce into the latest one.
+int get_event_fd(uint32_t mask);
+
 // Other command structures
 struct ksu_get_full_version_cmd {
   char version_full[KSU_FULL_VERSION_STRING]; // Output: full version string
@@ -199,6 +273,9 @@ struct ksu_hook_type_cmd {
 #define KSU_IOCTL_SET_APP_PROFILE _IOC(_IOC_WRITE, 'K', 12, 0)
 #define KSU_IOCTL_GET_FEATURE _IOC(_IOC_READ | _IOC_WRITE, 'K', 13, 0)
 #define KSU_IOCTL_SET_FEATURE _IOC(_IOC_WRITE, 'K', 14, 0)
+#define KSU_IOCTL_GET_APP_PROFILES _IOC(_IOC_READ | _IOC_WRITE, 'K', 19, 0)
+#define KSU_IOCTL_SET_APP_PROFILES _IOC(_IOC_READ | _IOC_WRITE, 'K', 20, 0)
+#define KSU_IOCTL_GET_EVENT_FD _IOC(_IOC_WRITE, 'K', 25, 0)
 
 // Other IOCTL command definitions
 #define KSU_IOCTL_GET_FULL_VERSION _IOC(_IOC_READ, 'K', 100, 0)
@@ -1,15 +1,21 @@
 package com.anatdx.yukisu
 
+import android.os.ParcelFileDescriptor
 import android.os.Parcelable
+import android.util.Log
 import androidx.annotation.Keep
 import androidx.compose.runtime.Immutable
+import com.anatdx.yukisu.profile.ProfileCodec
 import kotlinx.parcelize.Parcelize
+import java.nio.ByteBuffer
 
 /**
  * @author weishu
  * @date 2022/12/8.
  */
 object Natives {
+    private const val TAG = "Natives"
+
     // minimal supported kernel version
     // 10915: allowlist breaking change, add app profile
     // 10931: app profile struct add 'version' field
@@ -84,6 +90,65 @@ object Natives {
     external fun getAppProfile(key: String?, uid: Int): Profile
     external fun setAppProfile(profile: Profile?): Boolean
 
+    /**
+     * Fill the direct buffer with the encoded profiles whose uid is in
+     * [uidMin, uidMax] (unsigned).
+     * @return the encoded size, larger than the capacity if the buffer is too small, or -1.
+     */
+    private external fun getAppProfilesRaw(buf: ByteBuffer, uidMin: Int, uidMax: Int): Int
+
+    /**
+     * Apply the first size bytes of the direct buffer as a batch.
+     * @return the number of profiles applied, or -1.
+     */
+    private external fun setAppProfilesRaw(buf: ByteBuffer, size: Int): Int
+
+    private const val PROFILES_BUFFER_MAX = 4 shl 20
+    private var profilesBufferSize = 64 * 1024
+
+    /**
+     * Get all profiles in one call.
+     * @return null if the kernel doesn't support bulk profiles.
+     */
+    fun getAppProfiles(uidMin: Int = 0, uidMax: Int = -1): List<Profile>? {
+        while (true) {
+            val buf = ByteBuffer.allocateDirect(profilesBufferSize)
+            val size = getAppProfilesRaw(buf, uidMin, uidMax)
+            if (size < 0) return null
+            if (size <= buf.capacity()) return ProfileCodec.decode(buf, size)
+            if (size > PROFILES_BUFFER_MAX) return null
+            profilesBufferSize = size
+        }
+    }
+
+    /**
+     * Set profiles in one call, the kernel persists them with a single flush.
+     * Falls back to one call per profile on older kernels.
+     */
+    fun setAppProfiles(profiles: List<Profile>): Boolean {
+        if (profiles.isEmpty()) return true
+        val buf = runCatching { ProfileCodec.encode(profiles) }.getOrElse { return false }
+        val applied = setAppProfilesRaw(buf, buf.limit())
+        if (applied >= 0) return applied == profiles.size
+        Log.w(TAG, "bulk set of ${profiles.size} profiles failed: $applied, setting one by one")
+        return profiles.all { setAppProfile(it) }
+    }
+
+    // mirrors enum ksu_event_type
+    const val EVENT_ALLOWLIST = 1
+    const val EVENT_MANAGER = 2
+
+    private external fun getEventFd(mask: Int): Int
+
+    /**
+     * Open a pollable fd that yields 16 byte event records of the given types.
+     * @return null if the kernel doesn't support events.
+     */
+    fun openEventFd(vararg types: Int): ParcelFileDescriptor? {
+        val fd = getEventFd(types.fold(0) { mask, type -> mask or (1 shl type) })
+        return if (fd < 0) null else ParcelFileDescriptor.adoptFd(fd)
+    }
+
     /**
      * `su` compat mode can be disabled temporarily.
      *  0: disabled
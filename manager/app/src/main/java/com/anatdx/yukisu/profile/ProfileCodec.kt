@@ -0,0 +1,219 @@
+package com.anatdx.yukisu.profile
+
+import com.anatdx.yukisu.Natives
+import java.io.ByteArrayOutputStream
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * Codec for the kernel's compact profile blocks (kernel/profile_codec.h),
+ * used by the bulk get/set profile ioctls.
+ *
+ * A block is a `len, count, crc` header of little endian u32 followed by a
+ * domain string table and `count` varint encoded records.
+ */
+object ProfileCodec {
+    private const val FLAG_ALLOW_SU = 1 shl 0
+    private const val FLAG_USE_DEFAULT = 1 shl 1
+    private const val FLAG_UMOUNT_MODULES = 1 shl 2
+    private const val FLAG_TEMPLATE = 1 shl 3
+    private const val FLAG_ROOT_PROFILE = 1 shl 4
+
+    private const val BLOCK_HEADER_SIZE = 12
+    private const val BLOCK_RECORDS = 64
+    private const val APP_PROFILE_VERSION = 2
+
+    // KSU_MAX_PACKAGE_NAME and KSU_SELINUX_DOMAIN, both including the NUL
+    private const val MAX_PACKAGE_NAME = 256
+    private const val SELINUX_DOMAIN = 64
+
+    fun decode(buf: ByteBuffer, size: Int): List<Natives.Profile> {
+        val src = buf.duplicate().order(ByteOrder.LITTLE_ENDIAN)
+        src.position(0)
+        src.limit(size)
+        val result = ArrayList<Natives.Profile>()
+
+        while (src.remaining() >= BLOCK_HEADER_SIZE) {
+            val len = src.int
+            val count = src.int
+            src.int // crc, the kernel already checked it
+            if (len < 0 || len > src.remaining()) break
+            val end = src.position() + len
+
+            val domains = List(readVarint(src).toInt()) { readString(src) }
+            repeat(count) {
+                result += readProfile(src, domains)
+            }
+            src.position(end)
+        }
+
+        return result
+    }
+
+    /**
+     * Throws [IllegalArgumentException] if a name, template or domain doesn't
+     * fit the kernel's fixed size fields, the kernel rejects such a buffer.
+     */
+    fun encode(profiles: List<Natives.Profile>): ByteBuffer {
+        val out = ByteArrayOutputStream()
+
+        profiles.chunked(BLOCK_RECORDS).forEach { block ->
+            val payload = ByteArrayOutputStream()
+            val domains = block.filter { hasRootProfile(it) }.map { it.context }.distinct()
+
+            writeVarint(payload, domains.size.toLong())
+            domains.forEach { writeString(payload, it, SELINUX_DOMAIN) }
+            block.forEach { writeProfile(payload, it, domains) }
+
+            val bytes = payload.toByteArray()
+            val header = ByteBuffer.allocate(BLOCK_HEADER_SIZE).order(ByteOrder.LITTLE_ENDIAN)
+            header.putInt(bytes.size)
+            header.putInt(block.size)
+            header.putInt(crc32(bytes))
+            out.write(header.array())
+            out.write(bytes)
+        }
+
+        val bytes = out.toByteArray()
+        return ByteBuffer.allocateDirect(bytes.size).apply {
+            put(bytes)
+            flip()
+        }
+    }
+
+    // use_default grants carry their root profile too, like a single set does
+    private fun hasRootProfile(profile: Natives.Profile) = profile.allowSu
+
+    private fun readProfile(src: ByteBuffer, domains: List<String>): Natives.Profile {
+        readVarint(src) // version
+        val currentUid = readVarint(src).toInt()
+        val name = readString(src)
+        val flags = src.get().toInt() and 0xff
+        val allowSu = flags and FLAG_ALLOW_SU != 0
+        val template = if (flags and FLAG_TEMPLATE != 0) readString(src) else null
+
+        if (!allowSu) {
+            return Natives.Profile(
+                name = name,
+                currentUid = currentUid,
+                allowSu = false,
+                nonRootUseDefault = flags and FLAG_USE_DEFAULT != 0,
+                umountModules = flags and FLAG_UMOUNT_MODULES != 0,
+            )
+        }
+
+        // kernels before every grant carried its root profile
+        if (flags and FLAG_ROOT_PROFILE == 0) {
+            return Natives.Profile(
+                name = name,
+                currentUid = currentUid,
+                allowSu = true,
+                rootUseDefault = flags and FLAG_USE_DEFAULT != 0,
+                rootTemplate = template,
+            )
+        }
+
+        val uid = readVarint(src).toInt()
+        val gid = readVarint(src).toInt()
+        val groups = List(readVarint(src).toInt()) { readVarint(src).toInt() }
+        val effective = readVarint(src)
+        readVarint(src) // permitted
+        readVarint(src) // inheritable
+        val context = domains[readVarint(src).toInt()]
+        val namespace = readVarint(src).toInt()
+
+        return Natives.Profile(
+            name = name,
+            currentUid = currentUid,
+            allowSu = true,
+            rootUseDefault = flags and FLAG_USE_DEFAULT != 0,
+            rootTemplate = template,
+            uid = uid,
+            gid = gid,
+            groups = groups,
+            capabilities = (0 until 64).filter { effective and (1L shl it) != 0L },
+            context = context,
+            namespace = namespace,
+        )
+    }
+
+    private fun writeProfile(
+        out: ByteArrayOutputStream,
+        profile: Natives.Profile,
+        domains: List<String>
+    ) {
+        var flags = 0
+        if (profile.allowSu) {
+            flags = flags or FLAG_ALLOW_SU or FLAG_ROOT_PROFILE
+            if (profile.rootUseDefault) flags = flags or FLAG_USE_DEFAULT
+            if (!profile.rootTemplate.isNullOrEmpty()) flags = flags or FLAG_TEMPLATE
+        } else {
+            if (profile.nonRootUseDefault) flags = flags or FLAG_USE_DEFAULT
+            if (profile.umountModules) flags = flags or FLAG_UMOUNT_MODULES
+        }
+
+        writeVarint(out, APP_PROFILE_VERSION.toLong())
+        writeVarint(out, profile.currentUid.toLong() and 0xffffffffL)
+        writeString(out, profile.name, MAX_PACKAGE_NAME)
+        out.write(flags)
+        if (flags and FLAG_TEMPLATE != 0) writeString(out, profile.rootTemplate!!, MAX_PACKAGE_NAME)
+        if (flags and FLAG_ROOT_PROFILE == 0) return
+
+        val effective = profile.capabilities.fold(0L) { bits, cap -> bits or (1L shl cap) }
+        writeVarint(out, profile.uid.toLong() and 0xffffffffL)
+        writeVarint(out, profile.gid.toLong() and 0xffffffffL)
+        writeVarint(out, profile.groups.size.toLong())
+        profile.groups.forEach { writeVarint(out, it.toLong() and 0xffffffffL) }
+        writeVarint(out, effective)
+        writeVarint(out, 0) // permitted
+        writeVarint(out, 0) // inheritable
+        writeVarint(out, domains.indexOf(profile.context).toLong())
+        writeVarint(out, profile.namespace.toLong() and 0xffffffffL)
+    }
+
+    private fun readVarint(src: ByteBuffer): Long {
+        var value = 0L
+        var shift = 0
+        while (true) {
+            val b = src.get().toInt() and 0xff
+            value = value or ((b and 0x7f).toLong() shl shift)
+            if (b and 0x80 == 0) return value
+            shift += 7
+        }
+    }
+
+    private fun writeVarint(out: ByteArrayOutputStream, v: Long) {
+        var value = v
+        do {
+            var b = (value and 0x7f).toInt()
+            value = value ushr 7
+            if (value != 0L) b = b or 0x80
+            out.write(b)
+        } while (value != 0L)
+    }
+
+    private fun readString(src: ByteBuffer): String {
+        val bytes = ByteArray(readVarint(src).toInt())
+        src.get(bytes)
+        return String(bytes, Charsets.UTF_8)
+    }
+
+    private fun writeString(out: ByteArrayOutputStream, s: String, max: Int) {
+        val bytes = s.toByteArray(Charsets.UTF_8)
+        require(bytes.size < max) { "'$s' is longer than ${max - 1} bytes" }
+        writeVarint(out, bytes.size.toLong())
+        out.write(bytes)
+    }
+
+    // crc32_le with a zero seed and no final xor, matching the kernel's crc32()
+    private fun crc32(bytes: ByteArray): Int {
+        var crc = 0
+        for (b in bytes) {
+            crc = crc xor (b.toInt() and 0xff)
+            repeat(8) {
+                crc = (crc ushr 1) xor (0xEDB88320.toInt() and -(crc and 1))
+            }
+        }
+        return crc
+    }
+}
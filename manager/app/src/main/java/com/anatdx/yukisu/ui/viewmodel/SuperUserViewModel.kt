@@ -5,19 +5,27 @@ import android.content.pm.ApplicationInfo
 import android.content.pm.PackageInfo
 import android.graphics.drawable.Drawable
 import android.os.IBinder
+import android.os.Looper
+import android.os.MessageQueue.OnFileDescriptorEventListener.EVENT_ERROR
+import android.os.MessageQueue.OnFileDescriptorEventListener.EVENT_INPUT
 import android.os.Parcelable
+import android.system.ErrnoException
+import android.system.Os
 import android.util.Log
 import androidx.compose.runtime.*
 import androidx.core.content.edit
 import androidx.lifecycle.ViewModel
+import androidx.lifecycle.viewModelScope
 import com.anatdx.yukisu.Natives
 import com.anatdx.yukisu.ksuApp
 import com.anatdx.yukisu.ui.KsuService
 import com.anatdx.yukisu.ui.util.*
 import com.topjohnwu.superuser.Shell
 import kotlinx.coroutines.*
+import kotlinx.coroutines.channels.Channel
 import kotlinx.coroutines.sync.Mutex
 import kotlinx.coroutines.sync.withLock
+import java.io.FileDescriptor
 import java.text.Collator
 import java.util.*
 import java.util.concurrent.LinkedBlockingQueue
@@ -81,6 +89,7 @@ class SuperUserViewModel : ViewModel() {
         private const val MAX_POOL_SIZE = 16
         private const val KEEP_ALIVE_TIME = 60L
         private const val BATCH_SIZE = 20
+        private const val EVENT_RECORD_SIZE = 16
     }
 
     @Immutable
@@ -129,6 +138,24 @@ class SuperUserViewModel : ViewModel() {
     private val configChangeListeners = mutableSetOf<(String) -> Unit>()
     private val prefs = ksuApp.getSharedPreferences(PREFS_NAME, Context.MODE_PRIVATE)
 
+    // grants changed by su, ksud or another manager instance are picked up
+    // from the kernel event fd instead of waiting for the next manual refresh
+    private val kernelEvents = Channel<Unit>(Channel.CONFLATED)
+    private val eventFd = Natives.openEventFd(Natives.EVENT_ALLOWLIST, Natives.EVENT_MANAGER)
+
+    init {
+        eventFd?.let { pfd ->
+            Looper.getMainLooper().queue.addOnFileDescriptorEventListener(
+                pfd.fileDescriptor, EVENT_INPUT or EVENT_ERROR
+            ) { fd, events -> onKernelEvent(fd, events) }
+            viewModelScope.launch {
+                for (event in kernelEvents) {
+                    if (_isAppListLoaded.value) refreshAppConfigurations()
+                }
+            }
+        }
+    }
+
     var search by mutableStateOf("")
     var showSystemApps by mutableStateOf(prefs.getBoolean(KEY_SHOW_SYSTEM_APPS, false))
         private set
@@ -197,18 +224,22 @@ class SuperUserViewModel : ViewModel() {
     }
 
     suspend fun updateBatchPermissions(allowSu: Boolean, umountModules: Boolean? = null) {
-        selectedApps.forEach { packageName ->
+        val snapshot = loadProfileSnapshot()
+        val updates = selectedApps.mapNotNull { packageName ->
             apps.find { it.packageName == packageName }?.let { app ->
-                val profile = Natives.getAppProfile(packageName, app.uid)
-                val updatedProfile = profile.copy(
+                val profile = snapshot.profileOf(packageName, app.uid)
+                packageName to profile.copy(
                     allowSu = allowSu,
                     umountModules = umountModules ?: profile.umountModules,
                     nonRootUseDefault = false
                 )
-                if (Natives.setAppProfile(updatedProfile)) {
-                    updateAppProfileLocally(packageName, updatedProfile)
-                    notifyConfigChange(packageName)
-                }
+            }
+        }
+        // one supercall and one persistence flush for the whole selection
+        if (Natives.setAppProfiles(updates.map { it.second })) {
+            updates.forEach { (packageName, updatedProfile) ->
+                updateAppProfileLocally(packageName, updatedProfile)
+                notifyConfigChange(packageName)
             }
         }
         clearSelection()
@@ -249,11 +280,12 @@ class SuperUserViewModel : ViewModel() {
                 val batches = currentApps.chunked(BATCH_SIZE)
                 loadingProgress = 0f
 
+                val snapshot = loadProfileSnapshot()
                 val updatedApps = batches.mapIndexed { batchIndex, batch ->
                     async {
                         val batchResult = batch.map { app ->
                             try {
-                                val updatedProfile = Natives.getAppProfile(app.packageName, app.uid)
+                                val updatedProfile = snapshot.profileOf(app.packageName, app.uid)
                                 app.copy(profile = updatedProfile)
                             } catch (e: Exception) {
                                 Log.e(TAG, "Error refreshing profile for ${app.packageName}", e)
@@ -265,7 +297,10 @@ class SuperUserViewModel : ViewModel() {
                     }
                 }.awaitAll().flatten()
 
-                appListMutex.withLock { apps = updatedApps }
+                appListMutex.withLock {
+                    apps = updatedApps
+                    appGroups = groupAppsByUid(updatedApps, snapshot)
+                }
                 loadingProgress = 1f
             }
         }
@@ -321,6 +356,7 @@ class SuperUserViewModel : ViewModel() {
             val total = allPackages.packageCount
             val pageSize = 100
             val result = mutableListOf<AppInfo>()
+            val snapshot = loadProfileSnapshot()
 
             var start = 0
             while (start < total) {
@@ -332,7 +368,7 @@ class SuperUserViewModel : ViewModel() {
                         AppInfo(
                             label = appInfo.loadLabel(pm).toString(),
                             packageInfo = packageInfo,
-                            profile = Natives.getAppProfile(packageInfo.packageName, appInfo.uid)
+                            profile = snapshot.profileOf(packageInfo.packageName, appInfo.uid)
                         )
                     }
                 }
@@ -349,7 +385,7 @@ class SuperUserViewModel : ViewModel() {
             appListMutex.withLock {
                 val filteredApps = result.filter { it.packageName != ksuApp.packageName }
                 apps = filteredApps
-                appGroups = groupAppsByUid(filteredApps)
+                appGroups = groupAppsByUid(filteredApps, snapshot)
             }
             loadingProgress = 1f
         }
@@ -369,11 +405,29 @@ class SuperUserViewModel : ViewModel() {
         }
     }
 
-    private fun groupAppsByUid(appList: List<AppInfo>): List<AppGroup> {
+    /**
+     * Profiles fetched with one bulk supercall, falls back to per-app
+     * lookups on kernels without it.
+     */
+    private class ProfileSnapshot(private val profiles: Map<Int, Natives.Profile>?) {
+        fun profileOf(packageName: String, uid: Int): Natives.Profile =
+            if (profiles == null) Natives.getAppProfile(packageName, uid)
+            else profiles[uid] ?: Natives.Profile(packageName, uid)
+    }
+
+    private fun loadProfileSnapshot() = ProfileSnapshot(
+        Natives.getAppProfiles()?.let { list ->
+            HashMap<Int, Natives.Profile>().apply {
+                list.forEach { putIfAbsent(it.currentUid, it) }
+            }
+        }
+    )
+
+    private fun groupAppsByUid(appList: List<AppInfo>, snapshot: ProfileSnapshot): List<AppGroup> {
     return appList.groupBy { it.uid }
         .map { (uid, apps) ->
             val sortedApps = apps.sortedBy { it.label }
-            val profile = apps.firstOrNull()?.let { Natives.getAppProfile(it.packageName, uid) }
+            val profile = apps.firstOrNull()?.let { snapshot.profileOf(it.packageName, uid) }
             AppGroup(uid = uid, apps = sortedApps, profile = profile)
         }
         .sortedWith(
@@ -388,8 +442,27 @@ class SuperUserViewModel : ViewModel() {
             }.thenBy(Collator.getInstance(Locale.getDefault())) { it.mainApp.label }
         )
 }
+    private fun onKernelEvent(fd: FileDescriptor, events: Int): Int {
+        if (events and EVENT_ERROR != 0) return 0
+        // pending events are coalesced per type, one read drains them all
+        val records = ByteArray(EVENT_RECORD_SIZE * 8)
+        try {
+            if (Os.read(fd, records, 0, records.size) >= EVENT_RECORD_SIZE) {
+                kernelEvents.trySend(Unit)
+            }
+        } catch (e: ErrnoException) {
+            Log.w(TAG, "Failed to read kernel events", e)
+        }
+        return EVENT_INPUT or EVENT_ERROR
+    }
+
     override fun onCleared() {
         super.onCleared()
+        eventFd?.let { pfd ->
+            Looper.getMainLooper().queue.removeOnFileDescriptorEventListener(pfd.fileDescriptor)
+            pfd.close()
+        }
+        kernelEvents.close()
         try {
             stopKsuService()
             appProcessingThreadPool.close()
@@ -269,6 +269,11 @@ static int cmd_debug(const std::vector<std::string>& args) {
         printf("  su [-g]            Root shell\n");
         printf("  version            Get kernel version\n");
         printf("  mark <get|mark|unmark|refresh> [PID]\n");
+        printf("  stats [--reset]    Show hook statistics\n");
+        printf("  stats <enable|disable>\n");
+        printf("  sulog [--backlog]  Follow the su log live\n");
+        printf("  sulog-filter [KEY=VALUE...]\n");
+        printf("  events             Follow kernel state changes live\n");
         return 1;
     }
 
@@ -287,6 +292,14 @@ static int cmd_debug(const std::vector<std::string>& args) {
         return grant_root_shell(global_mnt);
     } else if (subcmd == "mark" && args.size() > 1) {
         return debug_mark(std::vector<std::string>(args.begin() + 1, args.end()));
+    } else if (subcmd == "stats") {
+        return debug_stats(std::vector<std::string>(args.begin() + 1, args.end()));
+    } else if (subcmd == "sulog") {
+        return debug_sulog(std::vector<std::string>(args.begin() + 1, args.end()));
+    } else if (subcmd == "sulog-filter") {
+        return debug_sulog_filter(std::vector<std::string>(args.begin() + 1, args.end()));
+    } else if (subcmd == "events") {
+        return debug_events(std::vector<std::string>(args.begin() + 1, args.end()));
     }
 
     printf("Unknown debug subcommand: %s\n", subcmd.c_str());
@@ -27,6 +27,10 @@ static const std::map<std::string, uint32_t> FEATURE_MAP = {
     {"kernel_umount", static_cast<uint32_t>(FeatureId::KernelUmount)},
     {"enhanced_security", static_cast<uint32_t>(FeatureId::EnhancedSecurity)},
     {"sulog", static_cast<uint32_t>(FeatureId::SuLog)},
+    {"hook_stats", static_cast<uint32_t>(FeatureId::HookStats)},
+    {"sulog_fsync_interval", static_cast<uint32_t>(FeatureId::SulogFsyncInterval)},
+    {"throne_debounce", static_cast<uint32_t>(FeatureId::ThroneDebounce)},
+    {"throne_max_delay", static_cast<uint32_t>(FeatureId::ThroneMaxDelay)},
 };
 
 static const std::map<uint32_t, const char*> FEATURE_DESCRIPTIONS = {
@@ -38,6 +42,14 @@ static const std::map<uint32_t, const char*> FEATURE_DESCRIPTIONS = {
      "Enhanced Security - disable non-KSU root elevation and unauthorized UID downgrades"},
     {static_cast<uint32_t>(FeatureId::SuLog),
      "SU Log - enables logging of SU command usage to kernel log for auditing purposes"},
+    {static_cast<uint32_t>(FeatureId::HookStats),
+     "Hook Stats - collects per-hook call counts and latency histograms, see 'ksud debug stats'"},
+    {static_cast<uint32_t>(FeatureId::SulogFsyncInterval),
+     "SU Log fsync interval - seconds between fsyncs of the SU log, 0 syncs every batch"},
+    {static_cast<uint32_t>(FeatureId::ThroneDebounce),
+     "Throne debounce - ms of quiet after a packages.list change before the manager rescan"},
+    {static_cast<uint32_t>(FeatureId::ThroneMaxDelay),
+     "Throne max delay - ms a packages.list change may wait for its manager rescan at most"},
 };
 
 // Returns {feature_id, valid}. Use pair because SuCompat ID is 0
@@ -298,9 +310,19 @@ int save_binary_config(const std::map<uint32_t, uint64_t>& features) {
 void apply_config(const std::map<uint32_t, uint64_t>& features) {
     LOGI("Applying feature configuration to kernel...");
 
+    KsuBatch batch;
+    for (const auto& [id, value] : features) {
+        batch.add(KSU_IOCTL_SET_FEATURE, SetFeatureCmd{id, value});
+    }
+    if (batch.flush() < 0) {
+        LOGW("Failed to submit feature configuration");
+        return;
+    }
+
     int applied = 0;
+    size_t i = 0;
     for (const auto& [id, value] : features) {
-        int ret = set_feature(id, value);
+        int ret = batch.result(i++);
         if (ret >= 0) {
             LOGI("Set feature %s to %" PRIu64, feature_id_to_name(id), value);
             applied++;
@@ -8,6 +8,8 @@
 #include <sys/prctl.h>
 #include <sys/syscall.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
 
 namespace ksud {
@@ -113,6 +115,80 @@ int ksuctl(int request, void* arg) {
     return ret;
 }
 
+// Cleared once the kernel turns out not to know KSU_IOCTL_BATCH
+static bool g_batch_supported = true;
+
+size_t KsuBatch::add(uint32_t cmd, const void* arg, size_t size) {
+    Call call{cmd, 0, nullptr};
+    if (arg) {
+        call.arg = std::make_unique<uint64_t[]>((size + 7) / 8);
+        memcpy(call.arg.get(), arg, size);
+    }
+    calls_.push_back(std::move(call));
+    return calls_.size() - 1;
+}
+
+int KsuBatch::flush() {
+    int fd = get_driver_fd();
+    if (fd < 0) {
+        return -1;
+    }
+
+    int failed = 0;
+    while (flushed_ < calls_.size()) {
+        size_t count = std::min(calls_.size() - flushed_, KSU_BATCH_MAX);
+
+        if (stopped_) {
+            for (size_t i = flushed_; i < flushed_ + count; i++) {
+                calls_[i].result = -ECANCELED;
+            }
+        } else if (g_batch_supported) {
+            std::vector<BatchEntry> entries(count);
+            for (size_t i = 0; i < count; i++) {
+                entries[i].cmd = calls_[flushed_ + i].cmd;
+                entries[i].arg = reinterpret_cast<uint64_t>(calls_[flushed_ + i].arg.get());
+            }
+
+            BatchCmd cmd = {reinterpret_cast<uint64_t>(entries.data()),
+                            static_cast<uint32_t>(count),
+                            stop_on_error_ ? KSU_BATCH_STOP_ON_ERROR : 0, 0};
+            if (ioctl(fd, KSU_IOCTL_BATCH, &cmd) < 0) {
+                if (errno != ENOTTY) {
+                    LOGE("batch ioctl failed: errno=%d (%s)", errno, strerror(errno));
+                    return -1;
+                }
+                LOGD("Kernel has no batch ioctl, issuing calls one by one");
+                g_batch_supported = false;
+                continue;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                calls_[flushed_ + i].result = i < cmd.done ? entries[i].result : -ECANCELED;
+            }
+            stopped_ = cmd.done < count;
+        } else {
+            for (size_t i = flushed_; i < flushed_ + count; i++) {
+                if (stopped_) {
+                    calls_[i].result = -ECANCELED;
+                    continue;
+                }
+                int ret = ioctl(fd, calls_[i].cmd, calls_[i].arg.get());
+                calls_[i].result = ret < 0 ? -errno : ret;
+                stopped_ = stop_on_error_ && ret < 0;
+            }
+        }
+
+        for (size_t i = flushed_; i < flushed_ + count; i++) {
+            if (calls_[i].result < 0) {
+                failed++;
+            }
+        }
+        flushed_ += count;
+    }
+
+    return failed;
+}
+
 static const GetInfoCmd& get_info() {
     if (!g_info_cached) {
         GetInfoCmd cmd = {0, 0};
@@ -236,4 +312,116 @@ std::optional<std::string> umount_list_list() {
     return std::string(buffer);
 }
 
+static int umount_bulk(uint8_t mode, std::string& buf, uint32_t* done) {
+    int fd = get_driver_fd();
+    if (fd < 0) {
+        return -ENODEV;
+    }
+
+    UmountBulkCmd bulk = {reinterpret_cast<uint64_t>(buf.data()),
+                          static_cast<uint32_t>(buf.size()), 0};
+    AddTryUmountCmd cmd = {reinterpret_cast<uint64_t>(&bulk), 0, mode};
+    // errno tells old kernels apart, so don't go through ksuctl()'s logging
+    int ret = ioctl(fd, KSU_IOCTL_ADD_TRY_UMOUNT, &cmd) < 0 ? -errno : 0;
+    *done = bulk.done;
+    return ret;
+}
+
+static int umount_list_bulk(uint8_t mode, const std::vector<UmountEntry>& entries) {
+    std::string buf;
+    for (const auto& entry : entries) {
+        buf.append(reinterpret_cast<const char*>(&entry.flags), sizeof(entry.flags));
+        buf.append(entry.path.c_str(), entry.path.size() + 1);
+    }
+    if (buf.size() > KSU_UMOUNT_BULK_MAX) {
+        return -E2BIG;
+    }
+
+    uint32_t done = 0;
+    int ret = umount_bulk(mode, buf, &done);
+    return ret < 0 ? ret : static_cast<int>(done);
+}
+
+int umount_list_add_bulk(const std::vector<UmountEntry>& entries) {
+    return umount_list_bulk(UMOUNT_ADD_BULK, entries);
+}
+
+std::optional<std::vector<UmountEntry>> umount_list_entries() {
+    std::string buf;
+    uint32_t needed = 0;
+    int ret;
+
+    // the empty buffer probes the size, the list may grow between calls
+    while ((ret = umount_bulk(UMOUNT_GET_BULK, buf, &needed)) == -ENOSPC &&
+           needed <= KSU_UMOUNT_BULK_MAX) {
+        buf.resize(needed);
+    }
+    if (ret < 0) {
+        return std::nullopt;
+    }
+
+    std::vector<UmountEntry> entries;
+    size_t pos = 0;
+    while (pos + sizeof(uint32_t) < needed) {
+        UmountEntry entry;
+        memcpy(&entry.flags, buf.data() + pos, sizeof(entry.flags));
+        pos += sizeof(entry.flags);
+        entry.path = buf.c_str() + pos;
+        pos += entry.path.size() + 1;
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+
+std::optional<HookStats> get_hook_stats(bool reset) {
+    // comfortably above the number of hook slots in the kernel
+    constexpr uint32_t MAX_ENTRIES = 128;
+    HookStats stats;
+    stats.entries.resize(MAX_ENTRIES);
+
+    GetStatsCmd cmd = {};
+    cmd.arg = reinterpret_cast<uint64_t>(stats.entries.data());
+    cmd.max_entries = MAX_ENTRIES;
+    cmd.flags = reset ? KSU_GET_STATS_FLAG_RESET : 0;
+    if (ksuctl(KSU_IOCTL_GET_STATS, &cmd) < 0) {
+        return std::nullopt;
+    }
+
+    stats.enabled = cmd.enabled != 0;
+    stats.prefilter_checked = cmd.prefilter_checked;
+    stats.prefilter_skipped = cmd.prefilter_skipped;
+    stats.umount_plans = cmd.umount_plans;
+    stats.umount_plan_size = cmd.umount_plan_size;
+    stats.umount_plan_build_ns = cmd.umount_plan_build_ns;
+    stats.umount_plan_hits = cmd.umount_plan_hits;
+    stats.umount_plan_skipped = cmd.umount_plan_skipped;
+    stats.entries.resize(cmd.count);
+    return stats;
+}
+
+int get_sulog_fd(bool backlog) {
+    GetSulogFdCmd cmd = {backlog ? KSU_SULOG_STREAM_BACKLOG : 0};
+    return ksuctl(KSU_IOCTL_GET_SULOG_FD, &cmd);
+}
+
+int get_event_fd(uint32_t mask) {
+    GetEventFdCmd cmd = {mask};
+    return ksuctl(KSU_IOCTL_GET_EVENT_FD, &cmd);
+}
+
+std::optional<SulogFilterCmd> get_sulog_filter() {
+    SulogFilterCmd cmd = {};
+    cmd.op = KSU_SULOG_FILTER_GET;
+    if (ksuctl(KSU_IOCTL_SULOG_FILTER, &cmd) < 0) {
+        return std::nullopt;
+    }
+    return cmd;
+}
+
+int set_sulog_filter(const SulogFilterCmd& filter) {
+    SulogFilterCmd cmd = filter;
+    cmd.op = KSU_SULOG_FILTER_SET;
+    return ksuctl(KSU_IOCTL_SULOG_FILTER, &cmd);
+}
+
 }  // namespace ksud
@@ -1,9 +1,12 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace ksud {
 
@@ -30,6 +33,11 @@ constexpr uint32_t KSU_IOCTL_GET_WRAPPER_FD = _IOW(K, 15, uint64_t);
 constexpr uint32_t KSU_IOCTL_MANAGE_MARK = _IOWR(K, 16, uint64_t);
 constexpr uint32_t KSU_IOCTL_NUKE_EXT4_SYSFS = _IOW(K, 17, uint64_t);
 constexpr uint32_t KSU_IOCTL_ADD_TRY_UMOUNT = _IOW(K, 18, uint64_t);
+constexpr uint32_t KSU_IOCTL_GET_STATS = _IOWR(K, 21, uint64_t);
+constexpr uint32_t KSU_IOCTL_GET_SULOG_FD = _IOW(K, 22, uint64_t);
+constexpr uint32_t KSU_IOCTL_SULOG_FILTER = _IOWR(K, 23, uint64_t);
+constexpr uint32_t KSU_IOCTL_BATCH = _IOWR(K, 24, uint64_t);
+constexpr uint32_t KSU_IOCTL_GET_EVENT_FD = _IOW(K, 25, uint64_t);
 constexpr uint32_t KSU_IOCTL_LIST_TRY_UMOUNT = _IOWR(K, 200, uint64_t);
 
 // Structures for ioctl - use natural C alignment (matching kernel and Rust repr(C))
@@ -91,6 +99,179 @@ struct ListTryUmountCmd {
     uint32_t buf_size;
 };
 
+// Packed records of a uint32_t flags and a NUL terminated path, unaligned
+struct UmountBulkCmd {
+    uint64_t buf;
+    uint32_t size;
+    uint32_t done;  // entries added or removed, bytes needed for UMOUNT_GET_BULK
+};
+
+constexpr size_t KSU_UMOUNT_BULK_MAX = 64 * 1024;
+
+struct UmountEntry {
+    std::string path;
+    uint32_t flags;
+};
+
+constexpr size_t HOOK_STAT_HIST_BUCKETS = 32;
+constexpr uint32_t KSU_GET_STATS_FLAG_RESET = 1 << 0;
+
+struct HookStatEntry {
+    char name[32];
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t hist[HOOK_STAT_HIST_BUCKETS];  // bucket n: [2^(n-1), 2^n) ns
+};
+
+struct GetStatsCmd {
+    uint64_t arg;
+    uint32_t max_entries;
+    uint32_t flags;
+    uint32_t count;
+    uint32_t enabled;
+    uint64_t prefilter_checked;
+    uint64_t prefilter_skipped;
+    uint32_t umount_plans;
+    uint32_t umount_plan_size;
+    uint64_t umount_plan_build_ns;
+    uint64_t umount_plan_hits;
+    uint64_t umount_plan_skipped;
+};
+
+struct HookStats {
+    bool enabled;
+    uint64_t prefilter_checked;
+    uint64_t prefilter_skipped;
+    uint32_t umount_plans;
+    uint32_t umount_plan_size;
+    uint64_t umount_plan_build_ns;
+    uint64_t umount_plan_hits;
+    uint64_t umount_plan_skipped;
+    std::vector<HookStatEntry> entries;
+};
+
+constexpr uint32_t KSU_SULOG_STREAM_BACKLOG = 1 << 0;
+
+struct GetSulogFdCmd {
+    uint32_t flags;
+};
+
+// Matches struct sulog_record in kernel/sulog.h
+enum class SulogEvent : uint8_t {
+    SuGrant = 0,
+    SuAttempt = 1,
+    PermCheck = 2,
+    ManagerOp = 3,
+    Syscall = 4,
+    Dropped = 5,
+};
+
+struct SulogRecord {
+    uint64_t ts_ns;
+    uint32_t uid;
+    uint32_t pid;
+    uint32_t target_uid;  // number of lost records for SulogEvent::Dropped
+    uint8_t type;
+    uint8_t result;
+    uint16_t count;  // repeats folded into this record in aggregate mode
+    char comm[48];
+    char name[24];
+    char arg[32];
+};
+static_assert(sizeof(SulogRecord) == 128, "SulogRecord must match the kernel");
+
+// Matches struct ksu_event in kernel/events.h
+enum class KsuEventType : uint32_t {
+    Allowlist = 1,  // value: allowlist generation
+    Manager = 2,    // arg: manager uid, value: manager generation
+    Feature = 3,    // arg: feature id, value: its current value
+    Packages = 4,   // arg: packages changed, 0 if unknown
+    ModuleMounted = 5,
+    BootCompleted = 6,
+};
+
+struct KsuEvent {
+    uint32_t type;
+    uint32_t arg;
+    uint64_t value;
+};
+static_assert(sizeof(KsuEvent) == 16, "KsuEvent must match the kernel");
+
+struct GetEventFdCmd {
+    uint32_t mask;  // bit n set: KsuEventType n, 0 for all
+};
+
+constexpr uint32_t KSU_SULOG_FILTER_GET = 0;
+constexpr uint32_t KSU_SULOG_FILTER_SET = 1;
+constexpr uint32_t KSU_SULOG_FILTER_AGGREGATE = 1 << 0;
+constexpr size_t KSU_SULOG_FILTER_MAX_UIDS = 16;
+
+struct SulogFilterCmd {
+    uint32_t op;
+    uint32_t flags;
+    uint32_t type_mask;  // bit n set: log SulogEvent n
+    uint32_t uid_count;
+    uint32_t uids[KSU_SULOG_FILTER_MAX_UIDS];  // never logged
+    uint64_t ioctl_mask[4];                    // bit n set: don't audit supercall nr n
+};
+
+constexpr uint32_t KSU_BATCH_STOP_ON_ERROR = 1 << 0;
+constexpr size_t KSU_BATCH_MAX = 256;
+
+struct BatchEntry {
+    uint32_t cmd;
+    int32_t result;
+    uint64_t arg;
+};
+
+struct BatchCmd {
+    uint64_t entries;
+    uint32_t count;
+    uint32_t flags;
+    uint32_t done;
+};
+
+// Queues supercalls and submits them with KSU_IOCTL_BATCH, falling back to
+// one ioctl per call on kernels without it. Arguments are copied when
+// queued, but whatever they point to has to stay valid until flush().
+class KsuBatch {
+public:
+    explicit KsuBatch(bool stop_on_error = false) : stop_on_error_(stop_on_error) {}
+
+    // Returns the index of the call, for result() and arg()
+    template <typename T>
+    size_t add(uint32_t cmd, const T& arg) {
+        static_assert(std::is_trivially_copyable_v<T>, "ioctl args are plain structs");
+        return add(cmd, &arg, sizeof(T));
+    }
+    size_t add(uint32_t cmd, const void* arg, size_t size);
+
+    // Returns how many calls failed, or -1 if the batch couldn't be submitted
+    int flush();
+
+    size_t size() const { return calls_.size(); }
+    // What call i returned, -errno if it failed or -ECANCELED if it was
+    // skipped after an earlier failure
+    int result(size_t i) const { return calls_[i].result; }
+    // Argument of call i as the kernel left it
+    template <typename T>
+    const T& arg(size_t i) const {
+        return *reinterpret_cast<const T*>(calls_[i].arg.get());
+    }
+
+private:
+    struct Call {
+        uint32_t cmd;
+        int result;
+        std::unique_ptr<uint64_t[]> arg;  // 8 byte aligned like the kernel structs
+    };
+
+    std::vector<Call> calls_;
+    size_t flushed_ = 0;
+    bool stop_on_error_;
+    bool stopped_ = false;
+};
+
 // API functions
 int ksuctl(int request, void* arg);
 
@@ -126,4 +307,23 @@ int umount_list_add(const std::string& path, uint32_t flags);
 int umount_list_del(const std::string& path);
 std::optional<std::string> umount_list_list();
 
+// Bulk variants, one ioctl for the whole list. The add returns the number of
+// entries added, or -errno; -EINVAL means the kernel predates it.
+int umount_list_add_bulk(const std::vector<UmountEntry>& entries);
+std::optional<std::vector<UmountEntry>> umount_list_entries();
+
+// Hook statistics, optionally resetting them after the read
+std::optional<HookStats> get_hook_stats(bool reset);
+
+// Returns an fd streaming SulogRecord on read(), starting with the records
+// still buffered in the kernel if backlog is set
+int get_sulog_fd(bool backlog);
+
+std::optional<SulogFilterCmd> get_sulog_filter();
+int set_sulog_filter(const SulogFilterCmd& filter);
+
+// Returns an fd yielding KsuEvent on read() and pollable for them. Pending
+// events of one type coalesce, so read() only reports the latest state.
+int get_event_fd(uint32_t mask);
+
 }  // namespace ksud
@@ -1,13 +1,17 @@
 #include "debug.hpp"
 #include "boot/apk_sign.hpp"
 #include "core/ksucalls.hpp"
+#include "defs.hpp"
 #include "log.hpp"
 #include "utils.hpp"
 
 #include <sys/stat.h>
+#include <unistd.h>
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
 #include <filesystem>
 #include <fstream>
 
@@ -140,4 +144,317 @@ int debug_mark(const std::vector<std::string>& args) {
     return 1;
 }
 
+// Upper bound in ns of the histogram bucket holding the given percentile
+static uint64_t hist_percentile(const HookStatEntry& e, uint64_t percent) {
+    uint64_t target = (e.count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HOOK_STAT_HIST_BUCKETS; i++) {
+        seen += e.hist[i];
+        if (seen >= target) {
+            return 1ULL << i;
+        }
+    }
+    return 1ULL << (HOOK_STAT_HIST_BUCKETS - 1);
+}
+
+int debug_stats(const std::vector<std::string>& args) {
+    bool reset = false;
+
+    for (const auto& arg : args) {
+        if (arg == "--reset") {
+            reset = true;
+        } else if (arg == "enable" || arg == "disable") {
+            uint64_t value = arg == "enable" ? 1 : 0;
+            if (set_feature(static_cast<uint32_t>(FeatureId::HookStats), value) < 0) {
+                printf("Failed to %s hook stats\n", arg.c_str());
+                return 1;
+            }
+            printf("Hook stats %sd\n", arg.c_str());
+            return 0;
+        } else {
+            printf("Usage: ksud debug stats [--reset] | <enable|disable>\n");
+            return 1;
+        }
+    }
+
+    auto stats = get_hook_stats(reset);
+    if (!stats) {
+        printf("Failed to get hook stats\n");
+        return 1;
+    }
+
+    printf("Hook stats: %s\n", stats->enabled ? "enabled" : "disabled");
+    printf("su prefilter: %" PRIu64 " checked, %" PRIu64 " skipped\n",
+           stats->prefilter_checked, stats->prefilter_skipped);
+    printf("umount plans: %u built, last %u mounts in %" PRIu64 " ns, %" PRIu64
+           " replayed, %" PRIu64 " entries skipped\n",
+           stats->umount_plans, stats->umount_plan_size, stats->umount_plan_build_ns,
+           stats->umount_plan_hits, stats->umount_plan_skipped);
+    printf("\n%-24s %10s %10s %10s %10s\n", "HOOK", "COUNT", "AVG(ns)", "P50(ns)", "P99(ns)");
+
+    for (const auto& e : stats->entries) {
+        if (e.count == 0) {
+            continue;
+        }
+        printf("%-24.*s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+               static_cast<int>(sizeof(e.name)), e.name, e.count, e.total_ns / e.count,
+               hist_percentile(e, 50), hist_percentile(e, 99));
+    }
+
+    if (reset) {
+        printf("\nStats reset\n");
+    }
+    return 0;
+}
+
+static void print_sulog_record(const SulogRecord& rec) {
+    char ts[32];
+    time_t secs = static_cast<time_t>(rec.ts_ns / 1000000000ULL);
+    struct tm tm;
+    localtime_r(&secs, &tm);
+    strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
+
+    int comm_len = static_cast<int>(strnlen(rec.comm, sizeof(rec.comm)));
+    int name_len = static_cast<int>(strnlen(rec.name, sizeof(rec.name)));
+    int arg_len = static_cast<int>(strnlen(rec.arg, sizeof(rec.arg)));
+
+    switch (static_cast<SulogEvent>(rec.type)) {
+    case SulogEvent::SuGrant:
+        printf("[%s] SU_GRANT: UID=%u COMM=%.*s METHOD=%.*s PID=%u", ts, rec.uid, comm_len,
+               rec.comm, name_len, rec.name, rec.pid);
+        break;
+    case SulogEvent::SuAttempt:
+        printf("[%s] SU_EXEC: UID=%u COMM=%.*s TARGET=%.*s RESULT=%s PID=%u", ts, rec.uid,
+               comm_len, rec.comm, arg_len, rec.arg, rec.result ? "SUCCESS" : "DENIED", rec.pid);
+        break;
+    case SulogEvent::PermCheck:
+        printf("[%s] PERM_CHECK: UID=%u COMM=%.*s RESULT=%s PID=%u", ts, rec.uid, comm_len,
+               rec.comm, rec.result ? "ALLOWED" : "DENIED", rec.pid);
+        break;
+    case SulogEvent::ManagerOp:
+        printf("[%s] MANAGER_OP: OP=%.*s MANAGER_UID=%u TARGET_UID=%u COMM=%.*s PID=%u", ts,
+               name_len, rec.name, rec.uid, rec.target_uid, comm_len, rec.comm, rec.pid);
+        break;
+    case SulogEvent::Syscall:
+        printf("[%s] SYSCALL: UID=%u COMM=%.*s SYSCALL=%.*s ARGS=%.*s PID=%u", ts, rec.uid,
+               comm_len, rec.comm, name_len, rec.name, arg_len, rec.arg, rec.pid);
+        break;
+    case SulogEvent::Dropped:
+        printf("[%s] OVERFLOW: DROPPED=%u", ts, rec.target_uid);
+        break;
+    default:
+        return;
+    }
+    if (rec.count) {
+        printf(" x%u", rec.count);
+    }
+    printf("\n");
+}
+
+int debug_sulog(const std::vector<std::string>& args) {
+    bool backlog = false;
+
+    for (const auto& arg : args) {
+        if (arg == "--backlog") {
+            backlog = true;
+        } else {
+            printf("Usage: ksud debug sulog [--backlog]\n");
+            return 1;
+        }
+    }
+
+    int fd = get_sulog_fd(backlog);
+    if (fd < 0) {
+        printf("Failed to open sulog stream\n");
+        return 1;
+    }
+
+    // the kernel only hands out whole records, read blocks until one arrives
+    SulogRecord recs[32];
+    while (true) {
+        ssize_t n = read(fd, recs, sizeof(recs));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Failed to read sulog stream: %s\n", strerror(errno));
+            close(fd);
+            return 1;
+        }
+        for (size_t i = 0; i < static_cast<size_t>(n) / sizeof(SulogRecord); i++) {
+            print_sulog_record(recs[i]);
+        }
+        fflush(stdout);
+    }
+}
+
+static const char* const SULOG_TYPE_NAMES[] = {"grant", "exec", "perm", "manager", "syscall"};
+static constexpr size_t SULOG_TYPE_COUNT = sizeof(SULOG_TYPE_NAMES) / sizeof(SULOG_TYPE_NAMES[0]);
+
+static void print_sulog_filter(const SulogFilterCmd& f) {
+    printf("types:");
+    for (size_t i = 0; i < SULOG_TYPE_COUNT; i++) {
+        if (f.type_mask & (1u << i)) {
+            printf(" %s", SULOG_TYPE_NAMES[i]);
+        }
+    }
+    printf("\nignore-uids:");
+    for (uint32_t i = 0; i < f.uid_count && i < KSU_SULOG_FILTER_MAX_UIDS; i++) {
+        printf(" %u", f.uids[i]);
+    }
+    printf("\nignore-ioctls:");
+    for (uint32_t nr = 0; nr < 256; nr++) {
+        if (f.ioctl_mask[nr / 64] & (1ULL << (nr % 64))) {
+            printf(" %u", nr);
+        }
+    }
+    printf("\naggregate: %d\n", (f.flags & KSU_SULOG_FILTER_AGGREGATE) ? 1 : 0);
+}
+
+static bool parse_sulog_filter_arg(const std::string& arg, SulogFilterCmd& f) {
+    auto eq = arg.find('=');
+    if (eq == std::string::npos) {
+        return false;
+    }
+    std::string key = arg.substr(0, eq);
+    std::vector<std::string> values = split(arg.substr(eq + 1), ',');
+
+    try {
+        if (key == "types") {
+            f.type_mask = 0;
+            for (const auto& v : values) {
+                size_t i = 0;
+                while (i < SULOG_TYPE_COUNT && v != SULOG_TYPE_NAMES[i]) {
+                    i++;
+                }
+                if (i == SULOG_TYPE_COUNT) {
+                    return false;
+                }
+                f.type_mask |= 1u << i;
+            }
+        } else if (key == "ignore-uids") {
+            f.uid_count = 0;
+            for (const auto& v : values) {
+                if (v.empty()) {
+                    continue;
+                }
+                if (f.uid_count >= KSU_SULOG_FILTER_MAX_UIDS) {
+                    return false;
+                }
+                f.uids[f.uid_count++] = static_cast<uint32_t>(std::stoul(v));
+            }
+        } else if (key == "ignore-ioctls") {
+            memset(f.ioctl_mask, 0, sizeof(f.ioctl_mask));
+            for (const auto& v : values) {
+                if (v.empty()) {
+                    continue;
+                }
+                unsigned long nr = std::stoul(v);
+                if (nr >= 256) {
+                    return false;
+                }
+                f.ioctl_mask[nr / 64] |= 1ULL << (nr % 64);
+            }
+        } else if (key == "aggregate") {
+            if (values.size() != 1) {
+                return false;
+            }
+            if (std::stoul(values[0])) {
+                f.flags |= KSU_SULOG_FILTER_AGGREGATE;
+            } else {
+                f.flags &= ~KSU_SULOG_FILTER_AGGREGATE;
+            }
+        } else {
+            return false;
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+int debug_sulog_filter(const std::vector<std::string>& args) {
+    auto filter = get_sulog_filter();
+    if (!filter) {
+        printf("Failed to get sulog filter\n");
+        return 1;
+    }
+
+    if (args.empty()) {
+        print_sulog_filter(*filter);
+        return 0;
+    }
+
+    for (const auto& arg : args) {
+        if (!parse_sulog_filter_arg(arg, *filter)) {
+            printf("Usage: ksud debug sulog-filter [types=grant,exec,perm,manager,syscall] "
+                   "[ignore-uids=UID,...] [ignore-ioctls=NR,...] [aggregate=0|1]\n");
+            return 1;
+        }
+    }
+
+    if (set_sulog_filter(*filter) < 0) {
+        printf("Failed to set sulog filter\n");
+        return 1;
+    }
+    print_sulog_filter(*filter);
+    return 0;
+}
+
+static void print_event(const KsuEvent& ev) {
+    switch (static_cast<KsuEventType>(ev.type)) {
+    case KsuEventType::Allowlist:
+        printf("ALLOWLIST: GEN=%" PRIu64 "\n", ev.value);
+        break;
+    case KsuEventType::Manager:
+        printf("MANAGER: UID=%d GEN=%" PRIu64 "\n", static_cast<int32_t>(ev.arg), ev.value);
+        break;
+    case KsuEventType::Feature:
+        printf("FEATURE: ID=%u VALUE=%" PRIu64 "\n", ev.arg, ev.value);
+        break;
+    case KsuEventType::Packages:
+        printf("PACKAGES: CHANGED=%u\n", ev.arg);
+        break;
+    case KsuEventType::ModuleMounted:
+        printf("MODULE_MOUNTED\n");
+        break;
+    case KsuEventType::BootCompleted:
+        printf("BOOT_COMPLETED\n");
+        break;
+    default:
+        printf("UNKNOWN: TYPE=%u\n", ev.type);
+        break;
+    }
+}
+
+int debug_events(const std::vector<std::string>& args) {
+    if (!args.empty()) {
+        printf("Usage: ksud debug events\n");
+        return 1;
+    }
+
+    int fd = get_event_fd(0);
+    if (fd < 0) {
+        printf("Failed to open event fd\n");
+        return 1;
+    }
+
+    KsuEvent evs[16];
+    while (true) {
+        ssize_t n = read(fd, evs, sizeof(evs));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Failed to read events: %s\n", strerror(errno));
+            close(fd);
+            return 1;
+        }
+        for (size_t i = 0; i < static_cast<size_t>(n) / sizeof(KsuEvent); i++) {
+            print_event(evs[i]);
+        }
+        fflush(stdout);
+    }
+}
+
 }  // namespace ksud
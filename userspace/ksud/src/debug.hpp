@@ -8,5 +8,9 @@ namespace ksud {
 int debug_set_manager(const std::string& pkg);
 int debug_get_sign(const std::string& apk);
 int debug_mark(const std::vector<std::string>& args);
+int debug_stats(const std::vector<std::string>& args);
+int debug_sulog(const std::vector<std::string>& args);
+int debug_sulog_filter(const std::vector<std::string>& args);
+int debug_events(const std::vector<std::string>& args);
 
 }  // namespace ksud
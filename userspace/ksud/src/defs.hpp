@@ -63,6 +63,10 @@ enum class FeatureId : uint32_t {
     KernelUmount = 1,
     EnhancedSecurity = 2,
     SuLog = 100,
+    HookStats = 101,
+    SulogFsyncInterval = 102,
+    ThroneDebounce = 103,
+    ThroneMaxDelay = 104,
 };
 
 // ioctl constants
@@ -83,5 +87,9 @@ constexpr uint32_t KSU_MARK_REFRESH = 4;
 constexpr uint8_t UMOUNT_WIPE = 0;
 constexpr uint8_t UMOUNT_ADD = 1;
 constexpr uint8_t UMOUNT_DEL = 2;
+constexpr uint8_t UMOUNT_ADD_BULK = 3;
+constexpr uint8_t UMOUNT_DEL_BULK = 4;
+constexpr uint8_t UMOUNT_REPLACE = 5;
+constexpr uint8_t UMOUNT_GET_BULK = 6;
 
 }  // namespace ksud
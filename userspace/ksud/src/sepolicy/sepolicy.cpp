@@ -529,22 +529,8 @@ static bool parse_rule(const std::string& rule, std::vector<AtomicStatement>& st
     return false;
 }
 
-// Apply a single atomic statement to kernel
-static int apply_statement(const AtomicStatement& stmt) {
-    FfiPolicy ffi = stmt.to_ffi();
-
-    SetSepolicyCmd cmd;
-    cmd.cmd = 0;
-    cmd.arg = reinterpret_cast<uint64_t>(&ffi);
-
-    int ret = set_sepolicy(cmd);
-    if (ret < 0) {
-        LOGW("Failed to apply sepolicy: cmd=%u subcmd=%u", ffi.cmd, ffi.subcmd);
-    }
-    return ret;
-}
-
 int sepolicy_live_patch(const std::string& policy) {
+    // every statement is queued first, FfiPolicy points into them
     std::vector<AtomicStatement> statements;
     int errors = 0;
 
@@ -569,15 +555,31 @@ int sepolicy_live_patch(const std::string& policy) {
                 continue;
             }
 
-            for (const auto& stmt : rule_stmts) {
-                if (apply_statement(stmt) < 0) {
-                    errors++;
-                }
-            }
+            statements.insert(statements.end(), rule_stmts.begin(), rule_stmts.end());
+        }
+    }
+
+    std::vector<FfiPolicy> ffis;
+    ffis.reserve(statements.size());
+    KsuBatch batch;
+    for (const auto& stmt : statements) {
+        ffis.push_back(stmt.to_ffi());
+        SetSepolicyCmd cmd = {0, reinterpret_cast<uint64_t>(&ffis.back())};
+        batch.add(KSU_IOCTL_SET_SEPOLICY, cmd);
+    }
+
+    int failed = batch.flush();
+    if (failed < 0) {
+        LOGW("Failed to submit sepolicy statements");
+        return 1;
+    }
+    for (size_t i = 0; i < ffis.size(); i++) {
+        if (batch.result(i) < 0) {
+            LOGW("Failed to apply sepolicy: cmd=%u subcmd=%u", ffis[i].cmd, ffis[i].subcmd);
         }
     }
 
-    return errors > 0 ? 1 : 0;
+    return errors + failed > 0 ? 1 : 0;
 }
 
 int sepolicy_apply_file(const std::string& file) {
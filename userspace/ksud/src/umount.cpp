@@ -5,6 +5,7 @@
 #include "utils.hpp"
 
 #include <unistd.h>
+#include <cstring>
 #include <algorithm>
 #include <fstream>
 #include <sstream>
@@ -12,11 +13,6 @@
 
 namespace ksud {
 
-struct UmountEntry {
-    std::string path;
-    uint32_t flags;
-};
-
 static std::vector<UmountEntry> load_umount_config() {
     std::vector<UmountEntry> entries;
     auto content = read_file(UMOUNT_CONFIG_PATH);
@@ -82,15 +78,10 @@ int umount_remove_entry(const std::string& mnt) {
     return 0;
 }
 
-int umount_save_config() {
-    auto list = umount_list_list();
-    if (!list) {
-        LOGE("Failed to get umount list from kernel");
-        return 1;
-    }
-
+// Text form of the list, for kernels without UMOUNT_GET_BULK
+static std::vector<UmountEntry> parse_umount_list(const std::string& list) {
     std::vector<UmountEntry> entries;
-    std::istringstream iss(*list);
+    std::istringstream iss(list);
     std::string line;
     while (std::getline(iss, line)) {
         line = trim(line);
@@ -108,25 +99,47 @@ int umount_save_config() {
         }
         entries.push_back(entry);
     }
+    return entries;
+}
+
+int umount_save_config() {
+    auto entries = umount_list_entries();
+    if (!entries) {
+        auto list = umount_list_list();
+        if (!list) {
+            LOGE("Failed to get umount list from kernel");
+            return 1;
+        }
+        entries = parse_umount_list(*list);
+    }
 
-    if (!save_umount_entries(entries)) {
+    if (!save_umount_entries(*entries)) {
         LOGE("Failed to save umount config");
         return 1;
     }
 
-    LOGI("Saved umount config with %zu entries", entries.size());
+    LOGI("Saved umount config with %zu entries", entries->size());
     return 0;
 }
 
-int umount_apply_config() {
-    auto entries = load_umount_config();
-
+// One ioctl per entry, for kernels without UMOUNT_ADD_BULK
+static int umount_apply_entries(const std::vector<UmountEntry>& entries) {
+    KsuBatch batch;
     for (const auto& entry : entries) {
-        int ret = umount_list_add(entry.path, entry.flags);
-        if (ret < 0) {
-            LOGW("Failed to add %s to umount list", entry.path.c_str());
+        AddTryUmountCmd cmd = {reinterpret_cast<uint64_t>(entry.path.c_str()), entry.flags,
+                               UMOUNT_ADD};
+        batch.add(KSU_IOCTL_ADD_TRY_UMOUNT, cmd);
+    }
+    if (batch.flush() < 0) {
+        LOGE("Failed to submit umount entries");
+        return 1;
+    }
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (batch.result(i) < 0) {
+            LOGW("Failed to add %s to umount list", entries[i].path.c_str());
         } else {
-            LOGD("Added %s to umount list (flags=%u)", entry.path.c_str(), entry.flags);
+            LOGD("Added %s to umount list (flags=%u)", entries[i].path.c_str(), entries[i].flags);
         }
     }
 
@@ -134,6 +147,25 @@ int umount_apply_config() {
     return 0;
 }
 
+int umount_apply_config() {
+    auto entries = load_umount_config();
+    if (entries.empty()) {
+        return 0;
+    }
+
+    // older kernels reject the mode, a bad entry fails the whole bulk add;
+    // either way one call per entry still gets the rest in
+    int added = umount_list_add_bulk(entries);
+    if (added < 0) {
+        LOGD("Bulk umount add failed: %s", strerror(-added));
+        return umount_apply_entries(entries);
+    }
+
+    // entries that were listed already don't count
+    LOGI("Applied %zu umount entries, %d new", entries.size(), added);
+    return 0;
+}
+
 int umount_clear_config() {
     // Clear kernel list
     int ret = umount_list_wipe();